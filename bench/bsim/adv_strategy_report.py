@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Compares station advertising strategies by detection latency and probability.
+
+Reads the runs of sweep_adv_strategy.sh, each a directory with sweep.json
+(strategy and observer scan setting) and report.json (bench_report.py
+output). For every scan setting it prints the detection probability, the
+share of punches detected within the feedback deadline, the punch-to-rx
+latency and the air time each strategy spends on a punch. It then names
+the fastest strategy and the one with the least air time that still
+detects the target share of the punches within the deadline.
+
+Air time counts the three primary channels of every advertising event, a
+legacy ADV_NONCONN_IND on the 1M PHY with the default payload. Span is
+the nominal time from the first to the last event of a punch.
+"""
+
+import argparse
+import json
+import os
+import sys
+from collections import defaultdict
+
+# Flags, 17 bytes of manufacturer data and "SI Beacon" after the address,
+# plus preamble, access address, header and CRC, at 8 us per byte
+ADV_PDU_US = (1 + 4 + 2 + 6 + 3 + 19 + 11 + 3) * 8
+ADV_CHANNELS = 3
+# Mean of the random advDelay added to every interval
+ADV_DELAY_MS = 5
+
+
+def events(params):
+    return params['events'] + params.get('backoff_events', 0)
+
+
+def airtime_us(params):
+    return events(params) * ADV_CHANNELS * ADV_PDU_US
+
+
+def span_ms(params):
+    if params['kind'] == 'fixed':
+        # The controller picks an interval between the minimum and 10 ms more
+        return (params['events'] - 1) * (params['interval_ms'] + 5 + ADV_DELAY_MS)
+    span = (params['events'] - 1) * (params['interval_ms'] + ADV_DELAY_MS)
+    if params.get('backoff_events'):
+        # The back-off starts right after the sent event of the burst
+        span += params['interval_ms'] + \
+            (params['backoff_events'] - 1) * (params['backoff_interval_ms'] + ADV_DELAY_MS)
+    return span
+
+
+def load(dirs):
+    runs = defaultdict(dict)
+    for d in dirs:
+        try:
+            with open(os.path.join(d, 'sweep.json')) as f:
+                params = json.load(f)
+            with open(os.path.join(d, 'report.json')) as f:
+                report = json.load(f)
+        except (OSError, ValueError) as e:
+            print(f'Skipping {d}: {e}', file=sys.stderr)
+            continue
+        scan = f"{params['scan_interval']}/{params['scan_window']}"
+        runs[scan][params['strategy']] = (params, report)
+    return runs
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--target', type=float, default=0.99,
+                        help='lowest acceptable share of punches detected within the deadline')
+    parser.add_argument('--deadline-ms', type=int, default=200,
+                        help='feedback deadline, one of the bench_report.py deadlines')
+    parser.add_argument('--json', help='also write all results to this file')
+    parser.add_argument('runs', nargs='+', help='run directories of the sweep')
+    args = parser.parse_args()
+
+    runs = load(args.runs)
+    if not runs:
+        sys.exit('No complete runs found')
+    deadline = f'{args.deadline_ms}_ms'
+
+    def ms(v):
+        return f'{"-":>7}' if v is None else f'{v / 1000:>7.1f}'
+
+    def pct(v):
+        return f'{"-":>8}' if v is None else f'{100 * v:>7.2f}%'
+
+    results = []
+    picks = {}
+    for scan in sorted(runs):
+        print(f'Scan interval/window {scan}')
+        print(f'{"strategy":<24}{"events":>7}{"air ms":>8}{"span ms":>8}{"detect":>9}'
+              f'{"<" + str(args.deadline_ms) + " ms":>9}{"p50 ms":>8}{"p95 ms":>8}{"p99 ms":>8}')
+        rows = []
+        for strategy, (params, report) in sorted(runs[scan].items(),
+                                                 key=lambda kv: airtime_us(kv[1][0])):
+            loss = report.get('loss_rate')
+            within = report.get('detected_within', {}).get(deadline)
+            rx = report['punch_to_rx']
+            row = {
+                'strategy': strategy,
+                'scan': scan,
+                'events': events(params),
+                'airtime_us': airtime_us(params),
+                'span_ms': span_ms(params),
+                'detection': None if loss is None else 1 - loss,
+                'detected_within_deadline': within,
+                'p50_us': rx['p50_us'],
+                'p95_us': rx['p95_us'],
+                'p99_us': rx['p99_us'],
+            }
+            rows.append(row)
+            print(f'{strategy:<24}{row["events"]:>7}{row["airtime_us"] / 1000:>8.1f}'
+                  f'{row["span_ms"]:>8} {pct(row["detection"])} {pct(within)}'
+                  f' {ms(rx["p50_us"])} {ms(rx["p95_us"])} {ms(rx["p99_us"])}')
+        results.extend(rows)
+
+        timed = [r for r in rows if r['p95_us'] is not None]
+        ok = [r for r in rows if r['detected_within_deadline'] is not None and
+              r['detected_within_deadline'] >= args.target]
+        if timed:
+            fastest = min(timed, key=lambda r: (r['p95_us'], r['airtime_us']))
+            print(f'Fastest: {fastest["strategy"]}, p95 {fastest["p95_us"] / 1000:.1f} ms')
+        if ok:
+            pick = min(ok, key=lambda r: (r['airtime_us'], r['p95_us'] or 0))
+            picks[scan] = pick
+            print(f'Least air time with {100 * args.target:.2f}% within {args.deadline_ms} ms: '
+                  f'{pick["strategy"]}, {pick["airtime_us"] / 1000:.1f} ms per punch')
+        else:
+            print(f'No strategy detects {100 * args.target:.2f}% within {args.deadline_ms} ms')
+        print()
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'target': args.target, 'deadline_ms': args.deadline_ms,
+                       'results': results, 'picks': picks}, f, indent=2)
+
+    return 0 if picks else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,243 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Matches station emulator punches against SI Voice observer events.
+
+Station logs need CONFIG_MOCK_STATION_PUNCH_LOG, the observer log needs
+CONFIG_SI_VOICE_BENCH_LOG. All simulated devices share the BabbleSim clock,
+so the microsecond timestamps of the different logs are directly comparable.
+
+A punch is identified by (SIAC ID, control, sequence number). Sequence
+numbers are per station, so when two stations happen to send the same key
+an observer event is credited to the latest punch pressed before it.
+"""
+
+import argparse
+import bisect
+import json
+import re
+import sys
+from collections import defaultdict
+
+PUNCH_RE = re.compile(r'Punch (\d+): SIAC (\d+) control (\d+) pressed at (\d+) us, '
+                      r'advertising (\w+)')
+BENCH_RE = re.compile(r'BENCH (rx|spi) (\d+) (\d+) (\d+) (\d+)')
+# Advertising reports and SI reports received so far, once a second
+SCAN_RE = re.compile(r'BENCH scan (\d+) (\d+) (\d+)')
+# Per announcement SPI and speech IC cost, only with the speech IC emulator
+ISC_RE = re.compile(r'BENCH isc (\d+) (\d+) (\d+) (\d+) (\d+) (\d+) (\d+)')
+# Boot steps done, microseconds after the kernel started
+BOOT_RE = re.compile(r'BENCH boot ([\w-]+) (\d+)')
+
+# Athlete feedback deadlines, the share of advertised punches detected within each is reported
+DEADLINES_MS = (50, 100, 200, 500, 1000)
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+def parse_stations(paths):
+    punches = defaultdict(list)
+    for device, path in enumerate(paths, start=1):
+        with open(path, errors='replace') as f:
+            for line in f:
+                m = PUNCH_RE.search(line)
+                if not m:
+                    continue
+                seq, siac, control, pressed_us, status = m.groups()
+                punches[(int(siac), int(control), int(seq))].append({
+                    'device': device,
+                    'pressed_us': int(pressed_us),
+                    'advertised': status == 'started',
+                    'rx': [],
+                    'spi': [],
+                    'isc': [],
+                })
+    for candidates in punches.values():
+        candidates.sort(key=lambda p: p['pressed_us'])
+    return punches
+
+
+def attach_observer_events(path, punches, window_us):
+    unmatched = defaultdict(int)
+    scan = []
+    boot = {}
+    with open(path, errors='replace') as f:
+        for line in f:
+            m = BOOT_RE.search(line)
+            if m:
+                boot.setdefault(m.group(1), int(m.group(2)))
+                continue
+            m = SCAN_RE.search(line)
+            if m:
+                scan.append(tuple(map(int, m.groups())))
+                continue
+            m = ISC_RE.search(line)
+            if m:
+                siac, control, seq, nbytes, transfers, busy_us, errors = map(int, m.groups())
+                for p in reversed(punches.get((siac, control, seq), [])):
+                    if p['spi']:
+                        p['isc'].append({'bytes': nbytes, 'transfers': transfers,
+                                         'busy_us': busy_us, 'errors': errors})
+                        break
+                continue
+            m = BENCH_RE.search(line)
+            if not m:
+                continue
+            kind, siac, control, seq, at_us = m.groups()
+            at_us = int(at_us)
+            candidates = punches.get((int(siac), int(control), int(seq)), [])
+            i = bisect.bisect_right([p['pressed_us'] for p in candidates], at_us) - 1
+            if i < 0 or at_us - candidates[i]['pressed_us'] > window_us:
+                unmatched[kind] += 1
+                continue
+            candidates[i][kind].append(at_us)
+    return unmatched, scan, boot
+
+
+def scan_load(scan):
+    """Reports per second over the run, from the first to the last BENCH scan line."""
+    if len(scan) < 2 or scan[-1][2] <= scan[0][2]:
+        return {'reports': scan[-1][0] if scan else None,
+                'si_reports': scan[-1][1] if scan else None,
+                'reports_per_s': None, 'si_reports_per_s': None}
+    seconds = (scan[-1][2] - scan[0][2]) / 1e6
+    return {
+        'reports': scan[-1][0],
+        'si_reports': scan[-1][1],
+        'reports_per_s': (scan[-1][0] - scan[0][0]) / seconds,
+        'si_reports_per_s': (scan[-1][1] - scan[0][1]) / seconds,
+    }
+
+
+def summarize(punches, unmatched, scan, boot):
+    all_punches = [p for candidates in punches.values() for p in candidates]
+    detected = [p for p in all_punches if p['rx']]
+    announced = [p for p in all_punches if p['spi']]
+    rx_latency = [min(p['rx']) - p['pressed_us'] for p in detected]
+    spi_latency = [min(p['spi']) - p['pressed_us'] for p in announced]
+
+    def stats(values):
+        return {
+            'count': len(values),
+            'p50_us': percentile(values, 50),
+            'p95_us': percentile(values, 95),
+            'p99_us': percentile(values, 99),
+            'max_us': max(values) if values else None,
+        }
+
+    isc = [i for p in announced for i in p['isc']]
+
+    def isc_stats(key):
+        values = [i[key] for i in isc]
+        return {
+            'mean': sum(values) / len(values) if values else None,
+            'p50': percentile(values, 50),
+            'p95': percentile(values, 95),
+            'max': max(values) if values else None,
+        }
+
+    total = len(all_punches)
+    advertised = [p for p in all_punches if p['advertised']]
+    lost = sum(1 for p in advertised if not p['rx'])
+    first_rx = [min(p['rx']) - p['pressed_us'] for p in advertised if p['rx']]
+    return {
+        'punches': total,
+        'advertised': len(advertised),
+        'detected': len(detected),
+        'detection_rate': len(detected) / total if total else None,
+        'lost': lost,
+        'loss_rate': lost / len(advertised) if advertised else None,
+        'announced': len(announced),
+        'announcement_rate': len(announced) / total if total else None,
+        'detected_within': {
+            f'{d}_ms': (sum(1 for l in first_rx if l <= d * 1000) / len(advertised)
+                        if advertised else None)
+            for d in DEADLINES_MS
+        },
+        'duplicate_reports': sum(len(p['rx']) - 1 for p in detected),
+        'duplicate_announcements': sum(len(p['spi']) - 1 for p in announced),
+        'unmatched_rx': unmatched['rx'],
+        'unmatched_spi': unmatched['spi'],
+        'scan': scan_load(scan),
+        'boot_to_scanning_us': boot.get('scanning'),
+        'boot_to_audio_ready_us': boot.get('audio-ready'),
+        'punch_to_rx': stats(rx_latency),
+        'punch_to_spi_start': stats(spi_latency),
+        'announcement_cost': {
+            'count': len(isc),
+            'spi_bytes': isc_stats('bytes'),
+            'spi_transfers': isc_stats('transfers'),
+            'ic_busy_us': isc_stats('busy_us'),
+            'isc_errors': sum(i['errors'] for i in isc),
+        },
+    }
+
+
+def print_summary(s):
+    def rate(r):
+        return 'n/a' if r is None else f'{100 * r:.2f} %'
+
+    def us(v):
+        return 'n/a' if v is None else f'{v / 1000:.2f} ms'
+
+    print(f"Punches:                 {s['punches']} ({s['advertised']} advertised)")
+    print(f"Detected:                {s['detected']} ({rate(s['detection_rate'])})")
+    print(f"Lost after advertising:  {s['lost']} ({rate(s['loss_rate'])})")
+    print('Detected within:         ' +
+          ', '.join(f"{d} ms {rate(s['detected_within'][f'{d}_ms'])}" for d in DEADLINES_MS))
+    print(f"Announced:               {s['announced']} ({rate(s['announcement_rate'])})")
+    print(f"Duplicate reports:       {s['duplicate_reports']}")
+    print(f"Duplicate announcements: {s['duplicate_announcements']}")
+    print(f"Unmatched rx/spi events: {s['unmatched_rx']}/{s['unmatched_spi']}")
+    if s['boot_to_scanning_us'] is not None or s['boot_to_audio_ready_us'] is not None:
+        print(f"Boot:                    scanning at {us(s['boot_to_scanning_us'])}, "
+              f"audio ready at {us(s['boot_to_audio_ready_us'])}")
+    if s['scan']['reports_per_s'] is not None:
+        print(f"Report load:             {s['scan']['reports_per_s']:.0f} reports/s, "
+              f"{s['scan']['si_reports_per_s']:.0f} SI reports/s")
+    for name in ('punch_to_rx', 'punch_to_spi_start'):
+        l = s[name]
+        print(f"{name + ':':24} p50 {us(l['p50_us'])}, p95 {us(l['p95_us'])}, "
+              f"p99 {us(l['p99_us'])}, max {us(l['max_us'])}")
+    cost = s['announcement_cost']
+    if cost['count']:
+        print(f"Per announcement:        {cost['spi_bytes']['mean']:.0f} SPI bytes in "
+              f"{cost['spi_transfers']['mean']:.1f} transfers, "
+              f"IC busy {us(cost['ic_busy_us']['mean'])} (mean of {cost['count']}), "
+              f"{cost['isc_errors']} ISC errors")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--observer', required=True, help='observer log')
+    parser.add_argument('--window-ms', type=int, default=10000,
+                        help='longest punch-to-event time credited to a punch')
+    parser.add_argument('--json', help='also write the summary to this file')
+    parser.add_argument('stations', nargs='+', help='station emulator logs')
+    args = parser.parse_args()
+
+    punches = parse_stations(args.stations)
+    if not punches:
+        sys.exit('No punches found, was CONFIG_MOCK_STATION_PUNCH_LOG enabled?')
+
+    unmatched, scan, boot = attach_observer_events(args.observer, punches, args.window_ms * 1000)
+    summary = summarize(punches, unmatched, scan, boot)
+    print_summary(summary)
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(summary, f, indent=2)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env bash
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+#
+# Runs N emulated SI stations against one SI Voice observer in BabbleSim
+# and reports detection rate, duplicates and punch-to-SPI-start latency.
+#
+# Requires ZEPHYR_BASE, BSIM_OUT_PATH and BSIM_COMPONENTS_PATH to be set,
+# see https://docs.zephyrproject.org/latest/boards/posix/nrf52_bsim/doc/index.html
+#
+# Usage: run_bench.sh [options]
+#   -n <stations>      emulated stations, one simulated device each (default 4)
+#   -a <ms>            station advertising interval in ms (default 20)
+#   -i <units>         observer scan interval in 0.625 ms units (default 0x60)
+#   -w <units>         observer scan window in 0.625 ms units (default 0x30)
+#   -r <punches/s>     load generator rate per station (default 2)
+#   -p <punches>       punches per station, 0 to run until -t (default 200)
+#   -t <s>             simulated time in seconds (default 150)
+#   -m load_gen|race_replay  station mode (default load_gen)
+#   -o <dir>           output directory (default ./bench_out)
+#   -e <args>          extra CMake arguments for the observer build, e.g.
+#                      "-DCONFIG_BT_BUF_EVT_DISCARDABLE_COUNT=2"
+#   -s                 skip the build and reuse the images in the output directory
+
+set -eu
+
+STATIONS=4
+ADV_INTERVAL_MS=20
+SCAN_INTERVAL=0x60
+SCAN_WINDOW=0x30
+PUNCH_RATE=2
+PUNCHES=200
+SIM_TIME_S=150
+MODE=load_gen
+OUT_DIR=$(pwd)/bench_out
+SKIP_BUILD=0
+OBSERVER_ARGS=""
+
+while getopts "n:a:i:w:r:p:t:m:o:e:s" opt; do
+	case $opt in
+	n) STATIONS=$OPTARG ;;
+	a) ADV_INTERVAL_MS=$OPTARG ;;
+	i) SCAN_INTERVAL=$OPTARG ;;
+	w) SCAN_WINDOW=$OPTARG ;;
+	r) PUNCH_RATE=$OPTARG ;;
+	p) PUNCHES=$OPTARG ;;
+	t) SIM_TIME_S=$OPTARG ;;
+	m) MODE=$OPTARG ;;
+	o) OUT_DIR=$OPTARG ;;
+	e) OBSERVER_ARGS=$OPTARG ;;
+	s) SKIP_BUILD=1 ;;
+	*) sed -n '2,/^$/p' "$0" >&2; exit 1 ;;
+	esac
+done
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set}"
+: "${BSIM_COMPONENTS_PATH:?BSIM_COMPONENTS_PATH must be set}"
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(cd "$SCRIPT_DIR/../.." && pwd)
+SIM_ID=si_voice_bench_$$
+BSIM_BIN=$BSIM_OUT_PATH/bin
+
+mkdir -p "$OUT_DIR"
+
+if [ "$SKIP_BUILD" -eq 0 ]; then
+	# shellcheck disable=SC2086
+	west build -p always -b nrf52_bsim -d "$OUT_DIR/build_observer" \
+		"$REPO_DIR/ble_observer" -- \
+		-DCONFIG_SI_VOICE_BENCH_LOG=y \
+		-DCONFIG_SI_VOICE_SCAN_INTERVAL="$SCAN_INTERVAL" \
+		-DCONFIG_SI_VOICE_SCAN_WINDOW="$SCAN_WINDOW" \
+		$OBSERVER_ARGS
+
+	STATION_ARGS="-DOVERLAY_CONFIG=$MODE.conf \
+		-DCONFIG_MOCK_STATION_PUNCH_LOG=y \
+		-DCONFIG_MOCK_STATION_ADV_INTERVAL_MS=$ADV_INTERVAL_MS"
+	if [ "$MODE" = load_gen ]; then
+		STATION_ARGS="$STATION_ARGS \
+			-DCONFIG_LOAD_GEN_PUNCH_RATE=$PUNCH_RATE \
+			-DCONFIG_LOAD_GEN_PUNCHES=$PUNCHES"
+	fi
+	# shellcheck disable=SC2086
+	west build -p always -b nrf52_bsim -d "$OUT_DIR/build_station" \
+		"$REPO_DIR/multiple_adv_sets" -- $STATION_ARGS
+fi
+
+OBSERVER_EXE=$OUT_DIR/build_observer/zephyr/zephyr.exe
+STATION_EXE=$OUT_DIR/build_station/zephyr/zephyr.exe
+
+DEVICES=$((STATIONS + 1))
+SIM_LEN_US=$((SIM_TIME_S * 1000000))
+PIDS=""
+
+cd "$BSIM_BIN"
+
+"$OBSERVER_EXE" -s="$SIM_ID" -d=0 -rs=1 > "$OUT_DIR/observer.log" 2>&1 &
+PIDS="$PIDS $!"
+
+for i in $(seq 1 "$STATIONS"); do
+	# Each station gets its own random seed so the load generators do not punch in lockstep
+	"$STATION_EXE" -s="$SIM_ID" -d="$i" -rs=$((i + 100)) > "$OUT_DIR/station_$i.log" 2>&1 &
+	PIDS="$PIDS $!"
+done
+
+./bs_2G4_phy_v1 -s="$SIM_ID" -D="$DEVICES" -sim_length="$SIM_LEN_US" > "$OUT_DIR/phy.log" 2>&1
+
+# shellcheck disable=SC2086
+wait $PIDS || true
+
+python3 "$SCRIPT_DIR/bench_report.py" \
+	--observer "$OUT_DIR/observer.log" \
+	--json "$OUT_DIR/report.json" \
+	"$OUT_DIR"/station_*.log
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Picks the smallest Bluetooth RX buffer set that meets a punch loss target.
+
+Reads the runs of sweep_rx_buffers.sh, each a directory with sweep.json
+(station count and buffer counts) and report.json (bench_report.py
+output). Prints the loss of every buffer set at every station count and
+picks the set with the least RAM whose loss stays at or under the target
+at all station counts. With --conf the pick is written as a Kconfig
+fragment for the observer.
+
+The RAM of a buffer set is estimated from the buffer sizes: a host event
+buffer is its data plus the net_buf header and Bluetooth user data, a
+controller RX buffer is a node of the Zephyr LL RX pool with room for an
+extended advertising PDU. The estimate is for ranking the sets, measure
+the final build with ble_observer/scripts/memory_budget.py.
+"""
+
+import argparse
+import json
+import os
+import sys
+from collections import defaultdict
+
+EVT_RX_SIZE = 255		# CONFIG_BT_BUF_EVT_RX_SIZE with extended advertising
+EVT_DISCARDABLE_SIZE = 58	# CONFIG_BT_BUF_EVT_DISCARDABLE_SIZE with extended advertising
+NET_BUF_OVERHEAD = 32		# struct net_buf and the 8 bytes of Bluetooth user data
+CTLR_RX_NODE_SIZE = 288		# Zephyr LL RX node with a 255 byte PDU
+
+KEYS = ('evt_rx_count', 'evt_discardable_count', 'ctlr_rx_buffers')
+
+
+def ram_estimate(cfg):
+    evt, disc, ctlr = cfg
+    return (evt * (EVT_RX_SIZE + NET_BUF_OVERHEAD) +
+            disc * (EVT_DISCARDABLE_SIZE + NET_BUF_OVERHEAD) +
+            ctlr * CTLR_RX_NODE_SIZE)
+
+
+def load(dirs):
+    runs = defaultdict(dict)
+    for d in dirs:
+        try:
+            with open(os.path.join(d, 'sweep.json')) as f:
+                params = json.load(f)
+            with open(os.path.join(d, 'report.json')) as f:
+                report = json.load(f)
+        except (OSError, ValueError) as e:
+            print(f'Skipping {d}: {e}', file=sys.stderr)
+            continue
+        cfg = tuple(params[k] for k in KEYS)
+        runs[cfg][params['stations']] = report
+    return runs
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--target', type=float, default=0.001,
+                        help='highest acceptable punch loss, as a fraction')
+    parser.add_argument('--conf', help='write the picked buffer set to this Kconfig fragment')
+    parser.add_argument('--json', help='also write all results to this file')
+    parser.add_argument('runs', nargs='+', help='run directories of the sweep')
+    args = parser.parse_args()
+
+    runs = load(args.runs)
+    if not runs:
+        sys.exit('No complete runs found')
+    stations = sorted({n for reports in runs.values() for n in reports})
+
+    print(f'{"event":>5} {"disc":>4} {"ctlr":>4} {"RAM":>6}  ' +
+          ''.join(f'{f"{n} st loss":>12}{"rep/s":>7}' for n in stations))
+    results = []
+    for cfg in sorted(runs, key=ram_estimate):
+        reports = runs[cfg]
+        row = f'{cfg[0]:>5} {cfg[1]:>4} {cfg[2]:>4} {ram_estimate(cfg):>6}  '
+        worst = 0.0
+        complete = True
+        for n in stations:
+            r = reports.get(n)
+            if r is None or r['loss_rate'] is None:
+                row += f'{"-":>12}{"-":>7}'
+                complete = False
+                continue
+            worst = max(worst, r['loss_rate'])
+            load_per_s = r.get('scan', {}).get('reports_per_s')
+            row += f'{100 * r["loss_rate"]:>11.2f}%' + \
+                (f'{load_per_s:>7.0f}' if load_per_s is not None else f'{"-":>7}')
+        print(row)
+        results.append({
+            **dict(zip(KEYS, cfg)),
+            'ram_estimate': ram_estimate(cfg),
+            'worst_loss_rate': worst if complete else None,
+            'loss_rate': {n: reports[n]['loss_rate'] for n in reports},
+        })
+
+    ok = [r for r in results if r['worst_loss_rate'] is not None and
+          r['worst_loss_rate'] <= args.target]
+    print()
+    if not ok:
+        print(f'No buffer set keeps the loss at or under {100 * args.target:.2f}% '
+              f'with {stations[-1]} stations')
+        pick = None
+    else:
+        pick = min(ok, key=lambda r: (r['ram_estimate'], r['worst_loss_rate']))
+        print(f'Smallest set with loss at or under {100 * args.target:.2f}% up to '
+              f'{stations[-1]} stations: {pick["evt_rx_count"]} event, '
+              f'{pick["evt_discardable_count"]} discardable, {pick["ctlr_rx_buffers"]} '
+              f'controller buffers, about {pick["ram_estimate"]} bytes, '
+              f'worst loss {100 * pick["worst_loss_rate"]:.2f}%')
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump({'target': args.target, 'results': results, 'pick': pick}, f, indent=2)
+
+    if args.conf and pick:
+        with open(args.conf, 'w') as f:
+            f.write('# Bluetooth RX buffers picked by bench/bsim/sweep_rx_buffers.sh:\n'
+                    f'# punch loss at most {100 * pick["worst_loss_rate"]:.2f}% '
+                    f'(target {100 * args.target:.2f}%) with up to {stations[-1]} stations.\n'
+                    '# The controller count was measured on the Zephyr LL, use it for\n'
+                    '# CONFIG_BT_CTLR_SDC_SCAN_BUFFER_COUNT with the SoftDevice Controller.\n'
+                    f'CONFIG_BT_BUF_EVT_RX_COUNT={pick["evt_rx_count"]}\n'
+                    f'CONFIG_BT_BUF_EVT_DISCARDABLE_COUNT={pick["evt_discardable_count"]}\n'
+                    f'CONFIG_BT_CTLR_RX_BUFFERS={pick["ctlr_rx_buffers"]}\n')
+        print(f'Written to {args.conf}')
+
+    return 0 if pick else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
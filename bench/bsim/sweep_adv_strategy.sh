@@ -0,0 +1,137 @@
+#!/usr/bin/env bash
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+#
+# Compares station advertising strategies in BabbleSim by the observer's
+# detection latency and detection probability.
+#
+# Every strategy is run with run_bench.sh against every observer scan
+# setting. A strategy is written as
+#   fixed:<ms>x<events>                  <events> at <ms> to <ms> + 10 ms
+#   burst:<ms>x<events>+<ms>x<events>    a burst at the first interval, then
+#                                        a back-off at the second
+# The station is built once per strategy and the observer once per scan
+# setting, written as <interval>/<window> in 0.625 ms units.
+#
+# Requires the same environment as run_bench.sh.
+#
+# Usage: sweep_adv_strategy.sh [options]
+#   -S "<strategies>"  strategies to compare
+#                      (default "fixed:100x5 fixed:20x5 burst:20x5+200x3 burst:20x3+100x4")
+#   -W "<scans>"       observer scan settings (default "0x60/0x30 0xa0/0x10")
+#   -n <stations>      emulated stations (default 4)
+#   -r <punches/s>     load generator rate per station (default 2)
+#   -p <punches>       punches per station (default 200)
+#   -t <s>             simulated time per run in seconds (default 150)
+#   -l <rate>          detection target within the deadline (default 0.99)
+#   -d <ms>            feedback deadline, one of 50 100 200 500 1000 (default 200)
+#   -o <dir>           output directory (default ./adv_sweep_out)
+
+set -eu
+
+STRATEGIES="fixed:100x5 fixed:20x5 burst:20x5+200x3 burst:20x3+100x4"
+SCANS="0x60/0x30 0xa0/0x10"
+STATIONS=4
+PUNCH_RATE=2
+PUNCHES=200
+SIM_TIME_S=150
+TARGET=0.99
+DEADLINE_MS=200
+OUT_DIR=$(pwd)/adv_sweep_out
+
+while getopts "S:W:n:r:p:t:l:d:o:" opt; do
+	case $opt in
+	S) STRATEGIES=$OPTARG ;;
+	W) SCANS=$OPTARG ;;
+	n) STATIONS=$OPTARG ;;
+	r) PUNCH_RATE=$OPTARG ;;
+	p) PUNCHES=$OPTARG ;;
+	t) SIM_TIME_S=$OPTARG ;;
+	l) TARGET=$OPTARG ;;
+	d) DEADLINE_MS=$OPTARG ;;
+	o) OUT_DIR=$OPTARG ;;
+	*) sed -n '2,/^$/p' "$0" >&2; exit 1 ;;
+	esac
+done
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(cd "$SCRIPT_DIR/../.." && pwd)
+BUILD_DIR=$OUT_DIR/builds
+
+mkdir -p "$BUILD_DIR"
+
+# Sets ARGS to the station CMake arguments and JSON to the strategy as JSON fields
+strategy_args() {
+	local kind=${1%%:*} rest=${1#*:}
+	local first=${rest%%+*}
+	local interval=${first%x*} events=${first#*x}
+
+	case $kind in
+	fixed)
+		ARGS="-DCONFIG_MOCK_STATION_ADV_STRATEGY_FIXED=y \
+			-DCONFIG_MOCK_STATION_ADV_INTERVAL_MS=$interval \
+			-DCONFIG_MOCK_STATION_ADV_EVENTS=$events"
+		JSON="\"kind\": \"fixed\", \"interval_ms\": $interval, \"events\": $events"
+		;;
+	burst)
+		local second=${rest#*+}
+		local backoff_interval=${second%x*} backoff_events=${second#*x}
+
+		ARGS="-DCONFIG_MOCK_STATION_ADV_STRATEGY_BURST=y \
+			-DCONFIG_MOCK_STATION_ADV_BURST_INTERVAL_MS=$interval \
+			-DCONFIG_MOCK_STATION_ADV_BURST_EVENTS=$events \
+			-DCONFIG_MOCK_STATION_ADV_BACKOFF_INTERVAL_MS=$backoff_interval \
+			-DCONFIG_MOCK_STATION_ADV_BACKOFF_EVENTS=$backoff_events"
+		JSON="\"kind\": \"burst\", \"interval_ms\": $interval, \"events\": $events,
+		 \"backoff_interval_ms\": $backoff_interval, \"backoff_events\": $backoff_events"
+		;;
+	*)
+		echo "Unknown strategy $1" >&2
+		exit 1
+		;;
+	esac
+}
+
+for scan in $SCANS; do
+	west build -p always -b nrf52_bsim -d "$BUILD_DIR/observer_${scan/\//_}" \
+		"$REPO_DIR/ble_observer" -- \
+		-DCONFIG_SI_VOICE_BENCH_LOG=y \
+		-DCONFIG_SI_VOICE_SCAN_INTERVAL="${scan%/*}" \
+		-DCONFIG_SI_VOICE_SCAN_WINDOW="${scan#*/}"
+done
+
+for strategy in $STRATEGIES; do
+	strategy_args "$strategy"
+	name=$(echo "$strategy" | tr ':+' '__')
+
+	# shellcheck disable=SC2086
+	west build -p always -b nrf52_bsim -d "$BUILD_DIR/station_$name" \
+		"$REPO_DIR/multiple_adv_sets" -- \
+		-DOVERLAY_CONFIG=load_gen.conf \
+		-DCONFIG_MOCK_STATION_PUNCH_LOG=y \
+		-DCONFIG_LOAD_GEN_PUNCH_RATE="$PUNCH_RATE" \
+		-DCONFIG_LOAD_GEN_PUNCHES="$PUNCHES" \
+		$ARGS
+
+	for scan in $SCANS; do
+		run=$OUT_DIR/run_${name}_${scan/\//_}
+		mkdir -p "$run"
+		ln -sfn "$BUILD_DIR/observer_${scan/\//_}" "$run/build_observer"
+		ln -sfn "$BUILD_DIR/station_$name" "$run/build_station"
+
+		cat > "$run/sweep.json" <<-EOF
+		{"strategy": "$strategy", $JSON,
+		 "scan_interval": "${scan%/*}", "scan_window": "${scan#*/}",
+		 "stations": $STATIONS, "punch_rate": $PUNCH_RATE}
+		EOF
+
+		echo "=== $strategy, scan $scan, $STATIONS stations"
+		"$SCRIPT_DIR/run_bench.sh" -s -n "$STATIONS" -t "$SIM_TIME_S" -o "$run" || \
+			echo "Run $run failed"
+	done
+done
+
+python3 "$SCRIPT_DIR/adv_strategy_report.py" --target "$TARGET" --deadline-ms "$DEADLINE_MS" \
+	--json "$OUT_DIR/adv_strategy.json" "$OUT_DIR"/run_*/
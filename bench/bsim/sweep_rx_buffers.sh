@@ -0,0 +1,106 @@
+#!/usr/bin/env bash
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+#
+# Sweeps the observer's Bluetooth RX buffer counts against the advertiser
+# density in BabbleSim and picks the smallest buffer set that keeps the
+# punch loss under a target.
+#
+# Every combination of host event buffers, discardable event buffers and
+# controller RX buffers is run with run_bench.sh at every station count.
+# A punch counts as lost when a station advertised it and the observer
+# never reported its SIAC ID, control and sequence number. The observer
+# is built once per buffer set and the station once for the whole sweep.
+#
+# Requires the same environment as run_bench.sh.
+#
+# Usage: sweep_rx_buffers.sh [options]
+#   -n "<stations>"    station counts to run (default "4 8 16")
+#   -r <punches/s>     load generator rate per station (default 5)
+#   -p <punches>       punches per station (default 200)
+#   -a <ms>            station advertising interval in ms (default 20)
+#   -t <s>             simulated time per run in seconds (default 80)
+#   -E "<counts>"      CONFIG_BT_BUF_EVT_RX_COUNT values (default "3 10")
+#   -D "<counts>"      CONFIG_BT_BUF_EVT_DISCARDABLE_COUNT values (default "1 2 3 6")
+#   -C "<counts>"      CONFIG_BT_CTLR_RX_BUFFERS values (default "1 3 6")
+#   -l <rate>          loss target as a fraction of the punches (default 0.001)
+#   -o <dir>           output directory (default ./rx_sweep_out)
+
+set -eu
+
+STATIONS="4 8 16"
+PUNCH_RATE=5
+PUNCHES=200
+ADV_INTERVAL_MS=20
+SIM_TIME_S=80
+EVT_COUNTS="3 10"
+DISCARDABLE_COUNTS="1 2 3 6"
+CTLR_COUNTS="1 3 6"
+LOSS_TARGET=0.001
+OUT_DIR=$(pwd)/rx_sweep_out
+
+while getopts "n:r:p:a:t:E:D:C:l:o:" opt; do
+	case $opt in
+	n) STATIONS=$OPTARG ;;
+	r) PUNCH_RATE=$OPTARG ;;
+	p) PUNCHES=$OPTARG ;;
+	a) ADV_INTERVAL_MS=$OPTARG ;;
+	t) SIM_TIME_S=$OPTARG ;;
+	E) EVT_COUNTS=$OPTARG ;;
+	D) DISCARDABLE_COUNTS=$OPTARG ;;
+	C) CTLR_COUNTS=$OPTARG ;;
+	l) LOSS_TARGET=$OPTARG ;;
+	o) OUT_DIR=$OPTARG ;;
+	*) sed -n '2,/^$/p' "$0" >&2; exit 1 ;;
+	esac
+done
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(cd "$SCRIPT_DIR/../.." && pwd)
+BUILD_DIR=$OUT_DIR/builds
+
+mkdir -p "$BUILD_DIR"
+
+west build -p always -b nrf52_bsim -d "$BUILD_DIR/station" \
+	"$REPO_DIR/multiple_adv_sets" -- \
+	-DOVERLAY_CONFIG=load_gen.conf \
+	-DCONFIG_MOCK_STATION_PUNCH_LOG=y \
+	-DCONFIG_MOCK_STATION_ADV_INTERVAL_MS="$ADV_INTERVAL_MS" \
+	-DCONFIG_LOAD_GEN_PUNCH_RATE="$PUNCH_RATE" \
+	-DCONFIG_LOAD_GEN_PUNCHES="$PUNCHES"
+
+for evt in $EVT_COUNTS; do
+for disc in $DISCARDABLE_COUNTS; do
+for ctlr in $CTLR_COUNTS; do
+	cfg=e${evt}_d${disc}_c${ctlr}
+
+	west build -p always -b nrf52_bsim -d "$BUILD_DIR/observer_$cfg" \
+		"$REPO_DIR/ble_observer" -- \
+		-DCONFIG_SI_VOICE_BENCH_LOG=y \
+		-DCONFIG_BT_BUF_EVT_RX_COUNT="$evt" \
+		-DCONFIG_BT_BUF_EVT_DISCARDABLE_COUNT="$disc" \
+		-DCONFIG_BT_CTLR_RX_BUFFERS="$ctlr"
+
+	for n in $STATIONS; do
+		run=$OUT_DIR/n${n}_$cfg
+		mkdir -p "$run"
+		ln -sfn "$BUILD_DIR/observer_$cfg" "$run/build_observer"
+		ln -sfn "$BUILD_DIR/station" "$run/build_station"
+
+		cat > "$run/sweep.json" <<-EOF
+		{"stations": $n, "punch_rate": $PUNCH_RATE, "adv_interval_ms": $ADV_INTERVAL_MS,
+		 "evt_rx_count": $evt, "evt_discardable_count": $disc, "ctlr_rx_buffers": $ctlr}
+		EOF
+
+		echo "=== $n stations, $evt event, $disc discardable, $ctlr controller buffers"
+		"$SCRIPT_DIR/run_bench.sh" -s -n "$n" -t "$SIM_TIME_S" -o "$run" || \
+			echo "Run $run failed"
+	done
+done
+done
+done
+
+python3 "$SCRIPT_DIR/rx_sweep_report.py" --target "$LOSS_TARGET" \
+	--conf "$OUT_DIR/rx_buffers.conf" "$OUT_DIR"/n*/
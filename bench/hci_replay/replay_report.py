@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Reports the HCI replay runs of run_replay.sh and checks them for regressions.
+
+Reads the capture directories of run_replay.sh, each with one observer
+log per run (run_<n>.log, built with CONFIG_SI_VOICE_BENCH_LOG). For
+every capture it prints the reports fed and dropped, the punches
+detected (distinct SIAC ID, control and sequence number of the
+"BENCH rx" lines), and the host CPU cost per report. Costs are the
+median of the runs, punches the fewest any run detected.
+
+The SI reports decoded are checked against the punches detected and
+the reports the application received, a count outside them fails the
+run. With --baseline the results are compared with the JSON of an
+earlier run. A capture regresses when it detects fewer punches or
+decodes fewer SI reports than the baseline, or its cycles per report
+grow by more than the tolerance; the script then exits with 1, so it
+can gate CI.
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import statistics
+import sys
+
+REPLAY_RE = re.compile(r'BENCH replay (\d+) (\d+) (\d+) (\d+) (\d+) (\d+) (\d+) (\d+)')
+RX_RE = re.compile(r'BENCH rx (\d+) (\d+) (\d+) (\d+)')
+
+
+def parse_run(path):
+    replay = None
+    punches = set()
+    with open(path, errors='replace') as f:
+        for line in f:
+            m = RX_RE.search(line)
+            if m:
+                punches.add(tuple(int(v) for v in m.groups()[:3]))
+                continue
+            m = REPLAY_RE.search(line)
+            if m:
+                replay = [int(v) for v in m.groups()]
+    if replay is None:
+        return None
+
+    events, reports, dropped, app_reports, si_reports, sim_us, cpu_ns, cycles = replay
+    processed = max(reports - dropped, 1)
+    return {
+        'events': events,
+        'reports': reports,
+        'dropped': dropped,
+        'app_reports': app_reports,
+        'si_reports': si_reports,
+        'punches': len(punches),
+        'sim_us': sim_us,
+        'reports_per_s': processed * 1e9 / max(cpu_ns, 1),
+        'ns_per_report': cpu_ns / processed,
+        'cycles_per_report': cycles / processed,
+    }
+
+
+def summarize(d):
+    runs = []
+    for path in sorted(glob.glob(os.path.join(d, 'run_*.log'))):
+        run = parse_run(path)
+        if run is None:
+            print(f'Skipping {path}: no BENCH replay line', file=sys.stderr)
+            continue
+        runs.append(run)
+    if not runs:
+        return None
+
+    # All runs replay the same capture, only the drops at recorded speed differ
+    summary = {k: runs[0][k] for k in ('events', 'reports')}
+    summary['dropped'] = max(r['dropped'] for r in runs)
+    for k in ('app_reports', 'si_reports', 'punches'):
+        summary[k] = min(r[k] for r in runs)
+    for k in ('sim_us', 'reports_per_s', 'ns_per_report', 'cycles_per_report'):
+        summary[k] = statistics.median(r[k] for r in runs)
+    summary['runs'] = len(runs)
+    return summary
+
+
+def inconsistencies(name, r):
+    # Every punch detected comes from a decoded SI report, and only
+    # reports handed to the application are decoded
+    found = []
+    if not r['punches'] <= r['si_reports'] <= r['app_reports']:
+        found.append(f'{name}: {r["si_reports"]} SI reports decoded, outside '
+                     f'{r["punches"]} punches to {r["app_reports"]} application reports')
+    return found
+
+
+def regressions(name, cur, base, tolerance):
+    found = []
+    if cur['punches'] < base['punches']:
+        found.append(f'{name}: {cur["punches"]} punches detected, baseline {base["punches"]}')
+    if cur['si_reports'] < base['si_reports']:
+        found.append(f'{name}: {cur["si_reports"]} SI reports decoded, '
+                     f'baseline {base["si_reports"]}')
+    if base['cycles_per_report'] > 0 and \
+            cur['cycles_per_report'] > base['cycles_per_report'] * (1 + tolerance):
+        found.append(f'{name}: {cur["cycles_per_report"]:.0f} cycles per report, '
+                     f'baseline {base["cycles_per_report"]:.0f}')
+    return found
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--json', help='write the results to this file, a baseline for later runs')
+    parser.add_argument('--baseline', help='results of an earlier run to compare with')
+    parser.add_argument('--tolerance', type=float, default=0.1,
+                        help='allowed relative increase of the cycles per report')
+    parser.add_argument('captures', nargs='+', help='capture directories of run_replay.sh')
+    args = parser.parse_args()
+
+    results = {}
+    for d in args.captures:
+        summary = summarize(d)
+        if summary is not None:
+            results[os.path.basename(os.path.normpath(d))] = summary
+    if not results:
+        sys.exit('No complete runs found')
+
+    print(f'{"capture":<24}{"reports":>9}{"dropped":>9}{"SI rep":>9}{"punches":>9}'
+          f'{"reports/s":>11}{"ns/rep":>9}{"cyc/rep":>9}')
+    for name, r in sorted(results.items()):
+        print(f'{name:<24}{r["reports"]:>9}{r["dropped"]:>9}{r["si_reports"]:>9}'
+              f'{r["punches"]:>9}{r["reports_per_s"]:>11.0f}{r["ns_per_report"]:>9.0f}'
+              f'{r["cycles_per_report"]:>9.0f}')
+
+    found = []
+    for name, r in sorted(results.items()):
+        found.extend(inconsistencies(name, r))
+    if found:
+        for line in found:
+            print(f'Invalid: {line}')
+        return 1
+
+    if args.json:
+        with open(args.json, 'w') as f:
+            json.dump(results, f, indent=2)
+
+    if not args.baseline:
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    for name, r in sorted(results.items()):
+        if name not in baseline:
+            print(f'{name}: not in the baseline')
+            continue
+        found.extend(regressions(name, r, baseline[name], args.tolerance))
+    for name in sorted(set(baseline) - set(results)):
+        print(f'{name}: in the baseline but not replayed')
+
+    for line in found:
+        print(f'Regression: {line}')
+    if not found:
+        print(f'No regressions against {args.baseline}')
+    return 1 if found else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
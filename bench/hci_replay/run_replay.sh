@@ -0,0 +1,94 @@
+#!/usr/bin/env bash
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+#
+# Replays btsnoop captures of real events into the SI Voice observer on
+# native_posix and reports the reports per second, the host CPU cycles
+# per report and the punches detected of every capture.
+#
+# Each capture is run -r times, its results are written to
+# <output>/<capture name>/run_<n>.log. With -b the results are compared
+# with a baseline written by an earlier run (-o <dir>/replay.json), and
+# the script fails when a capture detects fewer punches or costs more
+# cycles per report than the tolerance allows.
+#
+# Requires ZEPHYR_BASE to be set.
+#
+# Usage: run_replay.sh [options] <capture>...
+#   -x <n>             replay n times faster than recorded, 0 as fast as
+#                      possible (default 0)
+#   -r <runs>          runs per capture, the median is reported (default 3)
+#   -b <json>          baseline to compare with
+#   -T <fraction>      allowed increase of the cycles per report over the
+#                      baseline (default 0.1)
+#   -o <dir>           output directory (default ./replay_out)
+#   -e <args>          extra CMake arguments for the observer build
+#   -s                 skip the build and reuse the image in the output directory
+
+set -eu
+
+SPEEDUP=0
+RUNS=3
+BASELINE=""
+TOLERANCE=0.1
+OUT_DIR=$(pwd)/replay_out
+OBSERVER_ARGS=""
+SKIP_BUILD=0
+
+while getopts "x:r:b:T:o:e:s" opt; do
+	case $opt in
+	x) SPEEDUP=$OPTARG ;;
+	r) RUNS=$OPTARG ;;
+	b) BASELINE=$OPTARG ;;
+	T) TOLERANCE=$OPTARG ;;
+	o) OUT_DIR=$OPTARG ;;
+	e) OBSERVER_ARGS=$OPTARG ;;
+	s) SKIP_BUILD=1 ;;
+	*) sed -n '2,/^$/p' "$0" >&2; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+	sed -n '2,/^$/p' "$0" >&2
+	exit 1
+fi
+
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+REPO_DIR=$(cd "$SCRIPT_DIR/../.." && pwd)
+
+mkdir -p "$OUT_DIR"
+
+if [ "$SKIP_BUILD" -eq 0 ]; then
+	# shellcheck disable=SC2086
+	west build -p always -b native_posix -d "$OUT_DIR/build_observer" \
+		"$REPO_DIR/ble_observer" -- \
+		-DOVERLAY_CONFIG=hci_replay.conf \
+		-DCONFIG_SI_VOICE_BENCH_LOG=y \
+		$OBSERVER_ARGS
+fi
+
+OBSERVER_EXE=$OUT_DIR/build_observer/zephyr/zephyr.exe
+DIRS=""
+
+for capture in "$@"; do
+	name=$(basename "${capture%.*}")
+	dir=$OUT_DIR/$name
+	mkdir -p "$dir"
+	DIRS="$DIRS $dir"
+
+	for i in $(seq 1 "$RUNS"); do
+		echo "=== $name, run $i"
+		# --no-rt: simulated time runs ahead of the wall clock, the
+		# replay paces the reports itself
+		"$OBSERVER_EXE" --no-rt -hci_replay="$capture" \
+			-hci_replay_speedup="$SPEEDUP" > "$dir/run_$i.log" 2>&1 || \
+			echo "Run $dir/run_$i.log failed"
+	done
+done
+
+# shellcheck disable=SC2086
+python3 "$SCRIPT_DIR/replay_report.py" --json "$OUT_DIR/replay.json" \
+	${BASELINE:+--baseline "$BASELINE" --tolerance "$TOLERANCE"} $DIRS
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Sends announcements to an SI Voice unit over its SPI host interface.
+
+Needs the unit built with host_if.conf and a Linux host with spidev,
+wired to my_spi_slave of the unit. Every frame goes in its own
+transaction, followed by a no-op transaction to read the status that
+covers it. With --rate the frames are repeated to measure how many the
+unit takes per second. The frame layout is in src/host_if.h.
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+import spidev
+
+SYNC = 0xA5
+PHRASES = 0x01
+PUNCH = 0x02
+NOP = 0x03
+
+# struct host_if_status in src/host_if.h
+STATUS = struct.Struct('<BBBBHH')
+# struct host_if_punch in src/host_if.h
+PUNCH_RECORD = struct.Struct('<II7s')
+
+
+def crc16_ccitt(data, crc=0xffff):
+    """CRC-16/CCITT as crc16_ccitt() of Zephyr, reflected polynomial 0x8408."""
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0x8408 if crc & 1 else crc >> 1
+    return crc
+
+
+def frame(ftype, seq, payload):
+    body = bytes([ftype, seq & 0xff, len(payload)]) + payload
+    return bytes([SYNC]) + body + struct.pack('<H', crc16_ccitt(body))
+
+
+def transfer(spi, data, size):
+    rx = spi.xfer2(list(data.ljust(size, b'\0')))
+    status = STATUS.unpack_from(bytes(rx))
+    if status[0] != SYNC:
+        return None
+    return dict(zip(('sync', 'last_seq', 'queue_free', 'reserved', 'accepted', 'rejected'),
+                    status))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--bus', type=int, default=0, help='spidev bus')
+    parser.add_argument('--device', type=int, default=0, help='spidev chip select')
+    parser.add_argument('--speed', type=int, default=4000000, help='SPI clock in Hz')
+    parser.add_argument('--size', type=int, default=128,
+                        help='transaction length, CONFIG_SI_VOICE_HOST_IF_BUF_SIZE')
+    group = parser.add_mutually_exclusive_group()
+    group.add_argument('--phrases', nargs='+', type=lambda v: int(v, 0),
+                       help='phrase codes to play')
+    group.add_argument('--punch', nargs=4, type=int, metavar=('SIAC', 'CONTROL', 'HH', 'MM'),
+                       help='punch record to announce')
+    parser.add_argument('--seq', type=int, default=1, help='sequence number of the first frame')
+    parser.add_argument('--rate', type=int, default=0,
+                        help='send NOP frames for a second at most this many per second '
+                        'and report the rate the unit accepted')
+    args = parser.parse_args()
+
+    spi = spidev.SpiDev()
+    spi.open(args.bus, args.device)
+    spi.mode = 0
+    spi.max_speed_hz = args.speed
+
+    seq = args.seq
+    if args.phrases:
+        data = frame(PHRASES, seq, b''.join(struct.pack('<H', p) for p in args.phrases))
+    elif args.punch:
+        siac, control, hh, mm = args.punch
+        record = PUNCH_RECORD.pack(siac, seq, bytes([0x07, control, hh, mm, 0, 0, 0]))
+        data = frame(PUNCH, seq, record)
+    else:
+        data = frame(NOP, seq, b'')
+
+    transfer(spi, data, args.size)
+    # The status lags one transaction, read it with a no-op
+    transfer(spi, frame(NOP, seq, b''), args.size)
+    status = transfer(spi, frame(NOP, seq, b''), args.size)
+    if status is None:
+        sys.exit('No status from the unit, check the wiring and the build')
+    print(f'last seq {status["last_seq"]}, queue free {status["queue_free"]}, '
+          f'accepted {status["accepted"]}, rejected {status["rejected"]}')
+
+    if args.rate:
+        start_accepted = status['accepted']
+        start = time.monotonic()
+        sent = 0
+        while time.monotonic() - start < 1.0:
+            seq += 1
+            transfer(spi, frame(NOP, seq, b''), args.size)
+            sent += 1
+            time.sleep(max(0.0, start + sent / args.rate - time.monotonic()))
+        elapsed = time.monotonic() - start
+        transfer(spi, frame(NOP, seq, b''), args.size)
+        status = transfer(spi, frame(NOP, seq, b''), args.size)
+        accepted = (status['accepted'] - start_accepted) & 0xffff
+        print(f'sent {sent} frames in {elapsed:.2f} s, unit accepted {accepted} '
+              f'({accepted / elapsed:.0f}/s), rejected {status["rejected"]} in total')
+
+    spi.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Per-subsystem RAM and ROM budget of an observer build.
+
+Reads the linker map of a build (build/zephyr/zephyr.map) and sums the
+input sections by the subsystem of the object they come from. RAM is
+split into static data (data and bss) and noinit, which holds the thread
+stacks and the retained ledgers. ROM counts code, read-only data and the
+initial values of the data section.
+
+The totals are checked against the memory of the target SoC, by default
+the nRF52811 (24 kB RAM, 192 kB flash). The exit status is 1 when the
+build does not fit, so the script can gate a CI job:
+
+    scripts/memory_budget.py build/zephyr/zephyr.map --soc nrf52811
+
+With --top the largest RAM objects are listed as well, which is where to
+look first when the RAM budget is exceeded.
+"""
+
+import argparse
+import collections
+import re
+import sys
+
+SOCS = {
+    'nrf52811': (192 * 1024, 24 * 1024),
+    'nrf52832': (512 * 1024, 64 * 1024),
+    'nrf52833': (512 * 1024, 128 * 1024),
+    'nrf52840': (1024 * 1024, 256 * 1024),
+    'nrf5340_cpuapp': (1024 * 1024, 512 * 1024),
+    'nrf5340_cpunet': (256 * 1024, 64 * 1024),
+}
+
+RAM_START = 0x20000000
+
+# First match wins, the patterns are matched against the archive and
+# object name of each input section, e.g. "app/libapp.a(audio.c.obj)".
+SUBSYSTEMS = [
+    ('app', r'^app/libapp\.a\((?P<obj>[^.]+)'),
+    ('bt controller', r'softdevice_controller|bluetooth__controller|/bluetooth/controller/'),
+    ('mpsl', r'libmpsl|mpsl__|multithreading_lock'),
+    ('bt host', r'subsys__bluetooth|/bluetooth/host/|/bluetooth/common/'),
+    ('crypto', r'cc310|cc3xx|nrf_security|tinycrypt|mbedtls|hw_cc310'),
+    ('logging', r'subsys__logging|\((log_|mpsc_pbuf|cbprintf)'),
+    ('shell', r'subsys__shell|\(shell'),
+    ('storage', r'subsys__fs|subsys__storage|\((fcb|flash_map|nvs)'),
+    ('lz4', r'lz4'),
+    ('net_buf', r'subsys__net|\(buf\.c'),
+    ('kernel', r'libkernel\.a'),
+    ('drivers', r'libdrivers__|hal_nordic|nrfx|lib\.\.__nrf__drivers'),
+    ('arch/soc', r'libarch__|libsoc__|isr_tables|dev_handles|linker'),
+    ('libc', r'libc__|libgcc|libc\.a|libm\.a|lib__posix|libnosys'),
+    ('debug io', r'segger|\((rtt|console|uart_console)'),
+    ('zephyr lib', r'libzephyr\.a'),
+]
+
+OUTPUT_SKIP = ('.debug', '.comment', '.stab', '.gnu', '.rel', '.line', '.ARM.attributes',
+               '.note', '/DISCARD/')
+
+OUTPUT_RE = re.compile(r'^(?P<name>\S+)(?:\s+0x(?P<addr>[0-9a-f]+)\s+0x(?P<size>[0-9a-f]+)'
+                       r'(?:\s+load address 0x(?P<lma>[0-9a-f]+))?)?\s*$')
+INPUT_RE = re.compile(r'^ (?P<name>\S+)(?:\s+0x(?P<addr>[0-9a-f]+)\s+0x(?P<size>[0-9a-f]+)'
+                      r'(?:\s+(?P<obj>\S.*))?)?\s*$')
+CONT_RE = re.compile(r'^\s+0x(?P<addr>[0-9a-f]+)\s+0x(?P<size>[0-9a-f]+)\s+(?P<obj>\S.*)$')
+
+
+def subsystem(obj):
+    if obj == '*fill*':
+        return 'alignment'
+    for name, pattern in SUBSYSTEMS:
+        m = re.search(pattern, obj)
+        if m:
+            if name == 'app' and m.group('obj'):
+                return 'app/' + m.group('obj')
+            return name
+    return 'other'
+
+
+def parse(path):
+    """Yields (output section, is RAM, has load image, input section, size, object)."""
+    with open(path) as f:
+        lines = f.read().splitlines()
+    try:
+        lines = lines[lines.index('Linker script and memory map') + 1:]
+    except ValueError:
+        sys.exit(f'{path} is not a GNU ld map file')
+
+    out = None
+    pending = None
+    for line in lines:
+        if not line.strip():
+            continue
+        m = OUTPUT_RE.match(line)
+        if m and not line.startswith(' ') and not line.startswith('LOAD') and \
+                not line.startswith('OUTPUT'):
+            name = m.group('name')
+            if name.startswith(OUTPUT_SKIP):
+                out = None
+            else:
+                addr = int(m.group('addr') or '0', 16)
+                out = (name, addr >= RAM_START, m.group('lma') is not None)
+            pending = None
+            continue
+        if out is None:
+            continue
+        if pending:
+            name, pending = pending, None
+            m = CONT_RE.match(line)
+            if m:
+                yield out + (name, int(m.group('size'), 16), m.group('obj'))
+                continue
+        m = INPUT_RE.match(line)
+        if not m or m.group('name').startswith('0x'):
+            continue
+        if m.group('name').startswith('*') and m.group('name') != '*fill*':
+            # Input section pattern of the linker script
+            continue
+        if m.group('size') is None:
+            # Long section names wrap, address and size are on the next line
+            pending = m.group('name')
+        elif m.group('name') == '*fill*':
+            yield out + ('*fill*', int(m.group('size'), 16), '*fill*')
+        elif m.group('obj'):
+            yield out + (m.group('name'), int(m.group('size'), 16), m.group('obj'))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('map', help='zephyr.map of the build')
+    parser.add_argument('--soc', default='nrf52811', choices=sorted(SOCS),
+                        help='SoC whose memory is the budget')
+    parser.add_argument('--ram', type=int, help='RAM budget in bytes, overrides --soc')
+    parser.add_argument('--rom', type=int, help='flash budget in bytes, overrides --soc')
+    parser.add_argument('--reserve', type=int, default=0,
+                        help='flash kept free for the storage partition, in bytes')
+    parser.add_argument('--top', type=int, default=0, help='list the N largest RAM objects')
+    args = parser.parse_args()
+
+    rom_budget, ram_budget = SOCS[args.soc]
+    rom_budget = (args.rom or rom_budget) - args.reserve
+    ram_budget = args.ram or ram_budget
+
+    rom = collections.Counter()
+    data = collections.Counter()
+    noinit = collections.Counter()
+    objects = collections.Counter()
+    for out, is_ram, loaded, section, size, obj in parse(args.map):
+        sub = subsystem(obj)
+        if not is_ram or loaded:
+            rom[sub] += size
+        if is_ram:
+            if out == 'noinit' or section.startswith('.noinit'):
+                noinit[sub] += size
+            else:
+                data[sub] += size
+            objects[(sub, section)] += size
+
+    total_rom = sum(rom.values())
+    total_ram = sum(data.values()) + sum(noinit.values())
+    subs = sorted(set(rom) | set(data) | set(noinit),
+                  key=lambda s: (-(data[s] + noinit[s]), -rom[s]))
+
+    print(f'{"subsystem":<22}{"ROM":>9}{"data+bss":>10}{"noinit":>9}{"RAM":>9}{"RAM %":>7}')
+    for sub in subs:
+        ram = data[sub] + noinit[sub]
+        print(f'{sub:<22}{rom[sub]:>9}{data[sub]:>10}{noinit[sub]:>9}{ram:>9}'
+              f'{100 * ram / ram_budget:>6.1f}%')
+    print(f'{"total":<22}{total_rom:>9}{sum(data.values()):>10}{sum(noinit.values()):>9}'
+          f'{total_ram:>9}{100 * total_ram / ram_budget:>6.1f}%')
+    print()
+    print(f'ROM {total_rom} of {rom_budget} bytes ({100 * total_rom / rom_budget:.1f}%), '
+          f'{rom_budget - total_rom} free')
+    print(f'RAM {total_ram} of {ram_budget} bytes ({100 * total_ram / ram_budget:.1f}%), '
+          f'{ram_budget - total_ram} free')
+
+    if args.top:
+        print()
+        print('Largest RAM objects:')
+        for (sub, section), size in objects.most_common(args.top):
+            print(f'{size:>9}  {sub:<20}{section}')
+
+    if total_rom > rom_budget or total_ram > ram_budget:
+        print(f'Build does not fit the {args.soc} budget')
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
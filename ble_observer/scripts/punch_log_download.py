@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+# Copyright (c) 2022 Nordic Semiconductor ASA
+# SPDX-License-Identifier: Apache-2.0
+
+"""Downloads the punch log of an SI Voice unit over Bluetooth.
+
+Needs the unit built with punch_log.conf and download.conf, and bleak on
+the host, plus the lz4 package for logs built with
+CONFIG_SI_VOICE_PUNCH_LOG_LZ4. The log is written to the output file as
+stored on the unit, a sequence of segments that are raw or LZ4
+compressed. Every segment carries its log offset, which does not change
+when the unit erases the oldest sector to make room. With --resume an
+existing output file is continued from its end, otherwise the download
+starts at the oldest segment still on the unit. With --csv the segments
+are decompressed and the records decoded.
+"""
+
+import argparse
+import asyncio
+import csv
+import os
+import struct
+import sys
+import time
+
+from bleak import BleakClient, BleakScanner
+
+SERVICE_UUID = '5e5a0001-8f2c-4c1b-9a3e-5349564f4943'
+CTRL_UUID = '5e5a0002-8f2c-4c1b-9a3e-5349564f4943'
+DATA_UUID = '5e5a0003-8f2c-4c1b-9a3e-5349564f4943'
+
+OP_START = 0x01
+OP_STOP = 0x02
+OP_DONE = 0x81
+OP_ERROR = 0x82
+
+# Zephyr errno, reported by the unit
+ERANGE = 34
+
+# struct punch_log_segment and struct punch_log_record in src/punch_log.h
+SEGMENT = struct.Struct('<BBHI')
+SEGMENT_RAW = 0
+SEGMENT_LZ4 = 1
+RECORD = struct.Struct('<IIIBb7s3x')
+RECORD_TYPES = {0: 'boot', 1: 'punch', 2: 'announcement'}
+
+
+class Download:
+    def __init__(self, out, offset):
+        self.out = out
+        self.offset = offset
+        self.done = asyncio.Event()
+        self.result = None
+        self.gap = None
+
+    def on_data(self, _, data):
+        offset, = struct.unpack_from('<I', data)
+        if offset != self.offset:
+            # Only on a lost notification, the download is restarted from here
+            if self.gap is None:
+                self.gap = self.offset
+            return
+        self.out.write(data[4:])
+        self.offset += len(data) - 4
+
+    def on_ctrl(self, _, data):
+        if data[0] == OP_DONE:
+            end, sent, ms, rate = struct.unpack_from('<IIII', data, 1)
+            self.result = {'end': end, 'bytes': sent, 'ms': ms, 'rate': rate}
+        elif data[0] == OP_ERROR:
+            self.result = {'error': struct.unpack_from('<b', data, 1)[0]}
+        self.done.set()
+
+
+async def find(args):
+    if args.address:
+        return args.address
+    device = await BleakScanner.find_device_by_filter(
+        lambda d, ad: SERVICE_UUID in ad.service_uuids and
+        (args.name is None or d.name == args.name), timeout=args.timeout)
+    if device is None:
+        sys.exit('No SI Voice unit with the punch log service found')
+    return device
+
+
+def resume_offset(path):
+    """Log offset at the end of an earlier download, None to start afresh."""
+    if not os.path.exists(path) or os.path.getsize(path) < SEGMENT.size:
+        return None
+    with open(path, 'rb') as f:
+        _, _, _, start = SEGMENT.unpack(f.read(SEGMENT.size))
+    return start + os.path.getsize(path)
+
+
+async def run(args):
+    resume = resume_offset(args.output) if args.resume else None
+    target = await find(args)
+
+    async with BleakClient(target, timeout=args.timeout) as client:
+        info = await client.read_gatt_char(CTRL_UUID)
+        end, record_size, version, start = struct.unpack_from('<IHBI', info)
+        print(f'Log: offsets {start} to {end}, {record_size} byte records, format {version}')
+        if version != 3:
+            sys.exit(f'Log format {version} not supported')
+        offset = start if resume is None else resume
+
+        with open(args.output, 'wb' if resume is None else 'ab') as out:
+            dl = Download(out, offset)
+            await client.start_notify(DATA_UUID, dl.on_data)
+            await client.start_notify(CTRL_UUID, dl.on_ctrl)
+
+            start = time.monotonic()
+            while True:
+                dl.done.clear()
+                dl.gap = None
+                await client.write_gatt_char(CTRL_UUID, struct.pack('<BI', OP_START, dl.offset),
+                                             response=True)
+                await dl.done.wait()
+                if dl.gap is None or 'error' in dl.result:
+                    break
+                print(f'Notification lost at offset {dl.gap}, resuming')
+            elapsed = time.monotonic() - start
+
+    res = dl.result
+    if 'error' in res and res['error'] == -ERANGE:
+        sys.exit(f'Offset {dl.offset} no longer on the unit, it was erased to make room. '
+                 f'The log now starts at {start}, download without --resume')
+    if 'error' in res:
+        sys.exit(f'Download failed on the unit (err {res["error"]})')
+    received = dl.offset - offset
+    print(f'Received {received} bytes in {elapsed:.2f} s, {received / elapsed / 1000:.1f} kB/s')
+    print(f'Unit sent {res["bytes"]} bytes in {res["ms"]} ms, {res["rate"] / 1000:.1f} kB/s')
+
+
+def segments(data):
+    """Yields the records of every segment, decompressed."""
+    pos = 0
+    while pos + SEGMENT.size <= len(data):
+        fmt, count, length = SEGMENT.unpack_from(data, pos)
+        payload = data[pos + SEGMENT.size:pos + SEGMENT.size + length]
+        pos += SEGMENT.size + length
+        if len(payload) < length:
+            print(f'Log truncated in a segment at offset {pos - length - SEGMENT.size}')
+            return
+        if fmt == SEGMENT_LZ4:
+            import lz4.block  # only needed for compressed logs
+            payload = lz4.block.decompress(payload, uncompressed_size=count * RECORD.size)
+        elif fmt != SEGMENT_RAW:
+            sys.exit(f'Unknown segment format {fmt}')
+        for i in range(count):
+            yield RECORD.unpack_from(payload, i * RECORD.size)
+
+
+def decode(path, csv_path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    records = 0
+    with open(csv_path, 'w', newline='') as out:
+        w = csv.writer(out)
+        w.writerow(['uptime_ms', 'type', 'siac_id', 'seq', 'control', 'hh', 'mm', 'ss',
+                    'result'])
+        for uptime_ms, siac_id, seq, rtype, result, siac in segments(data):
+            w.writerow([uptime_ms, RECORD_TYPES.get(rtype, rtype), siac_id, seq,
+                        siac[1], siac[2], siac[3], siac[4], result])
+            records += 1
+    print(f'{records} records from {len(data)} bytes, '
+          f'{records * RECORD.size / max(len(data), 1):.2f}x compression')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--address', help='Bluetooth address of the unit')
+    parser.add_argument('--name', help='advertised name of the unit')
+    parser.add_argument('--timeout', type=float, default=10.0, help='scan/connect timeout, s')
+    parser.add_argument('-o', '--output', required=True, help='raw log file')
+    parser.add_argument('--resume', action='store_true',
+                        help='continue an existing output file from its end')
+    parser.add_argument('--csv', help='also decode the records to this file')
+    args = parser.parse_args()
+
+    asyncio.run(run(args))
+    if args.csv:
+        decode(args.output, args.csv)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,488 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr.h>
+#include <logging/log.h>
+#include "audio.h"
+#include "s1v3g340.h"
+#include "punch_log.h"
+#include "power_off.h"
+#if defined(CONFIG_S1V3G340_EMUL)
+#include "s1v3g340_emul.h"
+#endif
+
+LOG_MODULE_REGISTER(audio, CONFIG_SI_VOICE_LOG_LEVEL);
+
+/* The audio worker runs on the main thread, CONFIG_MAIN_STACK_SIZE sizes its stack */
+#define AUDIO_PRIORITY		7
+#define AUDIO_QUEUE_LEN		4
+#define AUDIO_ACK_QUEUE_LEN	2
+
+/* Time between two checks for a punch of the bound SIAC while a
+ * sequence plays, the longest a new acknowledgement waits for the IC
+ */
+#define PREEMPT_POLL_MS			10
+/* Longest announcement, "Reached control <n> in <h> hours <m> minutes" */
+#define ANNOUNCEMENT_PLAYBACK_TIMEOUT_MS	6000
+/* A speech IC that could not be recovered is left alone this long, the
+ * announcements meanwhile are dropped without touching the SPI bus
+ */
+#define IC_FAULT_HOLDOFF_MS		30000
+
+/* Announcements waiting for the speech IC, decoded punches or phrase
+ * lists from the SPI host interface, and the power off after inactivity
+ */
+struct audio_msg {
+	enum {
+		AUDIO_MSG_PUNCH,
+		AUDIO_MSG_PHRASES,
+		AUDIO_MSG_POWER_OFF,
+	} type;
+	union {
+		struct si_punch punch;
+		struct {
+			uint16_t codes[S1V3G340_MAX_PHRASES];
+			uint8_t count;
+		} phrases;
+	};
+};
+
+K_MSGQ_DEFINE(audio_msgq, sizeof(struct audio_msg), AUDIO_QUEUE_LEN, 4);
+/* Punches of the bound SIAC, taken before anything in audio_msgq */
+K_MSGQ_DEFINE(ack_msgq, sizeof(struct audio_msg), AUDIO_ACK_QUEUE_LEN, 4);
+/* One count per message in either queue */
+static K_SEM_DEFINE(audio_sem, 0, AUDIO_QUEUE_LEN + AUDIO_ACK_QUEUE_LEN);
+
+static struct audio_latency ack_latency;
+/* Sequences the speech IC never reported the end of */
+static uint32_t playback_timeouts;
+
+/* Records the latency of a sequence the speech IC accepted just now */
+static void latency_record(struct audio_latency *latency, uint32_t decoded_at)
+{
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - decoded_at);
+
+	if (latency->count == 0 || us < latency->min_us) {
+		latency->min_us = us;
+	}
+	if (us > latency->max_us) {
+		latency->max_us = us;
+	}
+	latency->last_us = us;
+	latency->total_us += us;
+	latency->count++;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: announcement_phrases
+//
+//  description:
+//    Parses the SIAC data to get the control number, hours and minutes
+//    and builds the phrase list for "Reached control <n> in [<h> hours]
+//    <m> minutes".
+//
+//  argument:
+//    siac_data: Data recieved from SIAC via BLE
+//    phrases: filled with the phrase codes to play
+//
+//  return:
+//    number of phrases
+///////////////////////////////////////////////////////////////////////
+static int announcement_phrases(const char siac_data[], uint16_t phrases[])
+{
+	uint8_t controlNumber = 0, hours = 0, minutes = 0;
+	int count = 0;
+
+	for (int i = 0; i + 3 < SIAC_DATA_LEN; i++)
+	{
+		if (siac_data[i] == 0x07)
+		{
+			/* Parse SIAC data */
+			controlNumber = siac_data[i+1];
+			hours = siac_data[i+2];
+			minutes = siac_data[i+3];
+			break;
+		}
+	}
+	LOG_DBG("control no: %d, hours: %d, minutes: %d", controlNumber, hours, minutes);
+
+	phrases[count++] = PHRASE_REACHED_CONTROL;
+	phrases[count++] = PHRASE_CONTROL(controlNumber);
+	phrases[count++] = PHRASE_IN;
+	if (hours != 0) {
+		phrases[count++] = PHRASE_HOURS(hours);
+	}
+	phrases[count++] = PHRASE_MINUTES(minutes);
+
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: ack_pending
+//
+//  description:
+//    True when a punch of the bound SIAC waits for its acknowledgement.
+///////////////////////////////////////////////////////////////////////
+static bool ack_pending(void)
+{
+	return IS_ENABLED(CONFIG_SI_VOICE_FAST_ACK) && k_msgq_num_used_get(&ack_msgq) > 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: playback_wait
+//
+//  description:
+//    Waits for the end of the sequence playing. When a punch of the
+//    bound SIAC comes in meanwhile the sequence is stopped, so its
+//    acknowledgement does not wait for the rest of an announcement.
+//    A sequence without an end after ANNOUNCEMENT_PLAYBACK_TIMEOUT_MS
+//    is counted and logged.
+//
+//  return:
+//    0 when the playback has finished, -ECANCELED when it was cut
+//    short, -ETIMEDOUT or the error of the speech IC
+///////////////////////////////////////////////////////////////////////
+static int playback_wait(void)
+{
+	int64_t deadline = k_uptime_get() + ANNOUNCEMENT_PLAYBACK_TIMEOUT_MS;
+	int err;
+
+	do {
+		err = S1V3G340_Wait_Playback_Done(PREEMPT_POLL_MS);
+		if (err != -ETIMEDOUT) {
+			return err;
+		}
+		if (ack_pending()) {
+			LOG_DBG("Playback cut short for a new punch");
+			err = S1V3G340_Stop_Playback();
+			return err ? err : -ECANCELED;
+		}
+	} while (k_uptime_get() < deadline);
+
+	playback_timeouts++;
+	LOG_WRN("No end of playback after %d ms (%u timeouts)",
+		ANNOUNCEMENT_PLAYBACK_TIMEOUT_MS, playback_timeouts);
+
+	return -ETIMEDOUT;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: announce
+//
+//  description:
+//    Plays the acknowledgement phrase followed by the split
+//    announcement as one sequence, so the speech IC goes from one to
+//    the other without a pause. When the acknowledgement is the opening
+//    phrase of the announcement it is not repeated.
+//
+//  return:
+//    0, -ECANCELED when a new punch cut the announcement short,
+//    -ETIMEDOUT when the speech IC did not report the end of the
+//    playback, or the error of the speech IC
+///////////////////////////////////////////////////////////////////////
+static int announce(const struct si_punch *punch)
+{
+	uint16_t phrases[S1V3G340_MAX_PHRASES];
+	int count = 0;
+	int err;
+
+#if defined(CONFIG_SI_VOICE_FAST_ACK)
+	phrases[count++] = CONFIG_SI_VOICE_ACK_PHRASE;
+	count += announcement_phrases(punch->siac_data, &phrases[count]);
+	if (phrases[1] == phrases[0]) {
+		memmove(&phrases[1], &phrases[2], (count - 2) * sizeof(phrases[0]));
+		count--;
+	}
+#else
+	count = announcement_phrases(punch->siac_data, phrases);
+#endif
+
+	err = S1V3G340_Play_Phrases(phrases, count);
+	if (err) {
+		return err;
+	}
+	trace_point(TRACE_ANNOUNCEMENT_STARTED);
+	latency_record(&ack_latency, punch->decoded_at);
+	LOG_DBG("decode-to-ack: %u us", ack_latency.last_us);
+
+	/* The speech IC takes no new sequence while this one is playing */
+	err = playback_wait();
+	if (err == 0) {
+		trace_point(TRACE_PLAYBACK_DONE);
+	}
+
+	return err;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: play_phrases
+//
+//  description:
+//    Plays a phrase list as given, without the acknowledgement, and
+//    waits for the end of the playback.
+//
+//  return:
+//    0, also when a new punch cut the playback short, -ETIMEDOUT when
+//    the speech IC did not report the end of the playback, or the
+//    error of the speech IC
+///////////////////////////////////////////////////////////////////////
+static int play_phrases(const uint16_t phrases[], int count)
+{
+	int err;
+
+	err = S1V3G340_Play_Phrases(phrases, count);
+	if (err) {
+		return err;
+	}
+
+	err = playback_wait();
+
+	return (err == -ECANCELED) ? 0 : err;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: ic_recover
+//
+//  description:
+//    Resets and initializes the speech IC after an exchange failed
+//    its retries. While a fault is being held off it returns straight
+//    away, so a dead IC costs at most one recovery per
+//    IC_FAULT_HOLDOFF_MS.
+//
+//  argument:
+//    fault_until: uptime in ms before which no recovery is attempted,
+//                 updated on a fault
+//
+//  return:
+//    0 when the speech IC is ready, -ENODEV otherwise
+///////////////////////////////////////////////////////////////////////
+static int ic_recover(int64_t *fault_until)
+{
+	if (k_uptime_get() < *fault_until) {
+		return -ENODEV;
+	}
+	if (S1V3G340_Recover() != 0) {
+		*fault_until = k_uptime_get() + IC_FAULT_HOLDOFF_MS;
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: audio_run
+//
+//  description:
+//    Announces queued punches, never returns. Runs on the calling
+//    thread, which main() hands over once it has initialized the speech
+//    IC, so no separate audio thread and stack are needed.
+//
+//    An announcement that fails after the driver's retries resets the
+//    speech IC and is played once more. When the reset does not bring
+//    the IC back a fault is reported and the announcements are dropped
+//    until the next recovery attempt. A sequence that was started but
+//    not reported done is not played again, it may have been heard.
+//
+//  argument:
+//    ic_ready: the speech IC has been initialized, otherwise it is reset
+//              before the first announcement
+///////////////////////////////////////////////////////////////////////
+void audio_run(bool ic_ready)
+{
+	struct audio_msg msg;
+	struct si_punch *punch = &msg.punch;
+	int64_t fault_until = 0;
+	int err;
+
+	/* Below the Bluetooth host threads, as the audio thread was */
+	k_thread_priority_set(k_current_get(), AUDIO_PRIORITY);
+
+	while (1) {
+		k_sem_take(&audio_sem, K_FOREVER);
+		if (k_msgq_get(&ack_msgq, &msg, K_NO_WAIT) != 0) {
+			(void)k_msgq_get(&audio_msgq, &msg, K_NO_WAIT);
+		}
+
+		if (IS_ENABLED(CONFIG_SI_VOICE_BENCH_LOG) && msg.type == AUDIO_MSG_PUNCH) {
+			/* First SPI activity caused by this punch */
+			printk("BENCH spi %u %u %u %llu\n", punch->siac_id, (uint8_t)punch->siac_data[1],
+			       punch->seq, k_cyc_to_us_floor64(k_cycle_get_32()));
+		}
+
+		if (msg.type == AUDIO_MSG_POWER_OFF) {
+			/* Returns only when the power off was called off */
+			if (power_off_enter() == -EIO) {
+				ic_ready = false;
+			}
+			continue;
+		}
+
+		if (!ic_ready) {
+			ic_ready = (ic_recover(&fault_until) == 0);
+			if (!ic_ready) {
+				LOG_WRN("Speech IC fault, announcement dropped");
+				if (msg.type == AUDIO_MSG_PUNCH) {
+					punch_log_announcement(punch, -ENODEV);
+				}
+				continue;
+			}
+		}
+
+		if (msg.type == AUDIO_MSG_PHRASES) {
+			err = play_phrases(msg.phrases.codes, msg.phrases.count);
+			if (err != 0 && err != -ETIMEDOUT) {
+				ic_ready = (ic_recover(&fault_until) == 0);
+				if (ic_ready) {
+					err = play_phrases(msg.phrases.codes, msg.phrases.count);
+					ic_ready = (err == 0 || err == -ETIMEDOUT);
+				}
+			}
+			continue;
+		}
+
+#if defined(CONFIG_S1V3G340_EMUL)
+		struct s1v3g340_emul_stats before, after;
+
+		s1v3g340_emul_stats_get(&before);
+#endif
+		trace_punch_begin(&punch->trace);
+		err = announce(punch);
+		if (err == -ECANCELED) {
+			LOG_INF("Announcement of SIAC %u cut short by a new punch", punch->siac_id);
+		} else if (err == -ETIMEDOUT) {
+			/* Logged by playback_wait(), kept in the punch log */
+		} else if (err != 0) {
+			LOG_WRN("Announcement failed (err %d), resetting the speech IC", err);
+			ic_ready = (ic_recover(&fault_until) == 0);
+			if (ic_ready) {
+				err = announce(punch);
+				/* Reset again before the next punch if this failed too */
+				ic_ready = (err == 0 || err == -ETIMEDOUT);
+			} else {
+				err = -ENODEV;
+			}
+		}
+		trace_punch_end();
+		/* RAM only, the flash write happens on the punch log work queue */
+		punch_log_announcement(punch, err);
+#if defined(CONFIG_S1V3G340_EMUL)
+		if (IS_ENABLED(CONFIG_SI_VOICE_BENCH_LOG)) {
+			/* SPI and speech IC cost of this announcement */
+			s1v3g340_emul_stats_get(&after);
+			printk("BENCH isc %u %u %u %u %u %llu %u\n", punch->siac_id,
+			       (uint8_t)punch->siac_data[1], punch->seq,
+			       after.bytes - before.bytes, after.transfers - before.transfers,
+			       after.busy_us - before.busy_us, after.errors - before.errors);
+		}
+#endif
+	}
+}
+
+/* Puts a message into one of the queues and wakes the audio worker */
+static int audio_put(struct k_msgq *msgq, const struct audio_msg *msg)
+{
+	int err;
+
+	err = k_msgq_put(msgq, msg, K_NO_WAIT);
+	if (err == 0) {
+		k_sem_give(&audio_sem);
+	}
+
+	return err;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: audio_submit_punch
+//
+//  description:
+//    Queues a decoded punch for announcement. Safe to call from the
+//    Bluetooth RX thread, never blocks. With CONFIG_SI_VOICE_FAST_ACK,
+//    a punch of CONFIG_SI_VOICE_BOUND_SIAC_ID is announced before the
+//    other queued messages and stops the playback in progress. Without
+//    a bound SIAC punches are announced in turn.
+//
+//  argument:
+//    punch: decoded punch, copied into the queue
+///////////////////////////////////////////////////////////////////////
+int audio_submit_punch(const struct si_punch *punch)
+{
+	struct audio_msg msg = {
+		.type = AUDIO_MSG_PUNCH,
+		.punch = *punch,
+	};
+	bool priority = IS_ENABLED(CONFIG_SI_VOICE_FAST_ACK) &&
+			CONFIG_SI_VOICE_BOUND_SIAC_ID != 0 &&
+			punch->siac_id == CONFIG_SI_VOICE_BOUND_SIAC_ID;
+
+	return audio_put(priority ? &ack_msgq : &audio_msgq, &msg);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: audio_submit_phrases
+//
+//  description:
+//    Queues a phrase list to be played as is, in turn with the punches.
+//    Never blocks.
+//
+//  argument:
+//    phrases: phrase codes on the speech IC, copied into the queue
+//    count: number of phrases, 1 to S1V3G340_MAX_PHRASES
+///////////////////////////////////////////////////////////////////////
+int audio_submit_phrases(const uint16_t phrases[], int count)
+{
+	struct audio_msg msg = {
+		.type = AUDIO_MSG_PHRASES,
+	};
+
+	if (count < 1 || count > S1V3G340_MAX_PHRASES) {
+		return -EINVAL;
+	}
+
+	memcpy(msg.phrases.codes, phrases, count * sizeof(phrases[0]));
+	msg.phrases.count = count;
+
+	return audio_put(&audio_msgq, &msg);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: audio_submit_power_off
+//
+//  description:
+//    Queues the power off behind the announcements still waiting, so
+//    the speech IC goes to standby only when they have been played.
+//    Never blocks.
+///////////////////////////////////////////////////////////////////////
+int audio_submit_power_off(void)
+{
+	struct audio_msg msg = {
+		.type = AUDIO_MSG_POWER_OFF,
+	};
+
+	return audio_put(&audio_msgq, &msg);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: audio_latency_get
+//
+//  description:
+//    Copies the decode-to-ack latency of the punches announced so far,
+//    up to the speech IC accepting the sequence, when its first phrase
+//    starts playing. The speech IC reports no event when a later phrase
+//    starts, so the start of the announcement after an acknowledgement
+//    phrase of its own is not measured.
+///////////////////////////////////////////////////////////////////////
+void audio_latency_get(struct audio_latency *ack)
+{
+	*ack = ack_latency;
+}
+
+/* Free slots in the audio queue, for flow control of the submitters */
+uint32_t audio_queue_free(void)
+{
+	return k_msgq_num_free_get(&audio_msgq);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef AUDIO_H_
+#define AUDIO_H_
+
+#include <zephyr.h>
+#include "trace.h"
+
+/* Punch record carried in the SPORTident manufacturer data:
+ * 0x07, control number, hours, minutes, followed by three timestamp bytes.
+ */
+#define SIAC_DATA_LEN	7
+
+/* Punch decoded from a SPORTident advertisement */
+struct si_punch {
+	uint32_t siac_id;
+	uint32_t seq;			/* station emulator sequence number, 0 if absent */
+	uint32_t decoded_at;		/* k_cycle_get_32() when the punch was decoded */
+	char siac_data[SIAC_DATA_LEN];
+	struct trace_record trace;
+};
+
+/* Latency from punch decode to the start of the sequence on the speech IC */
+struct audio_latency {
+	uint32_t count;
+	uint32_t last_us;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint64_t total_us;
+};
+
+void audio_run(bool ic_ready);
+int audio_submit_punch(const struct si_punch *punch);
+int audio_submit_phrases(const uint16_t phrases[], int count);
+uint32_t audio_queue_free(void);
+int audio_submit_power_off(void);
+void audio_latency_get(struct audio_latency *ack);
+
+#endif /* AUDIO_H_ */
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <logging/log.h>
+#include <shell/shell.h>
+#include <timing/timing.h>
+#include <zephyr/bluetooth/hci.h>
+#include "core_stats.h"
+
+LOG_MODULE_REGISTER(core_stats, CONFIG_SI_VOICE_LOG_LEVEL);
+
+/* Spacing of the timed commands, spread over the interval so they do
+ * not queue behind each other.
+ */
+#define HCI_PROBE_SPACING_MS \
+	(CONFIG_SI_VOICE_CORE_STATS_INTERVAL * MSEC_PER_SEC / CONFIG_SI_VOICE_CORE_STATS_HCI_PROBES)
+
+static void core_stats_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(core_stats_work, core_stats_work_handler);
+
+static struct k_spinlock core_stats_lock;
+static struct core_stats_report last_report;
+
+/* Accumulated over the current interval by the work handler only */
+static struct {
+	int64_t start;
+	uint64_t active_cycles;
+	uint64_t total_cycles;
+	uint32_t probes;
+	uint32_t hci_count;
+	uint32_t hci_min_us;
+	uint32_t hci_max_us;
+	uint64_t hci_sum_us;
+	uint32_t hci_worst_us;
+} acc;
+
+static void cpu_cycles_get(uint64_t *active, uint64_t *total)
+{
+	k_thread_runtime_stats_t stats;
+
+	if (k_thread_runtime_stats_all_get(&stats) == 0) {
+		*active = stats.execution_cycles - stats.idle_cycles;
+		*total = stats.execution_cycles;
+	} else {
+		*active = 0;
+		*total = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: hci_round_trip
+//
+//  description:
+//    Times HCI Read Local Version Information from the command leaving
+//    the host to its Command Complete waking this thread. The controller
+//    answers it without touching the radio, so on the nRF5340 this is
+//    the IPC latency between the cores plus the scheduling on both, the
+//    same path every advertising report takes to the application core.
+//
+//  return:
+//    Round trip in microseconds, or a negative error code
+///////////////////////////////////////////////////////////////////////
+static int hci_round_trip(void)
+{
+	struct net_buf *rsp;
+	int err;
+#if defined(CONFIG_TIMING_FUNCTIONS)
+	timing_t start = timing_counter_get();
+#else
+	uint32_t start = k_cycle_get_32();
+#endif
+
+	err = bt_hci_cmd_send_sync(BT_HCI_OP_READ_LOCAL_VERSION_INFO, NULL, &rsp);
+	if (err) {
+		return err;
+	}
+
+#if defined(CONFIG_TIMING_FUNCTIONS)
+	timing_t end = timing_counter_get();
+	uint32_t us = timing_cycles_to_ns(timing_cycles_get(&start, &end)) / NSEC_PER_USEC;
+#else
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+#endif
+
+	net_buf_unref(rsp);
+
+	return us;
+}
+
+static void interval_start(void)
+{
+	acc.start = k_uptime_get();
+	cpu_cycles_get(&acc.active_cycles, &acc.total_cycles);
+	acc.probes = 0;
+	acc.hci_count = 0;
+	acc.hci_min_us = UINT32_MAX;
+	acc.hci_max_us = 0;
+	acc.hci_sum_us = 0;
+}
+
+static void interval_end(void)
+{
+	struct core_stats_report report = { 0 };
+	uint64_t active, total;
+
+	cpu_cycles_get(&active, &total);
+
+	report.interval_ms = k_uptime_get() - acc.start;
+	if (total > acc.total_cycles) {
+		report.load_permille = (active - acc.active_cycles) * 1000 /
+				       (total - acc.total_cycles);
+	}
+	report.hci_count = acc.hci_count;
+	if (acc.hci_count) {
+		report.hci_min_us = acc.hci_min_us;
+		report.hci_avg_us = acc.hci_sum_us / acc.hci_count;
+		report.hci_max_us = acc.hci_max_us;
+	}
+	report.hci_worst_us = acc.hci_worst_us;
+
+	k_spinlock_key_t key = k_spin_lock(&core_stats_lock);
+
+	last_report = report;
+	k_spin_unlock(&core_stats_lock, key);
+
+	LOG_INF("app core %u.%u%% busy, HCI round trip %u/%u/%u us (min/avg/max of %u)",
+		report.load_permille / 10, report.load_permille % 10, report.hci_min_us,
+		report.hci_avg_us, report.hci_max_us, report.hci_count);
+
+	if (IS_ENABLED(CONFIG_SI_VOICE_BENCH_LOG)) {
+		printk("BENCH core %u %u %u %u %llu\n", report.load_permille, report.hci_min_us,
+		       report.hci_avg_us, report.hci_max_us, k_ticks_to_us_floor64(k_uptime_ticks()));
+	}
+}
+
+static void core_stats_work_handler(struct k_work *work)
+{
+	int us = hci_round_trip();
+
+	if (us < 0) {
+		LOG_WRN("HCI round trip failed (err %d)", us);
+	} else {
+		acc.hci_count++;
+		acc.hci_sum_us += us;
+		acc.hci_min_us = MIN(acc.hci_min_us, (uint32_t)us);
+		acc.hci_max_us = MAX(acc.hci_max_us, (uint32_t)us);
+		acc.hci_worst_us = MAX(acc.hci_worst_us, (uint32_t)us);
+	}
+
+	if (++acc.probes >= CONFIG_SI_VOICE_CORE_STATS_HCI_PROBES) {
+		interval_end();
+		interval_start();
+	}
+
+	k_work_reschedule(&core_stats_work, K_MSEC(HCI_PROBE_SPACING_MS));
+}
+
+void core_stats_get(struct core_stats_report *report)
+{
+	k_spinlock_key_t key = k_spin_lock(&core_stats_lock);
+
+	*report = last_report;
+	k_spin_unlock(&core_stats_lock, key);
+}
+
+int core_stats_start(void)
+{
+#if defined(CONFIG_TIMING_FUNCTIONS)
+	/* Cycle counter resolution, the kernel clock ticks too slowly for an IPC round trip */
+	timing_init();
+	timing_start();
+#endif
+	interval_start();
+	k_work_schedule(&core_stats_work, K_MSEC(HCI_PROBE_SPACING_MS));
+
+	return 0;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_core_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct core_stats_report report;
+
+	core_stats_get(&report);
+
+	shell_print(sh, "last %u ms: app core %u.%u%% busy", report.interval_ms,
+		    report.load_permille / 10, report.load_permille % 10);
+	shell_print(sh, "HCI round trip min %u, avg %u, max %u us over %u commands",
+		    report.hci_min_us, report.hci_avg_us, report.hci_max_us, report.hci_count);
+	shell_print(sh, "longest HCI round trip since boot %u us", report.hci_worst_us);
+
+	return 0;
+}
+
+SHELL_CMD_REGISTER(corestats, NULL, "Application core load and HCI round trip", cmd_core_stats);
+#endif /* CONFIG_SHELL */
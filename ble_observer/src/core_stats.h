@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef CORE_STATS_H_
+#define CORE_STATS_H_
+
+#include <zephyr.h>
+
+/* Application core load and host to controller round trip of the last interval */
+struct core_stats_report {
+	uint32_t interval_ms;
+	uint32_t load_permille;		/* CPU not idle, from the thread runtime statistics */
+	uint32_t hci_count;		/* round trips timed, failed commands not counted */
+	uint32_t hci_min_us;
+	uint32_t hci_avg_us;
+	uint32_t hci_max_us;
+	uint32_t hci_worst_us;		/* longest round trip since boot */
+};
+
+#if defined(CONFIG_SI_VOICE_CORE_STATS)
+
+/* Starts the periodic report, after bt_enable() */
+int core_stats_start(void);
+
+/* Copies the report of the last completed interval */
+void core_stats_get(struct core_stats_report *report);
+
+#else
+
+static inline int core_stats_start(void) { return 0; }
+
+#endif /* CONFIG_SI_VOICE_CORE_STATS */
+
+#endif /* CORE_STATS_H_ */
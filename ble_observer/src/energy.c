@@ -0,0 +1,304 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <init.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/crc.h>
+#include <logging/log.h>
+#include <shell/shell.h>
+#include "energy.h"
+
+LOG_MODULE_REGISTER(energy, CONFIG_SI_VOICE_LOG_LEVEL);
+
+#define ENERGY_LEDGER_MAGIC	0x454e5247	/* "ENRG" */
+
+/* Open intervals are folded into the ledger at least this often, so a
+ * reset loses little of a rail that stays on, such as scanning.
+ */
+#define ENERGY_FOLD_INTERVAL_MS	10000
+
+/* Kept in RAM that is not cleared at boot, and retained through System
+ * OFF by power_off.c, valid while the CRC matches
+ */
+struct energy_ledger {
+	uint32_t magic;
+	uint32_t race;
+	uint32_t boots;
+	uint64_t uptime_us;
+	uint64_t rail_us[ENERGY_RAIL_COUNT];
+	uint32_t crc;
+};
+
+static __noinit struct energy_ledger ledger;
+
+static const char *const rail_names[ENERGY_RAIL_COUNT] = {
+	[ENERGY_RAIL_SCAN] = "scan",
+	[ENERGY_RAIL_SPI] = "spi",
+	[ENERGY_RAIL_IC_AWAKE] = "ic-awake",
+	[ENERGY_RAIL_IC_STANDBY] = "ic-standby",
+	[ENERGY_RAIL_AMP] = "amp",
+	[ENERGY_RAIL_CPU] = "cpu",
+};
+
+/* Current drawn by each rail while on, in uA, from Kconfig for the board */
+static const uint32_t rail_ua[ENERGY_RAIL_COUNT] = {
+	[ENERGY_RAIL_SCAN] = CONFIG_SI_VOICE_ENERGY_SCAN_UA,
+	[ENERGY_RAIL_SPI] = CONFIG_SI_VOICE_ENERGY_SPI_UA,
+	[ENERGY_RAIL_IC_AWAKE] = CONFIG_SI_VOICE_ENERGY_IC_AWAKE_UA,
+	[ENERGY_RAIL_IC_STANDBY] = CONFIG_SI_VOICE_ENERGY_IC_STANDBY_UA,
+	[ENERGY_RAIL_AMP] = CONFIG_SI_VOICE_ENERGY_AMP_UA,
+	[ENERGY_RAIL_CPU] = CONFIG_SI_VOICE_ENERGY_CPU_UA,
+};
+
+static struct k_spinlock energy_lock;
+static uint32_t rails_on;
+static int64_t rail_on_since[ENERGY_RAIL_COUNT];
+static int64_t last_fold;
+static uint64_t last_cpu_cycles;
+
+static void energy_fold_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(energy_fold_work, energy_fold_work_handler);
+
+static uint32_t ledger_crc(void)
+{
+	return crc32_ieee((const uint8_t *)&ledger, offsetof(struct energy_ledger, crc));
+}
+
+/* False on the first power-on, the __noinit RAM holds garbage then */
+static bool ledger_valid(void)
+{
+	return ledger.magic == ENERGY_LEDGER_MAGIC && ledger.crc == ledger_crc();
+}
+
+static uint64_t cpu_active_cycles(void)
+{
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+	k_thread_runtime_stats_t stats;
+
+	if (k_thread_runtime_stats_all_get(&stats) == 0) {
+		return stats.execution_cycles - stats.idle_cycles;
+	}
+#endif
+	return 0;
+}
+
+static void rail_fold(enum energy_rail rail, int64_t now)
+{
+	uint64_t us = k_ticks_to_us_floor64(now - rail_on_since[rail]);
+
+	if (rail == ENERGY_RAIL_SCAN) {
+		/* The radio only receives during the scan window */
+		us = us * CONFIG_SI_VOICE_SCAN_WINDOW / CONFIG_SI_VOICE_SCAN_INTERVAL;
+	}
+	ledger.rail_us[rail] += us;
+	rail_on_since[rail] = now;
+}
+
+/* Adds the open intervals up to now to the ledger, energy_lock held */
+static void ledger_fold(void)
+{
+	int64_t now = k_uptime_ticks();
+	uint64_t cpu_cycles = cpu_active_cycles();
+
+	for (int i = 0; i < ENERGY_RAIL_COUNT; i++) {
+		if (rails_on & BIT(i)) {
+			rail_fold(i, now);
+		}
+	}
+
+	ledger.rail_us[ENERGY_RAIL_CPU] += k_cyc_to_us_floor64(cpu_cycles - last_cpu_cycles);
+	last_cpu_cycles = cpu_cycles;
+
+	ledger.uptime_us += k_ticks_to_us_floor64(now - last_fold);
+	last_fold = now;
+
+	ledger.crc = ledger_crc();
+}
+
+void energy_on(enum energy_rail rail)
+{
+	k_spinlock_key_t key = k_spin_lock(&energy_lock);
+
+	if (!(rails_on & BIT(rail))) {
+		rails_on |= BIT(rail);
+		rail_on_since[rail] = k_uptime_ticks();
+	}
+
+	k_spin_unlock(&energy_lock, key);
+}
+
+void energy_off(enum energy_rail rail)
+{
+	k_spinlock_key_t key = k_spin_lock(&energy_lock);
+
+	if (rails_on & BIT(rail)) {
+		rail_fold(rail, k_uptime_ticks());
+		rails_on &= ~BIT(rail);
+		ledger.crc = ledger_crc();
+	}
+
+	k_spin_unlock(&energy_lock, key);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: energy_report_get
+//
+//  description:
+//    Totals of the current race with the charge per rail, using the
+//    per-board current coefficients from Kconfig.
+///////////////////////////////////////////////////////////////////////
+void energy_report_get(struct energy_report *report)
+{
+	k_spinlock_key_t key = k_spin_lock(&energy_lock);
+
+	ledger_fold();
+	report->race = ledger.race;
+	report->boots = ledger.boots;
+	report->uptime_us = ledger.uptime_us;
+	memcpy(report->rail_us, ledger.rail_us, sizeof(report->rail_us));
+
+	k_spin_unlock(&energy_lock, key);
+
+	/* uA x us / 3600 = pAh, / 1000 = nAh */
+	report->total_nah = report->uptime_us * CONFIG_SI_VOICE_ENERGY_SLEEP_UA / 3600000;
+	for (int i = 0; i < ENERGY_RAIL_COUNT; i++) {
+		report->rail_nah[i] = report->rail_us[i] * rail_ua[i] / 3600000;
+		report->total_nah += report->rail_nah[i];
+	}
+}
+
+void energy_race_start(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&energy_lock);
+	uint32_t race = ledger_valid() ? ledger.race + 1 : 1;
+
+	ledger_fold();
+	memset(&ledger, 0, sizeof(ledger));
+	ledger.magic = ENERGY_LEDGER_MAGIC;
+	ledger.race = race;
+	ledger.boots = 1;
+	ledger.crc = ledger_crc();
+
+	k_spin_unlock(&energy_lock, key);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: energy_power_off
+//
+//  description:
+//    Folds the open intervals into the ledger before System OFF, so
+//    the race totals continue after the wake.
+//
+//  argument:
+//    len: set to the size of the ledger
+//
+//  return:
+//    the ledger, whose RAM has to be retained through System OFF
+///////////////////////////////////////////////////////////////////////
+const void *energy_power_off(size_t *len)
+{
+	k_spinlock_key_t key = k_spin_lock(&energy_lock);
+
+	ledger_fold();
+
+	k_spin_unlock(&energy_lock, key);
+
+	*len = sizeof(ledger);
+
+	return &ledger;
+}
+
+static void energy_fold_work_handler(struct k_work *work)
+{
+	static int64_t last_log;
+	k_spinlock_key_t key = k_spin_lock(&energy_lock);
+
+	ledger_fold();
+	k_spin_unlock(&energy_lock, key);
+
+	if (CONFIG_SI_VOICE_ENERGY_LOG_INTERVAL > 0 &&
+	    k_uptime_get() - last_log >= CONFIG_SI_VOICE_ENERGY_LOG_INTERVAL * MSEC_PER_SEC) {
+		struct energy_report report;
+
+		last_log = k_uptime_get();
+		energy_report_get(&report);
+		LOG_INF("race %u: %llu s, %llu.%03llu mAh (scan %llu, spi %llu, ic %llu/%llu, "
+			"amp %llu, cpu %llu uAh)", report.race, report.uptime_us / USEC_PER_SEC,
+			report.total_nah / 1000000, (report.total_nah / 1000) % 1000,
+			report.rail_nah[ENERGY_RAIL_SCAN] / 1000,
+			report.rail_nah[ENERGY_RAIL_SPI] / 1000,
+			report.rail_nah[ENERGY_RAIL_IC_AWAKE] / 1000,
+			report.rail_nah[ENERGY_RAIL_IC_STANDBY] / 1000,
+			report.rail_nah[ENERGY_RAIL_AMP] / 1000,
+			report.rail_nah[ENERGY_RAIL_CPU] / 1000);
+	}
+
+	k_work_reschedule(&energy_fold_work, K_MSEC(ENERGY_FOLD_INTERVAL_MS));
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_energy_show(const struct shell *sh, size_t argc, char **argv)
+{
+	struct energy_report report;
+
+	energy_report_get(&report);
+
+	shell_print(sh, "race %u, %u boots, %llu s", report.race, report.boots,
+		    report.uptime_us / USEC_PER_SEC);
+	shell_print(sh, "%-12s %12s %8s %14s", "rail", "on ms", "uA", "uAh");
+	for (int i = 0; i < ENERGY_RAIL_COUNT; i++) {
+		shell_print(sh, "%-12s %12llu %8u %10llu.%03llu", rail_names[i],
+			    report.rail_us[i] / USEC_PER_MSEC, rail_ua[i],
+			    report.rail_nah[i] / 1000, report.rail_nah[i] % 1000);
+	}
+	shell_print(sh, "%-12s %12llu %8u", "sleep", report.uptime_us / USEC_PER_MSEC,
+		    CONFIG_SI_VOICE_ENERGY_SLEEP_UA);
+	shell_print(sh, "total %llu.%06llu mAh, average %llu uA", report.total_nah / 1000000,
+		    report.total_nah % 1000000,
+		    report.uptime_us ? report.total_nah * 3600000 / report.uptime_us : 0);
+
+	return 0;
+}
+
+static int cmd_energy_race(const struct shell *sh, size_t argc, char **argv)
+{
+	energy_race_start();
+	shell_print(sh, "Energy ledger cleared for a new race");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(energy_cmds,
+	SHELL_CMD(show, NULL, "Time on and charge per rail for this race", cmd_energy_show),
+	SHELL_CMD(race, NULL, "Start a new race, clears the totals", cmd_energy_race),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(energy, &energy_cmds, "Energy ledger", NULL);
+#endif /* CONFIG_SHELL */
+
+static int energy_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+
+	if (ledger_valid()) {
+		/* Warm reset during a race, keep counting */
+		ledger.boots++;
+		ledger.crc = ledger_crc();
+	} else {
+		energy_race_start();
+	}
+
+	last_fold = k_uptime_ticks();
+	last_cpu_cycles = cpu_active_cycles();
+	k_work_schedule(&energy_fold_work, K_MSEC(ENERGY_FOLD_INTERVAL_MS));
+
+	return 0;
+}
+
+SYS_INIT(energy_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
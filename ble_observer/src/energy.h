@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ENERGY_H_
+#define ENERGY_H_
+
+#include <zephyr.h>
+
+/* Consumers tracked by the energy ledger */
+enum energy_rail {
+	ENERGY_RAIL_SCAN,		/* radio receiving, scan window duty applied */
+	ENERGY_RAIL_SPI,		/* SPI master transferring */
+	ENERGY_RAIL_IC_AWAKE,		/* speech IC out of reset and not in standby */
+	ENERGY_RAIL_IC_STANDBY,		/* speech IC in standby */
+	ENERGY_RAIL_AMP,		/* amplifier unmuted */
+	ENERGY_RAIL_CPU,		/* CPU not idle, from the thread runtime statistics */
+	ENERGY_RAIL_COUNT
+};
+
+/* Totals of the current race, kept across resets */
+struct energy_report {
+	uint32_t race;
+	uint32_t boots;			/* boots since the race was started */
+	uint64_t uptime_us;
+	uint64_t rail_us[ENERGY_RAIL_COUNT];
+	uint64_t rail_nah[ENERGY_RAIL_COUNT];
+	uint64_t total_nah;		/* rails plus the sleep current over the uptime */
+};
+
+#if defined(CONFIG_SI_VOICE_ENERGY)
+
+void energy_on(enum energy_rail rail);
+void energy_off(enum energy_rail rail);
+void energy_report_get(struct energy_report *report);
+/* Starts a new race, the totals of the previous one are cleared */
+void energy_race_start(void);
+const void *energy_power_off(size_t *len);
+
+#else
+
+static inline void energy_on(enum energy_rail rail) {}
+static inline void energy_off(enum energy_rail rail) {}
+
+#endif /* CONFIG_SI_VOICE_ENERGY */
+
+#endif /* ENERGY_H_ */
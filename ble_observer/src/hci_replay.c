@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zephyr.h>
+#include <init.h>
+#include <random/rand32.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/printk.h>
+#include <logging/log.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/bluetooth/buf.h>
+#include <zephyr/drivers/bluetooth/hci_driver.h>
+#include "soc.h"
+#include "cmdline.h"
+#include "posix_board_if.h"
+#include "observer.h"
+
+LOG_MODULE_REGISTER(hci_replay, CONFIG_SI_VOICE_LOG_LEVEL);
+
+/* Below the audio worker and the Bluetooth threads, so a report has gone
+ * through the whole pipeline before the next one is fed
+ */
+#define HCI_REPLAY_PRIORITY	K_PRIO_PREEMPT(10)
+#define HCI_REPLAY_STACK_SIZE	2048
+
+/* Time given to the host to finish the last reports before the results */
+#define HCI_REPLAY_DRAIN_MS	100
+
+/* btsnoop capture, all fields big endian */
+#define BTSNOOP_ID		"btsnoop"
+#define BTSNOOP_VERSION		1
+#define BTSNOOP_HCI_UNENCAP	1001	/* HCI packet, the type in the flags */
+#define BTSNOOP_HCI_UART	1002	/* H4 packet type byte first */
+#define BTSNOOP_LINUX_MONITOR	2001	/* btmon, the monitor opcode in the flags */
+
+#define BTSNOOP_FLAG_RECEIVED	BIT(0)
+#define BTSNOOP_FLAG_CMD_EVT	BIT(1)
+#define H4_EVENT		0x04
+#define MONITOR_EVENT_PKT	0x0003
+
+struct btsnoop_hdr {
+	char id[8];
+	uint32_t version;
+	uint32_t datalink;
+} __packed;
+
+struct btsnoop_rec {
+	uint32_t orig_len;
+	uint32_t incl_len;
+	uint32_t flags;
+	uint32_t drops;
+	uint64_t ts_us;		/* microseconds since year 0 */
+} __packed;
+
+/* Public address answered to Read BD_ADDR */
+static const bt_addr_t replay_addr = { .val = { 0x01, 0x00, 0xde, 0xc0, 0xde, 0xc0 } };
+
+static char *replay_file = CONFIG_SI_VOICE_HCI_REPLAY_FILE;
+static uint32_t replay_speedup = CONFIG_SI_VOICE_HCI_REPLAY_SPEEDUP;
+
+static FILE *capture;
+static uint32_t datalink;
+
+/* Next event to feed, a whole HCI event with its header */
+static uint8_t next_evt[BT_HCI_EVT_HDR_SIZE + UINT8_MAX];
+static size_t next_len;
+static uint64_t next_ts_us;
+static uint64_t first_ts_us;
+static bool has_next;
+static bool ext_reports;		/* the capture holds LE Extended Advertising Reports */
+
+static bool scanning;
+static bool started;
+static int64_t start_ticks;		/* uptime the first report is due at */
+static int64_t paused_at;
+
+static K_FIFO_DEFINE(cmd_fifo);
+
+/* Host (not simulated) time, native_posix kernel cycles do not advance with work */
+struct host_time {
+	uint64_t wall_ns;
+	uint64_t cpu_ns;
+	uint64_t cycles;
+};
+
+static struct host_time replay_start;
+
+static struct {
+	uint32_t events;
+	uint32_t reports;
+	uint32_t dropped;
+	uint32_t skipped;	/* records that are not advertising reports */
+} stats;
+
+static void host_time_get(struct host_time *t)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t->wall_ns = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+	/* All Zephyr threads are threads of this process */
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	t->cpu_ns = (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+#if defined(__x86_64__) || defined(__i386__)
+	t->cycles = __builtin_ia32_rdtsc();
+#else
+	t->cycles = 0;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: capture_next
+//
+//  description:
+//    Reads the capture up to the next LE Advertising Report or LE
+//    Extended Advertising Report event into next_evt. Commands, ACL
+//    data, other events and truncated records are skipped.
+//
+//  return:
+//    false at the end of the capture
+///////////////////////////////////////////////////////////////////////
+static bool capture_next(void)
+{
+	struct btsnoop_rec rec;
+	uint8_t record[1 + sizeof(next_evt)];	/* H4 packet type and the largest event */
+
+	while (fread(&rec, sizeof(rec), 1, capture) == 1) {
+		uint32_t len = sys_be32_to_cpu(rec.incl_len);
+		uint32_t flags = sys_be32_to_cpu(rec.flags);
+		const uint8_t *evt = record;
+		bool event;
+
+		if (len > sizeof(record)) {
+			stats.skipped++;
+			if (fseek(capture, len, SEEK_CUR) != 0) {
+				return false;
+			}
+			continue;
+		}
+		if (fread(record, 1, len, capture) != len) {
+			return false;
+		}
+
+		switch (datalink) {
+		case BTSNOOP_HCI_UNENCAP:
+			event = (flags & (BTSNOOP_FLAG_RECEIVED | BTSNOOP_FLAG_CMD_EVT)) ==
+				(BTSNOOP_FLAG_RECEIVED | BTSNOOP_FLAG_CMD_EVT);
+			break;
+		case BTSNOOP_HCI_UART:
+			event = (len > 0 && record[0] == H4_EVENT);
+			evt++;
+			len--;
+			break;
+		default:
+			event = (flags & 0xffff) == MONITOR_EVENT_PKT;
+			break;
+		}
+
+		if (!event || len < BT_HCI_EVT_HDR_SIZE + 2 ||
+		    evt[0] != BT_HCI_EVT_LE_META_EVENT || evt[1] != len - BT_HCI_EVT_HDR_SIZE ||
+		    (evt[2] != BT_HCI_EVT_LE_ADVERTISING_REPORT &&
+		     evt[2] != BT_HCI_EVT_LE_EXT_ADVERTISING_REPORT)) {
+			stats.skipped++;
+			continue;
+		}
+
+		memcpy(next_evt, evt, len);
+		next_len = len;
+		next_ts_us = sys_be64_to_cpu(rec.ts_us);
+		return true;
+	}
+
+	return false;
+}
+
+static int capture_open(void)
+{
+	struct btsnoop_hdr hdr;
+
+	if (strlen(replay_file) == 0) {
+		printk("HCI replay: no capture, set CONFIG_SI_VOICE_HCI_REPLAY_FILE or "
+		       "-hci_replay=<file>\n");
+		return -ENOENT;
+	}
+
+	capture = fopen(replay_file, "rb");
+	if (capture == NULL) {
+		printk("HCI replay: cannot open %s\n", replay_file);
+		return -ENOENT;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, capture) != 1 ||
+	    memcmp(hdr.id, BTSNOOP_ID, sizeof(BTSNOOP_ID)) != 0 ||
+	    sys_be32_to_cpu(hdr.version) != BTSNOOP_VERSION) {
+		printk("HCI replay: %s is not a btsnoop capture\n", replay_file);
+		return -EINVAL;
+	}
+
+	datalink = sys_be32_to_cpu(hdr.datalink);
+	if (datalink != BTSNOOP_HCI_UNENCAP && datalink != BTSNOOP_HCI_UART &&
+	    datalink != BTSNOOP_LINUX_MONITOR) {
+		printk("HCI replay: unsupported btsnoop datalink %u\n", datalink);
+		return -EINVAL;
+	}
+
+	has_next = capture_next();
+	first_ts_us = next_ts_us;
+	/* The host only scans with the extended commands when the controller has the feature */
+	ext_reports = has_next && next_evt[2] == BT_HCI_EVT_LE_EXT_ADVERTISING_REPORT;
+
+	if (replay_speedup == 0) {
+		printk("HCI replay: %s at maximum speed\n", replay_file);
+	} else {
+		printk("HCI replay: %s at %ux recorded speed\n", replay_file, replay_speedup);
+	}
+
+	return 0;
+}
+
+static void cmd_complete(uint16_t opcode, const uint8_t *rp, uint8_t len)
+{
+	struct bt_hci_evt_cmd_complete *cc;
+	struct bt_hci_evt_hdr *hdr;
+	struct net_buf *buf;
+
+	buf = bt_buf_get_evt(BT_HCI_EVT_CMD_COMPLETE, false, K_FOREVER);
+	hdr = net_buf_add(buf, sizeof(*hdr));
+	hdr->evt = BT_HCI_EVT_CMD_COMPLETE;
+	hdr->len = sizeof(*cc) + len;
+	cc = net_buf_add(buf, sizeof(*cc));
+	cc->ncmd = 1;
+	cc->opcode = sys_cpu_to_le16(opcode);
+	net_buf_add_mem(buf, rp, len);
+
+	(void)bt_recv(buf);
+}
+
+static void scan_enable(bool enable)
+{
+	if (enable == scanning) {
+		return;
+	}
+	scanning = enable;
+
+	if (!enable) {
+		paused_at = k_uptime_ticks();
+	} else if (!started) {
+		started = true;
+		start_ticks = k_uptime_ticks();
+		host_time_get(&replay_start);
+	} else {
+		/* Reports are not due while the host is not scanning */
+		start_ticks += k_uptime_ticks() - paused_at;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: cmd_handle
+//
+//  description:
+//    Answers a command of the host as an LE only controller without
+//    extended advertising, unless the capture holds extended reports.
+//    Commands the host does not need for scanning are refused with
+//    Unknown HCI Command.
+///////////////////////////////////////////////////////////////////////
+static void cmd_handle(struct net_buf *buf)
+{
+	struct bt_hci_cmd_hdr *hdr = (void *)buf->data;
+	uint16_t opcode = sys_le16_to_cpu(hdr->opcode);
+	uint8_t param = (hdr->param_len > 0) ? buf->data[sizeof(*hdr)] : 0;
+	uint8_t rp[sizeof(struct bt_hci_rp_read_supported_commands)] = { BT_HCI_ERR_SUCCESS };
+	uint8_t len = 1;
+
+	/* The host may reuse the command buffer for the Command Complete */
+	net_buf_unref(buf);
+
+	switch (opcode) {
+	case BT_HCI_OP_RESET:
+	case BT_HCI_OP_SET_EVENT_MASK:
+	case BT_HCI_OP_LE_SET_EVENT_MASK:
+	case BT_HCI_OP_LE_SET_RANDOM_ADDRESS:
+	case BT_HCI_OP_LE_SET_SCAN_PARAM:
+	case BT_HCI_OP_LE_SET_EXT_SCAN_PARAM:
+		break;
+	case BT_HCI_OP_LE_SET_SCAN_ENABLE:
+	case BT_HCI_OP_LE_SET_EXT_SCAN_ENABLE:
+		scan_enable(param != 0);
+		break;
+	case BT_HCI_OP_READ_LOCAL_VERSION_INFO: {
+		struct bt_hci_rp_read_local_version_info *ver = (void *)rp;
+
+		ver->hci_version = BT_HCI_VERSION_5_2;
+		ver->lmp_version = BT_HCI_VERSION_5_2;
+		ver->manufacturer = sys_cpu_to_le16(BT_COMP_ID_LF);
+		len = sizeof(*ver);
+		break;
+	}
+	case BT_HCI_OP_READ_SUPPORTED_COMMANDS: {
+		struct bt_hci_rp_read_supported_commands *cmds = (void *)rp;
+
+		cmds->commands[15] |= BIT(1);	/* Read BD_ADDR */
+		cmds->commands[27] |= BIT(7);	/* LE Rand, for the host PRNG */
+		len = sizeof(*cmds);
+		break;
+	}
+	case BT_HCI_OP_READ_LOCAL_FEATURES: {
+		struct bt_hci_rp_read_local_features *feat = (void *)rp;
+
+		/* BR/EDR not supported, LE supported */
+		feat->features[4] = BIT(5) | BIT(6);
+		len = sizeof(*feat);
+		break;
+	}
+	case BT_HCI_OP_READ_BD_ADDR: {
+		struct bt_hci_rp_read_bd_addr *addr = (void *)rp;
+
+		bt_addr_copy(&addr->bdaddr, &replay_addr);
+		len = sizeof(*addr);
+		break;
+	}
+	case BT_HCI_OP_LE_READ_BUFFER_SIZE: {
+		struct bt_hci_rp_le_read_buffer_size *size = (void *)rp;
+
+		size->le_max_len = sys_cpu_to_le16(27);
+		size->le_max_num = 1;
+		len = sizeof(*size);
+		break;
+	}
+	case BT_HCI_OP_LE_READ_LOCAL_FEATURES: {
+		struct bt_hci_rp_le_read_local_features *feat = (void *)rp;
+
+		if (ext_reports) {
+			feat->features[BT_LE_FEAT_BIT_EXT_ADV >> 3] |= BIT(BT_LE_FEAT_BIT_EXT_ADV & 7);
+		}
+		len = sizeof(*feat);
+		break;
+	}
+	case BT_HCI_OP_LE_RAND: {
+		struct bt_hci_rp_le_rand *rand = (void *)rp;
+
+		sys_rand_get(rand->rand, sizeof(rand->rand));
+		len = sizeof(*rand);
+		break;
+	}
+	default:
+		LOG_WRN("Unknown HCI command 0x%04x", opcode);
+		rp[0] = BT_HCI_ERR_UNKNOWN_CMD;
+		break;
+	}
+
+	cmd_complete(opcode, rp, len);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: report_feed
+//
+//  description:
+//    Hands next_evt to the host. At recorded speed an event that finds
+//    no free discardable buffer is dropped, as the controller drivers
+//    do; at maximum speed the replay waits for a buffer, so every report
+//    reaches the host.
+///////////////////////////////////////////////////////////////////////
+static void report_feed(void)
+{
+	struct net_buf *buf;
+
+	stats.events++;
+	stats.reports += next_evt[3];
+
+	if (replay_speedup == 0) {
+		buf = bt_buf_get_rx(BT_BUF_EVT, K_FOREVER);
+	} else {
+		buf = bt_buf_get_evt(BT_HCI_EVT_LE_META_EVENT, true, K_NO_WAIT);
+	}
+	if (buf == NULL || net_buf_tailroom(buf) < next_len) {
+		stats.dropped += next_evt[3];
+		if (buf != NULL) {
+			net_buf_unref(buf);
+		}
+		return;
+	}
+
+	net_buf_add_mem(buf, next_evt, next_len);
+	(void)bt_recv(buf);
+}
+
+static k_timeout_t report_due(void)
+{
+	uint64_t offset_us;
+
+	if (!scanning || !has_next) {
+		return K_FOREVER;
+	}
+	if (replay_speedup == 0) {
+		return K_NO_WAIT;
+	}
+
+	/* Report times are relative to the first report of the capture */
+	offset_us = (next_ts_us - first_ts_us) / replay_speedup;
+
+	return K_TIMEOUT_ABS_TICKS(start_ticks + k_us_to_ticks_ceil64(offset_us));
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: replay_results
+//
+//  description:
+//    Prints what the host made of the capture and its cost in host CPU
+//    time. Cycles are the CPU time at the rate the time stamp counter
+//    ran during the replay, so they stay comparable at recorded speed,
+//    when the process sleeps between reports.
+//
+//  argument:
+//    sim_us: simulated time from the first to the last report fed
+///////////////////////////////////////////////////////////////////////
+static void replay_results(uint64_t sim_us)
+{
+	struct host_time end;
+	uint32_t app_reports, si_reports;
+	uint64_t wall_ns, cpu_ns, cycles;
+	uint32_t reports = MAX(stats.reports - stats.dropped, 1);
+
+	host_time_get(&end);
+	observer_stats_get(&app_reports, &si_reports);
+
+	wall_ns = MAX(end.wall_ns - replay_start.wall_ns, 1);
+	cpu_ns = MAX(end.cpu_ns - replay_start.cpu_ns, 1);
+	cycles = (uint64_t)((double)(end.cycles - replay_start.cycles) * cpu_ns / wall_ns);
+
+	printk("HCI replay done: %u events, %u reports, %u dropped, %u other records, "
+	       "%llu ms simulated\n", stats.events, stats.reports, stats.dropped, stats.skipped,
+	       sim_us / USEC_PER_MSEC);
+	printk("HCI replay: %u reports to the application, %u SI reports decoded\n",
+	       app_reports, si_reports);
+	printk("HCI replay: %llu reports/s of host CPU, %llu ns and %llu cycles per report\n",
+	       (uint64_t)reports * NSEC_PER_SEC / cpu_ns, cpu_ns / reports, cycles / reports);
+	if (IS_ENABLED(CONFIG_SI_VOICE_BENCH_LOG)) {
+		printk("BENCH replay %u %u %u %u %u %llu %llu %llu\n", stats.events, stats.reports,
+		       stats.dropped, app_reports, si_reports, sim_us, cpu_ns, cycles);
+	}
+}
+
+static void replay_thread(void)
+{
+	struct net_buf *buf;
+	uint64_t sim_us;
+	int64_t drain_end;
+
+	while (has_next || !started) {
+		buf = net_buf_get(&cmd_fifo, report_due());
+		if (buf != NULL) {
+			cmd_handle(buf);
+			continue;
+		}
+
+		report_feed();
+		has_next = capture_next();
+	}
+
+	/* Let the host finish the last reports, still answering its commands */
+	sim_us = k_ticks_to_us_floor64(k_uptime_ticks() - start_ticks);
+	drain_end = k_uptime_ticks() + k_ms_to_ticks_ceil64(HCI_REPLAY_DRAIN_MS);
+	while ((buf = net_buf_get(&cmd_fifo, K_TIMEOUT_ABS_TICKS(drain_end))) != NULL) {
+		cmd_handle(buf);
+	}
+
+	replay_results(sim_us);
+	fclose(capture);
+	posix_exit(0);
+}
+
+K_THREAD_DEFINE(hci_replay_tid, HCI_REPLAY_STACK_SIZE, replay_thread, NULL, NULL, NULL,
+		HCI_REPLAY_PRIORITY, 0, SYS_FOREVER_MS);
+
+static int replay_open(void)
+{
+	int err;
+
+	err = capture_open();
+	if (err) {
+		/* Nothing to benchmark, do not leave a run waiting */
+		posix_exit(1);
+		return err;
+	}
+
+	k_thread_start(hci_replay_tid);
+
+	return 0;
+}
+
+static int replay_send(struct net_buf *buf)
+{
+	if (bt_buf_get_type(buf) != BT_BUF_CMD) {
+		net_buf_unref(buf);
+		return -EINVAL;
+	}
+
+	/* Answered on the replay thread, not in the host's send path */
+	net_buf_put(&cmd_fifo, buf);
+
+	return 0;
+}
+
+static const struct bt_hci_driver replay_drv = {
+	.name = "HCI replay",
+	.bus = BT_HCI_DRIVER_BUS_VIRTUAL,
+	.open = replay_open,
+	.send = replay_send,
+};
+
+static void hci_replay_options(void)
+{
+	static struct args_struct_t options[] = {
+		{
+			.option = "hci_replay",
+			.name = "file",
+			.type = 's',
+			.dest = (void *)&replay_file,
+			.descript = "btsnoop capture to replay into the Bluetooth host",
+		},
+		{
+			.option = "hci_replay_speedup",
+			.name = "n",
+			.type = 'u',
+			.dest = (void *)&replay_speedup,
+			.descript = "Replay n times faster than recorded, 0 as fast as possible",
+		},
+		ARG_TABLE_ENDMARKER
+	};
+
+	native_add_command_line_opts(options);
+}
+
+NATIVE_TASK(hci_replay_options, PRE_BOOT_1, 10);
+
+static int hci_replay_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+
+	return bt_hci_driver_register(&replay_drv);
+}
+
+SYS_INIT(hci_replay_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
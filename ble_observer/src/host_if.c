@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <zephyr.h>
+#include <device.h>
+#include <devicetree.h>
+#include <drivers/spi.h>
+#include <sys/crc.h>
+#include <zephyr/sys/byteorder.h>
+#include <logging/log.h>
+#include <shell/shell.h>
+#include "audio.h"
+#include "host_if.h"
+#include "punch_log.h"
+#include "s1v3g340.h"
+
+LOG_MODULE_REGISTER(host_if, CONFIG_SI_VOICE_LOG_LEVEL);
+
+#define MY_SPI_SLAVE DT_NODELABEL(my_spi_slave)
+
+/* Above the audio worker, so the next receive buffer is armed while an
+ * announcement is being sent to the speech IC
+ */
+#define HOST_IF_PRIORITY	K_PRIO_PREEMPT(6)
+
+#define HOST_IF_BUF_SIZE	CONFIG_SI_VOICE_HOST_IF_BUF_SIZE
+
+BUILD_ASSERT(HOST_IF_BUF_SIZE >= sizeof(struct host_if_status),
+	     "host interface buffer smaller than the status");
+BUILD_ASSERT(SIAC_DATA_LEN == sizeof(((struct host_if_punch *)0)->siac_data),
+	     "host interface punch record out of step with SIAC_DATA_LEN");
+
+static const struct device *spis_dev = DEVICE_DT_GET(MY_SPI_SLAVE);
+
+static const struct spi_config spis_cfg = {
+	.operation = SPI_OP_MODE_SLAVE | SPI_WORD_SET(8) | SPI_TRANSFER_MSB,
+};
+
+/* Two receive and two transmit buffers, EasyDMA fills one pair while the
+ * thread parses the other
+ */
+static uint8_t rx_bufs[2][HOST_IF_BUF_SIZE];
+static uint8_t tx_bufs[2][HOST_IF_BUF_SIZE];
+
+static struct k_poll_signal spis_sig = K_POLL_SIGNAL_INITIALIZER(spis_sig);
+
+/* Updated by the host interface thread only, copied for readers after
+ * every transaction
+ */
+static struct host_if_stats stats;
+static struct host_if_stats shown_stats;
+static struct k_spinlock stats_lock;
+static uint8_t last_seq;
+
+///////////////////////////////////////////////////////////////////////
+//  function: spis_arm
+//
+//  description:
+//    Hands buffer pair i to the SPI slave for the next transaction and
+//    fills its transmit half with the current status.
+///////////////////////////////////////////////////////////////////////
+static int spis_arm(int i)
+{
+	struct host_if_status status = {
+		.sync = HOST_IF_SYNC,
+		.last_seq = last_seq,
+		.queue_free = audio_queue_free(),
+		.accepted = sys_cpu_to_le16(stats.accepted),
+		.rejected = sys_cpu_to_le16(stats.crc_errors + stats.bad_frames + stats.queue_full),
+	};
+	const struct spi_buf tx_buf = {
+		.buf = tx_bufs[i],
+		.len = sizeof(tx_bufs[i]),
+	};
+	const struct spi_buf rx_buf = {
+		.buf = rx_bufs[i],
+		.len = sizeof(rx_bufs[i]),
+	};
+	const struct spi_buf_set tx = {
+		.buffers = &tx_buf,
+		.count = 1,
+	};
+	const struct spi_buf_set rx = {
+		.buffers = &rx_buf,
+		.count = 1,
+	};
+
+	memcpy(tx_bufs[i], &status, sizeof(status));
+
+	return spi_transceive_async(spis_dev, &spis_cfg, &tx, &rx, &spis_sig);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: frame_submit
+//
+//  description:
+//    Queues the announcement of one frame whose CRC has been checked.
+//
+//  return:
+//    0, -EINVAL for a payload that does not fit its type or -ENOMSG
+//    for a full audio queue
+///////////////////////////////////////////////////////////////////////
+static int frame_submit(uint8_t type, const uint8_t *payload, uint8_t len)
+{
+	switch (type) {
+	case HOST_IF_PHRASES: {
+		uint16_t phrases[S1V3G340_MAX_PHRASES];
+		int count = len / sizeof(uint16_t);
+
+		if ((len % sizeof(uint16_t)) || count < 1 || count > S1V3G340_MAX_PHRASES) {
+			return -EINVAL;
+		}
+		for (int i = 0; i < count; i++) {
+			phrases[i] = sys_get_le16(&payload[i * sizeof(uint16_t)]);
+		}
+
+		return audio_submit_phrases(phrases, count) ? -ENOMSG : 0;
+	}
+	case HOST_IF_PUNCH: {
+		const struct host_if_punch *rec = (const struct host_if_punch *)payload;
+		struct si_punch punch = {
+			.decoded_at = k_cycle_get_32(),
+		};
+
+		if (len != sizeof(*rec)) {
+			return -EINVAL;
+		}
+		punch.siac_id = sys_le32_to_cpu(rec->siac_id);
+		punch.seq = sys_le32_to_cpu(rec->seq);
+		memcpy(punch.siac_data, rec->siac_data, SIAC_DATA_LEN);
+		trace_stamp(&punch.trace, TRACE_PUNCH_ENQUEUED);
+
+		punch_log_punch(&punch);
+		if (audio_submit_punch(&punch)) {
+			punch_log_announcement(&punch, -ENOBUFS);
+			return -ENOMSG;
+		}
+
+		return 0;
+	}
+	case HOST_IF_NOP:
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: frames_parse
+//
+//  description:
+//    Walks the frames of one transaction and submits them. Parsing
+//    stops at the first byte that is not a frame start or at a frame
+//    cut off by the end of the transaction.
+//
+//  argument:
+//    buf: receive buffer of the transaction
+//    len: bytes clocked in by the master
+///////////////////////////////////////////////////////////////////////
+static void frames_parse(const uint8_t *buf, size_t len)
+{
+	size_t pos = 0;
+
+	while (pos + HOST_IF_HDR_LEN + HOST_IF_CRC_LEN <= len && buf[pos] == HOST_IF_SYNC) {
+		const uint8_t *frame = &buf[pos];
+		uint8_t type = frame[1];
+		uint8_t seq = frame[2];
+		uint8_t payload_len = frame[3];
+		size_t frame_len = HOST_IF_HDR_LEN + payload_len + HOST_IF_CRC_LEN;
+		int err;
+
+		stats.frames++;
+		if (pos + frame_len > len) {
+			stats.bad_frames++;
+			break;
+		}
+		pos += frame_len;
+
+		if (crc16_ccitt(0xffff, &frame[1], HOST_IF_HDR_LEN - 1 + payload_len) !=
+		    sys_get_le16(&frame[HOST_IF_HDR_LEN + payload_len])) {
+			stats.crc_errors++;
+			continue;
+		}
+
+		err = frame_submit(type, &frame[HOST_IF_HDR_LEN], payload_len);
+		if (err == -ENOMSG) {
+			stats.queue_full++;
+			LOG_WRN("Audio queue full, frame %u dropped", seq);
+		} else if (err) {
+			stats.bad_frames++;
+			LOG_WRN("Bad frame %u, type 0x%02x, %u bytes", seq, type, payload_len);
+		} else {
+			stats.accepted++;
+			last_seq = seq;
+		}
+	}
+}
+
+static void host_if_thread(void *p1, void *p2, void *p3)
+{
+	struct k_poll_event event = K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL,
+							     K_POLL_MODE_NOTIFY_ONLY, &spis_sig);
+	int cur = 0;
+	int err;
+
+	if (!device_is_ready(spis_dev)) {
+		LOG_ERR("SPI slave not ready");
+		return;
+	}
+
+	err = spis_arm(cur);
+	if (err) {
+		LOG_ERR("SPI slave receive failed (err %d)", err);
+		return;
+	}
+	LOG_INF("Host interface ready, %u byte transactions", HOST_IF_BUF_SIZE);
+
+	while (1) {
+		unsigned int signaled;
+		int result;
+		int done;
+
+		k_poll(&event, 1, K_FOREVER);
+		k_poll_signal_check(&spis_sig, &signaled, &result);
+		k_poll_signal_reset(&spis_sig);
+		event.state = K_POLL_STATE_NOT_READY;
+
+		/* Re-arm with the other pair first so the master can clock in
+		 * the next transaction while this one is parsed
+		 */
+		done = cur;
+		cur ^= 1;
+		err = spis_arm(cur);
+
+		if (result < 0) {
+			LOG_WRN("SPI slave transaction failed (err %d)", result);
+		} else {
+			stats.transactions++;
+			frames_parse(rx_bufs[done], MIN((size_t)result, sizeof(rx_bufs[done])));
+
+			k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+			shown_stats = stats;
+			k_spin_unlock(&stats_lock, key);
+		}
+
+		while (err) {
+			LOG_ERR("SPI slave receive failed (err %d)", err);
+			k_sleep(K_MSEC(100));
+			err = spis_arm(cur);
+		}
+	}
+}
+
+K_THREAD_DEFINE(host_if, CONFIG_SI_VOICE_HOST_IF_STACK_SIZE, host_if_thread,
+		NULL, NULL, NULL, HOST_IF_PRIORITY, 0, 0);
+
+void host_if_stats_get(struct host_if_stats *out)
+{
+	k_spinlock_key_t key = k_spin_lock(&stats_lock);
+
+	*out = shown_stats;
+	k_spin_unlock(&stats_lock, key);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_host_if(const struct shell *sh, size_t argc, char **argv)
+{
+	struct host_if_stats s;
+
+	host_if_stats_get(&s);
+
+	shell_print(sh, "%u transactions, %u frames, %u accepted", s.transactions, s.frames,
+		    s.accepted);
+	shell_print(sh, "rejected: %u CRC, %u bad, %u queue full", s.crc_errors, s.bad_frames,
+		    s.queue_full);
+	shell_print(sh, "audio queue %u free", audio_queue_free());
+
+	return 0;
+}
+
+SHELL_CMD_REGISTER(hostif, NULL, "SPI host interface counters", cmd_host_if);
+#endif /* CONFIG_SHELL */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HOST_IF_H_
+#define HOST_IF_H_
+
+#include <zephyr.h>
+
+/* Frames written by the SPI master (MOSI). A transaction carries any
+ * number of frames back to back, the first byte that is not
+ * HOST_IF_SYNC ends them, so the rest of the transaction can be filler.
+ *
+ *   sync  type  seq  len  payload[len]  crc16[2]
+ *
+ * seq is chosen by the master and echoed in the status. The CRC is
+ * CRC-16/CCITT (seed 0xffff) over type, seq, len and the payload, little
+ * endian. Multi-byte payload fields are little endian.
+ */
+#define HOST_IF_SYNC		0xA5
+#define HOST_IF_HDR_LEN		4
+#define HOST_IF_CRC_LEN		2
+
+/* u16 phrase codes, 1 to S1V3G340_MAX_PHRASES, played as given */
+#define HOST_IF_PHRASES		0x01
+/* Punch record, announced like a received punch and logged */
+#define HOST_IF_PUNCH		0x02
+/* No operation, to read the status */
+#define HOST_IF_NOP		0x03
+
+/* Payload of HOST_IF_PUNCH */
+struct host_if_punch {
+	uint32_t siac_id;
+	uint32_t seq;
+	uint8_t siac_data[7];		/* as in the SPORTident manufacturer data */
+} __packed;
+
+/* Read by the master (MISO) at the start of every transaction. It
+ * covers the frames up to the transaction before the previous one, the
+ * receive buffer of the next transaction is armed before a transaction
+ * is parsed.
+ */
+struct host_if_status {
+	uint8_t sync;			/* HOST_IF_SYNC */
+	uint8_t last_seq;		/* seq of the last frame accepted */
+	uint8_t queue_free;		/* announcements the audio queue still takes */
+	uint8_t reserved;
+	uint16_t accepted;		/* frames queued, wrapping */
+	uint16_t rejected;		/* frames dropped, bad CRC, length or queue full, wrapping */
+} __packed;
+
+/* Counters since boot */
+struct host_if_stats {
+	uint32_t transactions;
+	uint32_t frames;
+	uint32_t accepted;
+	uint32_t crc_errors;
+	uint32_t bad_frames;		/* unknown type, bad length or cut off */
+	uint32_t queue_full;
+};
+
+#if defined(CONFIG_SI_VOICE_HOST_IF)
+
+void host_if_stats_get(struct host_if_stats *stats);
+
+#endif /* CONFIG_SI_VOICE_HOST_IF */
+
+#endif /* HOST_IF_H_ */
@@ -24,46 +24,45 @@
 
 /////////////////////////////////////////////////////////////////////////////////
 
+#include <string.h>
+
 #include "isc_msgs.h"
 
-unsigned char aucIscResetReq[HEADER_LEN + LEN_ISC_RESET_REQ] = {
 
-	0x00, ID_START,
 
-	LEN_ISC_RESET_REQ, 0x00,
+// Checks at compile time that a request template has as many bytes as
 
-	_GET_LOW_BYTE(ID_ISC_RESET_REQ), _GET_HIGH_BYTE(ID_ISC_RESET_REQ),
+// its LEN_* macro says, and that the length fits the low length byte.
 
-	0x00, 0x00,
-
-};
+#define ISC_ASSERT_LEN(aucMsg, len)	_Static_assert(sizeof(aucMsg) == ISC_MSG_SIZE(len) && (len) <= 0xFF, #aucMsg " does not match " #len)
 
 
-int iIscResetReqLen = sizeof(aucIscResetReq);
 
+//////////////////////////////////////////////////
 
+// REQUEST TEMPLATES (const, kept in flash)
 
-#ifdef CHECKSUM
+//////////////////////////////////////////////////
 
-unsigned char aucIscTestReq[HEADER_LEN + LEN_ISC_TEST_REQ] = {
+static const unsigned char aucIscResetReq[] = {
 
 	0x00, ID_START,
 
-	LEN_ISC_TEST_REQ, 0x00,
+	LEN_ISC_RESET_REQ, 0x00,
 
-	_GET_LOW_BYTE(ID_ISC_TEST_REQ), _GET_HIGH_BYTE(ID_ISC_TEST_REQ),
+	_GET_LOW_BYTE(ID_ISC_RESET_REQ), _GET_HIGH_BYTE(ID_ISC_RESET_REQ),
 
-	0x01, 0x00,				// Check-Sum 1:Enable 0:Disable
+	0x00, 0x00,
 
-	0x01, 0x00,				// 1:Full duplex, 0:Half duplex
+};
+
+ISC_ASSERT_LEN(aucIscResetReq, LEN_ISC_RESET_REQ);
 
-	0xe1, 0x48, 0xe6, 0x55, // key-code
 
-};
 
-#else
+// The checksum flag is patched in by IscEncodeTestReq()
 
-unsigned char aucIscTestReq[HEADER_LEN + LEN_ISC_TEST_REQ] = {
+static const unsigned char aucIscTestReq[] = {
 
 	0x00, ID_START,
 
@@ -76,20 +75,18 @@ unsigned char aucIscTestReq[HEADER_LEN + LEN_ISC_TEST_REQ] = {
 	0x01, 0x00,				// 1:Full duplex, 0:Half duplex
 
 	//0xe1, 0x48, 0xe6, 0x55, // key-code
-	// 0x85, 0x1F, 0xAA, 0x1A, // key-code
-	0x9B, 0x68, 0x52, 0xD1, // key-code	
 
-};
-
-#endif
+	// 0x85, 0x1F, 0xAA, 0x1A, // key-code
 
+	0x9B, 0x68, 0x52, 0xD1, // key-code
 
+};
 
-int iIscTestReqLen = sizeof(aucIscTestReq);
+ISC_ASSERT_LEN(aucIscTestReq, LEN_ISC_TEST_REQ);
 
 
 
-unsigned char aucIscVersionReq[HEADER_LEN + LEN_ISC_VERSION_REQ] = {
+static const unsigned char aucIscVersionReq[] = {
 
 	0x00, ID_START,
 
@@ -99,13 +96,11 @@ unsigned char aucIscVersionReq[HEADER_LEN + LEN_ISC_VERSION_REQ] = {
 
 };
 
-
-
-int iIscVersionReqLen = sizeof(aucIscVersionReq);
+ISC_ASSERT_LEN(aucIscVersionReq, LEN_ISC_VERSION_REQ);
 
 
 
-unsigned char aucIscPmanStandbyEntryReq[HEADER_LEN + LEN_ISC_PMAN_STANDBY_ENTRY_REQ] = {
+static const unsigned char aucIscPmanStandbyEntryReq[] = {
 
 	0x00, ID_START,
 
@@ -115,13 +110,11 @@ unsigned char aucIscPmanStandbyEntryReq[HEADER_LEN + LEN_ISC_PMAN_STANDBY_ENTRY_
 
 };
 
+ISC_ASSERT_LEN(aucIscPmanStandbyEntryReq, LEN_ISC_PMAN_STANDBY_ENTRY_REQ);
 
 
-int iIscPmanStandbyEntryReqLen = sizeof(aucIscPmanStandbyEntryReq);
 
-  
-
-unsigned char aucIscAudioConfigReq[HEADER_LEN + LEN_ISC_AUDIO_CONFIG_REQ] = {
+static const unsigned char aucIscAudioConfigReq[] = {
 
 	0x00, ID_START,
 
@@ -147,13 +140,11 @@ unsigned char aucIscAudioConfigReq[HEADER_LEN + LEN_ISC_AUDIO_CONFIG_REQ] = {
 
 };
 
+ISC_ASSERT_LEN(aucIscAudioConfigReq, LEN_ISC_AUDIO_CONFIG_REQ);
 
 
-int iIscAudioConfigReqLen = sizeof(aucIscAudioConfigReq);
-
 
-
-unsigned char aucIscAudioVolumeReq[HEADER_LEN + LEN_ISC_AUDIO_VOLUME_REQ] = {
+static const unsigned char aucIscAudioVolumeReq[] = {
 
 	0x00, ID_START,
 
@@ -165,13 +156,11 @@ unsigned char aucIscAudioVolumeReq[HEADER_LEN + LEN_ISC_AUDIO_VOLUME_REQ] = {
 
 };
 
+ISC_ASSERT_LEN(aucIscAudioVolumeReq, LEN_ISC_AUDIO_VOLUME_REQ);
 
 
-int iIscAudioVolumeReqLen = sizeof(aucIscAudioVolumeReq);
-
 
-
-unsigned char aucIscAudioMuteReq[HEADER_LEN + LEN_ISC_AUDIO_MUTE_REQ] = {
+static const unsigned char aucIscAudioMuteReq[] = {
 
 	0x00, ID_START,
 
@@ -185,13 +174,11 @@ unsigned char aucIscAudioMuteReq[HEADER_LEN + LEN_ISC_AUDIO_MUTE_REQ] = {
 
 };
 
+ISC_ASSERT_LEN(aucIscAudioMuteReq, LEN_ISC_AUDIO_MUTE_REQ);
 
 
-int iIscAudioMuteReqLen = sizeof(aucIscAudioMuteReq);
-
 
-
-unsigned char aucIscAudiodecConfigReq[HEADER_LEN + LEN_ISC_AUDIODEC_CONFIG_REQ] = {
+static const unsigned char aucIscAudiodecConfigReq[] = {
 
 	0x00, ID_START,
 
@@ -213,13 +200,11 @@ unsigned char aucIscAudiodecConfigReq[HEADER_LEN + LEN_ISC_AUDIODEC_CONFIG_REQ]
 
 };
 
+ISC_ASSERT_LEN(aucIscAudiodecConfigReq, LEN_ISC_AUDIODEC_CONFIG_REQ);
 
 
-int iIscAudiodecConfigReqLen = sizeof(aucIscAudiodecConfigReq);
-
 
-
-unsigned char aucIscAudiodecPauseReq[HEADER_LEN + LEN_ISC_AUDIODEC_PAUSE_REQ] = {
+static const unsigned char aucIscAudiodecPauseReq[] = {
 
 	0x00, ID_START,
 
@@ -235,13 +220,11 @@ unsigned char aucIscAudiodecPauseReq[HEADER_LEN + LEN_ISC_AUDIODEC_PAUSE_REQ] =
 
 };
 
+ISC_ASSERT_LEN(aucIscAudiodecPauseReq, LEN_ISC_AUDIODEC_PAUSE_REQ);
 
 
-int iIscAudiodecPauseReqLen = sizeof(aucIscAudiodecPauseReq);
-
 
-
-unsigned char aucIscAudiodecStopReq[HEADER_LEN + LEN_ISC_AUDIODEC_STOP_REQ] = {
+static const unsigned char aucIscAudiodecStopReq[] = {
 
 	0x00, ID_START,
 
@@ -253,19 +236,49 @@ unsigned char aucIscAudiodecStopReq[HEADER_LEN + LEN_ISC_AUDIODEC_STOP_REQ] = {
 
 };
 
+ISC_ASSERT_LEN(aucIscAudiodecStopReq, LEN_ISC_AUDIODEC_STOP_REQ);
+
+
+
+static const unsigned char aucIscSequencerConfigHead[] = {
+
+	0x00, ID_START,
+
+	0x00, 0x00,						// length, depends on the number of events
+
+	_GET_LOW_BYTE(ID_ISC_SEQUENCER_CONFIG_REQ), _GET_HIGH_BYTE(ID_ISC_SEQUENCER_CONFIG_REQ),
+
+	0x01, 0x00,						// play mode
+
+	0x00, 0x00,						// number of events
+
+};
+
+ISC_ASSERT_LEN(aucIscSequencerConfigHead, LEN_HEAD_ISC_SEQUENCER_CONFIG_REQ);
+
 
 
-int iIscAudiodecStopReqLen = sizeof(aucIscAudiodecStopReq);
+static const unsigned char aucIscSequencerFileEvent[LEN_EVENT_ISC_SEQUENCER_CONFIG_REQ] = {
+
+	0x00, 0x00,
 
+	0x01, 0x00,						// event type: file
+
+	0x03, 0x00,						// file type
+
+	0x00, 0x00,						// phrase code
+
+};
 
 
-unsigned char aucIscSequencerStartReq[HEADER_LEN + LEN_ISC_SEQUENCER_START_REQ] = {
+
+static const unsigned char aucIscSequencerStartReq[] = {
 
 	0x00, ID_START,
 
 	LEN_ISC_SEQUENCER_START_REQ, 0x00,
 
-	_GET_LOW_BYTE(ID_ISC_SEQUENCER_START_REQ), _GET_HIGH_BYTE(ID_ISC_SEQUENCER_START_REQ), 
+	_GET_LOW_BYTE(ID_ISC_SEQUENCER_START_REQ), _GET_HIGH_BYTE(ID_ISC_SEQUENCER_START_REQ),
 
 	0x00,							// notification 0:disable, 1:enable
 
@@ -273,29 +286,25 @@ unsigned char aucIscSequencerStartReq[HEADER_LEN + LEN_ISC_SEQUENCER_START_REQ]
 
 };
 
-
-
-int iIscSequencerStartReqLen = sizeof(aucIscSequencerStartReq);
+ISC_ASSERT_LEN(aucIscSequencerStartReq, LEN_ISC_SEQUENCER_START_REQ);
 
 
 
-unsigned char aucIscSequencerStopReq[HEADER_LEN + LEN_ISC_SEQUENCER_STOP_REQ] = {
+static const unsigned char aucIscSequencerStopReq[] = {
 
 	0x00, ID_START,
 
 	LEN_ISC_SEQUENCER_STOP_REQ, 0x00,
 
-	_GET_LOW_BYTE(ID_ISC_SEQUENCER_STOP_REQ), _GET_HIGH_BYTE(ID_ISC_SEQUENCER_STOP_REQ), 
+	_GET_LOW_BYTE(ID_ISC_SEQUENCER_STOP_REQ), _GET_HIGH_BYTE(ID_ISC_SEQUENCER_STOP_REQ),
 
 };
 
-
-
-int iIscSequencerStopReqLen = sizeof(aucIscSequencerStopReq);
+ISC_ASSERT_LEN(aucIscSequencerStopReq, LEN_ISC_SEQUENCER_STOP_REQ);
 
 
 
-unsigned char aucIscSequencerPauseReq[HEADER_LEN + LEN_ISC_SEQUENCER_PAUSE_REQ] = {
+static const unsigned char aucIscSequencerPauseReq[] = {
 
 	0x00, ID_START,
 
@@ -309,7 +318,385 @@ unsigned char aucIscSequencerPauseReq[HEADER_LEN + LEN_ISC_SEQUENCER_PAUSE_REQ]
 
 };
 
+ISC_ASSERT_LEN(aucIscSequencerPauseReq, LEN_ISC_SEQUENCER_PAUSE_REQ);
+
+
+
+//////////////////////////////////////////////////
+
+// CHECKSUM
+
+//////////////////////////////////////////////////
+
+
+
+unsigned char IscChecksum(const unsigned char *pucMsg, int iLen)
+
+{
+
+	unsigned char ucSum = 0;
+
+	int i;
+
+
+
+	for (i = 0; i < iLen; i++) {
+
+		ucSum += pucMsg[i];
+
+	}
+
+	return (unsigned char)(0x100 - ucSum);
+
+}
+
+
+
+int IscAppendChecksum(unsigned char *pucBuf, int iSize, int iLen)
+
+{
+
+	if (iLen < ISC_MSG_SIZE(4) || iSize < iLen + ISC_CHECKSUM_LEN) {
+
+		return -1;
+
+	}
+
+	pucBuf[iLen] = IscChecksum(&pucBuf[HEADER_LEN], iLen - HEADER_LEN);
+
+	return iLen + ISC_CHECKSUM_LEN;
+
+}
+
+
+
+//////////////////////////////////////////////////
+
+// ENCODERS
+
+//////////////////////////////////////////////////
+
+static int iscEncodeTemplate(unsigned char *pucBuf, int iSize,
+
+			     const unsigned char *pucMsg, int iLen)
+
+{
+
+	if (iSize < iLen) {
+
+		return -1;
+
+	}
+
+	memcpy(pucBuf, pucMsg, iLen);
+
+	return iLen;
+
+}
+
+
+
+int IscEncodeResetReq(unsigned char *pucBuf, int iSize)
+
+{
+
+	return iscEncodeTemplate(pucBuf, iSize, aucIscResetReq, sizeof(aucIscResetReq));
+
+}
+
+
+
+int IscEncodeTestReq(unsigned char *pucBuf, int iSize, int iChecksum)
+
+{
+
+	int iLen = iscEncodeTemplate(pucBuf, iSize, aucIscTestReq, sizeof(aucIscTestReq));
+
+
+
+	if (iLen > 0) {
+
+		pucBuf[6] = iChecksum ? 0x01 : 0x00;
+
+	}
+
+	return iLen;
+
+}
+
+
+
+int IscEncodeVersionReq(unsigned char *pucBuf, int iSize)
+
+{
+
+	return iscEncodeTemplate(pucBuf, iSize, aucIscVersionReq, sizeof(aucIscVersionReq));
+
+}
+
+
+
+int IscEncodePmanStandbyEntryReq(unsigned char *pucBuf, int iSize)
+
+{
+
+	return iscEncodeTemplate(pucBuf, iSize, aucIscPmanStandbyEntryReq,
+
+				 sizeof(aucIscPmanStandbyEntryReq));
+
+}
+
+
+
+int IscEncodeAudioConfigReq(unsigned char *pucBuf, int iSize, unsigned char ucGain)
+
+{
+
+	int iLen = iscEncodeTemplate(pucBuf, iSize, aucIscAudioConfigReq,
+
+				     sizeof(aucIscAudioConfigReq));
+
+
+
+	if (iLen > 0) {
+
+		pucBuf[7] = ucGain;
+
+	}
+
+	return iLen;
+
+}
+
+
+
+int IscEncodeAudioVolumeReq(unsigned char *pucBuf, int iSize, unsigned short usGainInc)
+
+{
+
+	int iLen = iscEncodeTemplate(pucBuf, iSize, aucIscAudioVolumeReq,
+
+				     sizeof(aucIscAudioVolumeReq));
+
+
+
+	if (iLen > 0) {
+
+		pucBuf[6] = _GET_LOW_BYTE(usGainInc);
+
+		pucBuf[7] = _GET_HIGH_BYTE(usGainInc);
+
+	}
+
+	return iLen;
+
+}
+
+
+
+int IscEncodeAudioMuteReq(unsigned char *pucBuf, int iSize, int iMute)
+
+{
+
+	int iLen = iscEncodeTemplate(pucBuf, iSize, aucIscAudioMuteReq,
+
+				     sizeof(aucIscAudioMuteReq));
+
+
+
+	if (iLen > 0) {
+
+		pucBuf[6] = iMute ? 0x01 : 0x00;
+
+	}
+
+	return iLen;
+
+}
+
+
+
+int IscEncodeAudiodecConfigReq(unsigned char *pucBuf, int iSize)
+
+{
+
+	return iscEncodeTemplate(pucBuf, iSize, aucIscAudiodecConfigReq,
+
+				 sizeof(aucIscAudiodecConfigReq));
+
+}
+
+
+
+int IscEncodeAudiodecPauseReq(unsigned char *pucBuf, int iSize, int iPause)
+
+{
+
+	int iLen = iscEncodeTemplate(pucBuf, iSize, aucIscAudiodecPauseReq,
+
+				     sizeof(aucIscAudiodecPauseReq));
+
+
+
+	if (iLen > 0) {
+
+		pucBuf[6] = iPause ? 0x01 : 0x00;
+
+	}
+
+	return iLen;
+
+}
+
+
+
+int IscEncodeAudiodecStopReq(unsigned char *pucBuf, int iSize)
+
+{
+
+	return iscEncodeTemplate(pucBuf, iSize, aucIscAudiodecStopReq,
+
+				 sizeof(aucIscAudiodecStopReq));
+
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+
+//  function: IscEncodeSequencerConfigReq
+
+//
+
+//  description:
+
+//    ISC_SEQUENCER_CONFIG_REQ that plays the given phrases in
+
+//    sequence, one file event per phrase.
+
+//
+
+//  argument:
+
+//    ausPhrases: phrase codes stored on the speech IC
+
+//    iCount: number of phrases
+
+//
+
+//  return:
+
+//    length of the message, -1 when it does not fit iSize
+
+///////////////////////////////////////////////////////////////////////
+
+int IscEncodeSequencerConfigReq(unsigned char *pucBuf, int iSize,
+
+				const unsigned short ausPhrases[], int iCount)
+
+{
+
+	int iMsgLen = LEN_HEAD_ISC_SEQUENCER_CONFIG_REQ + iCount * LEN_EVENT_ISC_SEQUENCER_CONFIG_REQ;
+
+	unsigned char *pucEvent;
+
+	int i;
+
+
+
+	if (iCount <= 0 || iSize < ISC_MSG_SIZE(iMsgLen)) {
+
+		return -1;
+
+	}
+
+
+
+	memcpy(pucBuf, aucIscSequencerConfigHead, sizeof(aucIscSequencerConfigHead));
+
+	pucBuf[2] = _GET_LOW_BYTE(iMsgLen);
+
+	pucBuf[3] = _GET_HIGH_BYTE(iMsgLen);
+
+	pucBuf[8] = _GET_LOW_BYTE(iCount);
+
+	pucBuf[9] = _GET_HIGH_BYTE(iCount);
+
+
+
+	for (i = 0; i < iCount; i++) {
+
+		// file event - play phrase
+
+		pucEvent = &pucBuf[ISC_SEQUENCER_CONFIG_REQ_SIZE(i)];
+
+		memcpy(pucEvent, aucIscSequencerFileEvent, sizeof(aucIscSequencerFileEvent));
+
+		pucEvent[6] = _GET_LOW_BYTE(ausPhrases[i]);
+
+		pucEvent[7] = _GET_HIGH_BYTE(ausPhrases[i]);
+
+	}
+
+
+
+	return ISC_MSG_SIZE(iMsgLen);
+
+}
+
+
+
+int IscEncodeSequencerStartReq(unsigned char *pucBuf, int iSize, int iNotify)
+
+{
+
+	int iLen = iscEncodeTemplate(pucBuf, iSize, aucIscSequencerStartReq,
+
+				     sizeof(aucIscSequencerStartReq));
+
+
+
+	if (iLen > 0) {
+
+		pucBuf[6] = iNotify ? 0x01 : 0x00;
+
+	}
+
+	return iLen;
+
+}
+
+
+
+int IscEncodeSequencerStopReq(unsigned char *pucBuf, int iSize)
+
+{
+
+	return iscEncodeTemplate(pucBuf, iSize, aucIscSequencerStopReq,
+
+				 sizeof(aucIscSequencerStopReq));
+
+}
+
+
+
+int IscEncodeSequencerPauseReq(unsigned char *pucBuf, int iSize, int iPause)
+
+{
+
+	int iLen = iscEncodeTemplate(pucBuf, iSize, aucIscSequencerPauseReq,
+
+				     sizeof(aucIscSequencerPauseReq));
+
+
+
+	if (iLen > 0) {
+
+		pucBuf[6] = iPause ? 0x01 : 0x00;
+
+	}
 
+	return iLen;
 
-int iIscSequencerPauseReqLen = sizeof(aucIscSequencerPauseReq);
+}
 
@@ -267,67 +267,79 @@
 
 /////////////////////////////////////
 
-// data array of request message
+// encoded request message
 
 /////////////////////////////////////
 
-extern unsigned char aucIscResetReq[];
+// Bytes of a request on the bus, the length field does not count the
 
-extern unsigned char aucIscTestReq[];
+// 0x00 and ID_START in front of it
 
-extern unsigned char aucIscVersionReq[];
+#define ISC_MSG_SIZE(len)					(HEADER_LEN + (len))
 
-extern unsigned char aucIscPmanStandbyEntryReq[];
+#define ISC_SEQUENCER_CONFIG_REQ_SIZE(events)	ISC_MSG_SIZE(LEN_HEAD_ISC_SEQUENCER_CONFIG_REQ + (events) * LEN_EVENT_ISC_SEQUENCER_CONFIG_REQ)
 
-extern unsigned char aucIscAudioConfigReq[];
 
-extern unsigned char aucIscAudioVolumeReq[];
 
-extern unsigned char aucIscAudioMuteReq[];
+// Each encoder writes a complete request to pucBuf and returns its length,
 
-extern unsigned char aucIscAudiodecConfigReq[];
+// or -1 when it does not fit in iSize bytes. The templates are const and
 
-extern unsigned char aucIscAudiodecPauseReq[];
+// the encoders keep no state, so requests can be built concurrently.
 
-extern unsigned char aucIscAudiodecStopReq[];
+int IscEncodeResetReq(unsigned char *pucBuf, int iSize);
 
-extern unsigned char aucIscSequencerConfigReq[];
+int IscEncodeTestReq(unsigned char *pucBuf, int iSize, int iChecksum);
 
-extern unsigned char aucIscSequencerStartReq[];
+int IscEncodeVersionReq(unsigned char *pucBuf, int iSize);
 
-extern unsigned char aucIscSequencerStopReq[];
+int IscEncodePmanStandbyEntryReq(unsigned char *pucBuf, int iSize);
 
-extern unsigned char aucIscSequencerPauseReq[];
+int IscEncodeAudioConfigReq(unsigned char *pucBuf, int iSize, unsigned char ucGain);
 
+int IscEncodeAudioVolumeReq(unsigned char *pucBuf, int iSize, unsigned short usGainInc);
 
+int IscEncodeAudioMuteReq(unsigned char *pucBuf, int iSize, int iMute);
 
-extern int iIscResetReqLen;
+int IscEncodeAudiodecConfigReq(unsigned char *pucBuf, int iSize);
 
-extern int iIscTestReqLen;
+int IscEncodeAudiodecPauseReq(unsigned char *pucBuf, int iSize, int iPause);
 
-extern int iIscVersionReqLen;
+int IscEncodeAudiodecStopReq(unsigned char *pucBuf, int iSize);
 
-extern int iIscPmanStandbyEntryReqLen;
+int IscEncodeSequencerConfigReq(unsigned char *pucBuf, int iSize,
 
-extern int iIscAudioConfigReqLen;
+				const unsigned short ausPhrases[], int iCount);
 
-extern int iIscAudioVolumeReqLen;
+int IscEncodeSequencerStartReq(unsigned char *pucBuf, int iSize, int iNotify);
 
-extern int iIscAudioMuteReqLen;
+int IscEncodeSequencerStopReq(unsigned char *pucBuf, int iSize);
 
-extern int iIscAudiodecConfigReqLen;
+int IscEncodeSequencerPauseReq(unsigned char *pucBuf, int iSize, int iPause);
 
-extern int iIscAudiodecPauseReqLen;
 
-extern int iIscAudiodecStopReqLen;
 
-extern int iIscSequencerConfigReqLen;
+// With checksums enabled by ISC_TEST_REQ every message after it, request
 
-extern int iIscSequencerStartReqLen;
+// and response, is followed by one checksum byte that the length field
+
+// does not count. It is the two's complement of the byte sum from the
+
+// length field to the last parameter, so the sum including it is 0.
+
+#define ISC_CHECKSUM_LEN					1
+
+
+
+unsigned char IscChecksum(const unsigned char *pucMsg, int iLen);
+
+// Appends the checksum to an encoded request of iLen bytes, returns the
+
+// new length or -1 when it does not fit in iSize bytes.
+
+int IscAppendChecksum(unsigned char *pucBuf, int iSize, int iLen);
 
-extern int iIscSequencerStopReqLen;
 
-extern int iIscSequencerPauseReqLen;
 
 
 
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/sys/byteorder.h>
+#include <logging/log.h>
+#include "log_download.h"
+#include "observer.h"
+#include "punch_log.h"
+
+LOG_MODULE_REGISTER(log_download, CONFIG_SI_VOICE_LOG_LEVEL);
+
+/* 5e5a000x-8f2c-4c1b-9a3e-5349564f4943, the node is "SIVOIC" */
+#define BT_UUID_PUNCH_LOG_VAL \
+	BT_UUID_128_ENCODE(0x5e5a0001, 0x8f2c, 0x4c1b, 0x9a3e, 0x5349564f4943)
+#define BT_UUID_PUNCH_LOG_CTRL_VAL \
+	BT_UUID_128_ENCODE(0x5e5a0002, 0x8f2c, 0x4c1b, 0x9a3e, 0x5349564f4943)
+#define BT_UUID_PUNCH_LOG_DATA_VAL \
+	BT_UUID_128_ENCODE(0x5e5a0003, 0x8f2c, 0x4c1b, 0x9a3e, 0x5349564f4943)
+
+#define BT_UUID_PUNCH_LOG	BT_UUID_DECLARE_128(BT_UUID_PUNCH_LOG_VAL)
+#define BT_UUID_PUNCH_LOG_CTRL	BT_UUID_DECLARE_128(BT_UUID_PUNCH_LOG_CTRL_VAL)
+#define BT_UUID_PUNCH_LOG_DATA	BT_UUID_DECLARE_128(BT_UUID_PUNCH_LOG_DATA_VAL)
+
+/* Control point, written by the client */
+#define DL_OP_START		0x01	/* u32 log offset to start from */
+#define DL_OP_STOP		0x02
+/* Control point, notified to the client */
+#define DL_OP_DONE		0x81	/* u32 end offset, u32 bytes, u32 ms, u32 bytes/s */
+#define DL_OP_ERROR		0x82	/* s8 errno, -ERANGE when the offset was erased */
+
+/* Bumped when the layout of the log data changes, 3 is segments of
+ * struct punch_log_segment, raw or LZ4, carrying their log offset
+ */
+#define DL_FORMAT_VERSION	3
+
+/* Each data notification starts with the u32 log offset of its payload */
+#define DL_HDR_LEN		4
+/* ATT MTU of 247 bytes, the most one LL data length extended packet carries */
+#define DL_PAYLOAD_MAX		(247 - 3 - DL_HDR_LEN)
+
+/* In 0.625 ms units */
+#define DL_ADV_INTERVAL		(CONFIG_SI_VOICE_LOG_DOWNLOAD_ADV_INTERVAL_MS * 8 / 5)
+
+#define DL_STOP			0
+#define DL_RUNNING		1
+
+static struct bt_conn *dl_conn;
+static atomic_t dl_flags;
+static uint32_t dl_offset;
+static K_SEM_DEFINE(dl_start_sem, 0, 1);
+/* Notifications queued and not yet sent, bounded to keep the buffers flowing */
+static K_SEM_DEFINE(dl_tx_credits, CONFIG_SI_VOICE_LOG_DOWNLOAD_TX_WINDOW,
+		    CONFIG_SI_VOICE_LOG_DOWNLOAD_TX_WINDOW);
+
+static void adv_work_handler(struct k_work *work);
+static K_WORK_DEFINE(adv_work, adv_work_handler);
+
+static ssize_t ctrl_read(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+			 uint16_t len, uint16_t offset);
+static ssize_t ctrl_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			  const void *buf, uint16_t len, uint16_t offset, uint8_t flags);
+
+BT_GATT_SERVICE_DEFINE(punch_log_svc,
+	BT_GATT_PRIMARY_SERVICE(BT_UUID_PUNCH_LOG),
+	BT_GATT_CHARACTERISTIC(BT_UUID_PUNCH_LOG_CTRL,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE | BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_READ | BT_GATT_PERM_WRITE, ctrl_read, ctrl_write, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+	BT_GATT_CHARACTERISTIC(BT_UUID_PUNCH_LOG_DATA, BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_NONE, NULL, NULL, NULL),
+	BT_GATT_CCC(NULL, BT_GATT_PERM_READ | BT_GATT_PERM_WRITE),
+);
+
+#define CTRL_ATTR	(&punch_log_svc.attrs[2])
+#define DATA_ATTR	(&punch_log_svc.attrs[5])
+
+static const struct bt_data ad[] = {
+	BT_DATA_BYTES(BT_DATA_FLAGS, (BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR)),
+	BT_DATA_BYTES(BT_DATA_UUID128_ALL, BT_UUID_PUNCH_LOG_VAL),
+};
+
+/* Log end offset, record size, format and the offset of the oldest
+ * segment, so the client knows what to expect and where to start
+ */
+static ssize_t ctrl_read(struct bt_conn *conn, const struct bt_gatt_attr *attr, void *buf,
+			 uint16_t len, uint16_t offset)
+{
+	uint32_t start, end;
+	uint8_t info[11];
+
+	punch_log_range(&start, &end);
+	sys_put_le32(end, &info[0]);
+	sys_put_le16(sizeof(struct punch_log_record), &info[4]);
+	info[6] = DL_FORMAT_VERSION;
+	sys_put_le32(start, &info[7]);
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, info, sizeof(info));
+}
+
+static ssize_t ctrl_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			  const void *buf, uint16_t len, uint16_t offset, uint8_t flags)
+{
+	const uint8_t *req = buf;
+
+	if (offset != 0 || len < 1) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	switch (req[0]) {
+	case DL_OP_START:
+		if (len != 1 + sizeof(uint32_t)) {
+			return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+		}
+		if (atomic_test_and_set_bit(&dl_flags, DL_RUNNING)) {
+			return BT_GATT_ERR(BT_ATT_ERR_PROCEDURE_IN_PROGRESS);
+		}
+		dl_offset = sys_get_le32(&req[1]);
+		atomic_clear_bit(&dl_flags, DL_STOP);
+		k_sem_give(&dl_start_sem);
+		break;
+	case DL_OP_STOP:
+		atomic_set_bit(&dl_flags, DL_STOP);
+		break;
+	default:
+		return BT_GATT_ERR(BT_ATT_ERR_NOT_SUPPORTED);
+	}
+
+	return len;
+}
+
+static void notify_sent(struct bt_conn *conn, void *user_data)
+{
+	k_sem_give(&dl_tx_credits);
+}
+
+static void ctrl_notify(struct bt_conn *conn, const uint8_t *data, uint16_t len)
+{
+	if (bt_gatt_is_subscribed(conn, CTRL_ATTR, BT_GATT_CCC_NOTIFY)) {
+		(void)bt_gatt_notify(conn, CTRL_ATTR, data, len);
+	}
+}
+
+static void ctrl_notify_error(struct bt_conn *conn, int err)
+{
+	uint8_t rsp[2] = { DL_OP_ERROR, (uint8_t)(int8_t)err };
+
+	ctrl_notify(conn, rsp, sizeof(rsp));
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: download_run
+//
+//  description:
+//    Streams the log from dl_offset as data notifications until the
+//    end of the log, a stop request or a disconnection. At most
+//    CONFIG_SI_VOICE_LOG_DOWNLOAD_TX_WINDOW notifications are queued,
+//    which keeps the controller supplied without holding every ACL
+//    buffer. Reports the throughput when done.
+///////////////////////////////////////////////////////////////////////
+static void download_run(struct bt_conn *conn)
+{
+	static uint8_t buf[DL_HDR_LEN + DL_PAYLOAD_MAX];
+	struct punch_log_cursor cur;
+	uint8_t rsp[17] = { DL_OP_DONE };
+	uint32_t sent = 0;
+	int64_t start;
+	uint32_t ms;
+	int err;
+
+	if (!bt_gatt_is_subscribed(conn, DATA_ATTR, BT_GATT_CCC_NOTIFY)) {
+		ctrl_notify_error(conn, -EACCES);
+		return;
+	}
+
+	/* Records still in RAM are part of the download */
+	punch_log_flush();
+
+	err = punch_log_seek(&cur, dl_offset);
+	if (err) {
+		ctrl_notify_error(conn, err);
+		return;
+	}
+
+	if (IS_ENABLED(CONFIG_SI_VOICE_LOG_DOWNLOAD_PAUSE_SCAN)) {
+		/* Give the connection all radio time */
+		(void)observer_stop();
+	}
+
+	LOG_INF("Download from offset %u, ATT MTU %u", dl_offset, bt_gatt_get_mtu(conn));
+	start = k_uptime_get();
+
+	while (!atomic_test_bit(&dl_flags, DL_STOP)) {
+		uint16_t payload = MIN(bt_gatt_get_mtu(conn) - 3 - DL_HDR_LEN, DL_PAYLOAD_MAX);
+		struct bt_gatt_notify_params params = {
+			.attr = DATA_ATTR,
+			.data = buf,
+			.func = notify_sent,
+		};
+		int n;
+
+		sys_put_le32(cur.offset, buf);
+		n = punch_log_read(&cur, &buf[DL_HDR_LEN], payload);
+		if (n <= 0) {
+			err = n;
+			break;
+		}
+		params.len = DL_HDR_LEN + n;
+
+		if (k_sem_take(&dl_tx_credits, K_MSEC(1000)) != 0) {
+			err = -ETIMEDOUT;
+			break;
+		}
+		err = bt_gatt_notify_cb(conn, &params);
+		if (err) {
+			k_sem_give(&dl_tx_credits);
+			break;
+		}
+		sent += n;
+	}
+
+	/* Wait for the queued notifications to go out before taking the time */
+	for (int i = 0; i < CONFIG_SI_VOICE_LOG_DOWNLOAD_TX_WINDOW; i++) {
+		if (k_sem_take(&dl_tx_credits, K_MSEC(500)) != 0) {
+			break;
+		}
+	}
+	k_sem_reset(&dl_tx_credits);
+	for (int i = 0; i < CONFIG_SI_VOICE_LOG_DOWNLOAD_TX_WINDOW; i++) {
+		k_sem_give(&dl_tx_credits);
+	}
+	ms = MAX(k_uptime_get() - start, 1);
+
+	if (IS_ENABLED(CONFIG_SI_VOICE_LOG_DOWNLOAD_PAUSE_SCAN)) {
+		(void)observer_start();
+	}
+
+	if (err) {
+		LOG_WRN("Download stopped at offset %u (err %d)", cur.offset, err);
+		ctrl_notify_error(conn, err);
+		return;
+	}
+
+	LOG_INF("Downloaded %u bytes in %u ms, %u bytes/s", sent, ms,
+		(uint32_t)((uint64_t)sent * MSEC_PER_SEC / ms));
+
+	sys_put_le32(cur.offset, &rsp[1]);
+	sys_put_le32(sent, &rsp[5]);
+	sys_put_le32(ms, &rsp[9]);
+	sys_put_le32((uint32_t)((uint64_t)sent * MSEC_PER_SEC / ms), &rsp[13]);
+	ctrl_notify(conn, rsp, sizeof(rsp));
+}
+
+static void download_thread(void)
+{
+	while (1) {
+		struct bt_conn *conn;
+
+		k_sem_take(&dl_start_sem, K_FOREVER);
+
+		conn = dl_conn ? bt_conn_ref(dl_conn) : NULL;
+		if (conn) {
+			download_run(conn);
+			bt_conn_unref(conn);
+		}
+		atomic_clear_bit(&dl_flags, DL_RUNNING);
+	}
+}
+
+K_THREAD_DEFINE(log_download, CONFIG_SI_VOICE_LOG_DOWNLOAD_STACK_SIZE, download_thread,
+		NULL, NULL, NULL, K_PRIO_PREEMPT(8), 0, 0);
+
+static void mtu_exchanged(struct bt_conn *conn, uint8_t err,
+			  struct bt_gatt_exchange_params *params)
+{
+	LOG_INF("ATT MTU %u (err %u)", bt_gatt_get_mtu(conn), err);
+}
+
+static struct bt_gatt_exchange_params mtu_params = {
+	.func = mtu_exchanged,
+};
+
+static void connected(struct bt_conn *conn, uint8_t err)
+{
+	if (err) {
+		LOG_WRN("Connection failed (err %u)", err);
+		k_work_submit(&adv_work);
+		return;
+	}
+
+	LOG_INF("Connected");
+	dl_conn = bt_conn_ref(conn);
+
+	/* The throughput comes from long packets on the 2M PHY, ask for both */
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+	err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (err) {
+		LOG_WRN("PHY update failed (err %d)", err);
+	}
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+	err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+	if (err) {
+		LOG_WRN("Data length update failed (err %d)", err);
+	}
+#endif
+#if defined(CONFIG_BT_GATT_CLIENT)
+	err = bt_gatt_exchange_mtu(conn, &mtu_params);
+	if (err) {
+		LOG_WRN("MTU exchange failed (err %d)", err);
+	}
+#endif
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	LOG_INF("Disconnected (reason 0x%02x)", reason);
+
+	atomic_set_bit(&dl_flags, DL_STOP);
+	if (dl_conn) {
+		bt_conn_unref(dl_conn);
+		dl_conn = NULL;
+	}
+
+	/* Restarted from the work queue once the connection object is released */
+	k_work_submit(&adv_work);
+}
+
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+	LOG_INF("PHY tx %u rx %u", param->tx_phy, param->rx_phy);
+}
+#endif
+
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info)
+{
+	LOG_INF("Data length tx %u bytes %u us, rx %u bytes %u us", info->tx_max_len,
+		info->tx_max_time, info->rx_max_len, info->rx_max_time);
+}
+#endif
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+#if defined(CONFIG_BT_USER_PHY_UPDATE)
+	.le_phy_updated = le_phy_updated,
+#endif
+#if defined(CONFIG_BT_USER_DATA_LEN_UPDATE)
+	.le_data_len_updated = le_data_len_updated,
+#endif
+};
+
+static void adv_work_handler(struct k_work *work)
+{
+	(void)log_download_start();
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: log_download_start
+//
+//  description:
+//    Advertises the punch log service, connectable, at a slow interval
+//    so it costs little next to the scanner.
+///////////////////////////////////////////////////////////////////////
+int log_download_start(void)
+{
+	const struct bt_le_adv_param *param =
+		BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONNECTABLE | BT_LE_ADV_OPT_USE_NAME,
+				DL_ADV_INTERVAL, DL_ADV_INTERVAL, NULL);
+	int err;
+
+	err = bt_le_adv_start(param, ad, ARRAY_SIZE(ad), NULL, 0);
+	if (err) {
+		LOG_ERR("Advertising failed to start (err %d)", err);
+		return err;
+	}
+	LOG_INF("Advertising the punch log service");
+
+	return 0;
+}
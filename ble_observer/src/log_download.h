@@ -0,0 +1,23 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef LOG_DOWNLOAD_H_
+#define LOG_DOWNLOAD_H_
+
+#include <zephyr.h>
+
+#if defined(CONFIG_SI_VOICE_LOG_DOWNLOAD)
+
+/* Starts connectable advertising of the punch log service, after bt_enable() */
+int log_download_start(void);
+
+#else
+
+static inline int log_download_start(void) { return 0; }
+
+#endif /* CONFIG_SI_VOICE_LOG_DOWNLOAD */
+
+#endif /* LOG_DOWNLOAD_H_ */
@@ -8,20 +8,99 @@
 #include <zephyr/sys/printk.h>
 #include <zephyr/bluetooth/bluetooth.h>
 #include <zephyr/bluetooth/hci.h>
+#include <zephyr/sys/byteorder.h>
+#include <logging/log.h>
+#include "audio.h"
+#include "observer.h"
+#include "energy.h"
+#include "punch_log.h"
+#include "power_off.h"
 
-/* Set DEBUG_ENABLE to see all debug messages*/
-#define DEBUG_ENABLE	0
+LOG_MODULE_REGISTER(observer, CONFIG_SI_VOICE_LOG_LEVEL);
 
 #define NAME_LEN 30
 
+/* Offsets into the SPORTident advertising data */
+#define SIAC_DATA_OFFSET	7
+#define SIAC_ID_OFFSET		(SIAC_DATA_OFFSET + SIAC_DATA_LEN)
+#define SIAC_SEQ_OFFSET		(SIAC_ID_OFFSET + 4)
+
+#define BENCH_SCAN_INTERVAL_MS	1000
+/* "BENCH rx" lines are printed in batches this long after the first */
+#define BENCH_RX_DRAIN_MS	50
+#define BENCH_RX_QUEUE_LEN	16
+
+/* Reports handed to the application, for the RX buffer and HCI replay benchmarks */
+static atomic_t scan_reports;
+static atomic_t si_reports;
+
 static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
 			 struct net_buf_simple *ad)
 {
 	char addr_str[BT_ADDR_LE_STR_LEN];
 
+	atomic_inc(&scan_reports);
 	bt_addr_le_to_str(addr, addr_str, sizeof(addr_str));
 }
 
+#if defined(CONFIG_SI_VOICE_BENCH_LOG)
+static void bench_scan_handler(struct k_work *work)
+{
+	printk("BENCH scan %u %u %llu\n", (uint32_t)atomic_get(&scan_reports),
+	       (uint32_t)atomic_get(&si_reports), k_cyc_to_us_floor64(k_cycle_get_32()));
+	k_work_schedule(k_work_delayable_from_work(work), K_MSEC(BENCH_SCAN_INTERVAL_MS));
+}
+
+static K_WORK_DELAYABLE_DEFINE(bench_scan_work, bench_scan_handler);
+
+/* Punches decoded by scan_recv(), printed from the system work queue so
+ * the Bluetooth RX thread does not wait for the UART
+ */
+struct bench_rx {
+	uint32_t siac_id;
+	uint32_t seq;
+	uint32_t decoded_at;
+	uint8_t control;
+};
+
+K_MSGQ_DEFINE(bench_rx_msgq, sizeof(struct bench_rx), BENCH_RX_QUEUE_LEN, 4);
+static atomic_t bench_rx_dropped;
+
+static void bench_rx_handler(struct k_work *work)
+{
+	struct bench_rx rx;
+	uint32_t dropped;
+
+	while (k_msgq_get(&bench_rx_msgq, &rx, K_NO_WAIT) == 0) {
+		printk("BENCH rx %u %u %u %llu\n", rx.siac_id, rx.control, rx.seq,
+		       k_cyc_to_us_floor64(rx.decoded_at));
+	}
+
+	dropped = (uint32_t)atomic_set(&bench_rx_dropped, 0);
+	if (dropped != 0) {
+		LOG_WRN("%u BENCH rx lines dropped", dropped);
+	}
+}
+
+static K_WORK_DELAYABLE_DEFINE(bench_rx_work, bench_rx_handler);
+
+static void bench_rx_put(const struct si_punch *punch)
+{
+	struct bench_rx rx = {
+		.siac_id = punch->siac_id,
+		.seq = punch->seq,
+		.decoded_at = punch->decoded_at,
+		.control = punch->siac_data[1],
+	};
+
+	if (k_msgq_put(&bench_rx_msgq, &rx, K_NO_WAIT) != 0) {
+		atomic_inc(&bench_rx_dropped);
+	}
+	/* Already scheduled when a batch is pending */
+	k_work_schedule(&bench_rx_work, K_MSEC(BENCH_RX_DRAIN_MS));
+}
+#endif /* CONFIG_SI_VOICE_BENCH_LOG */
+
 #if defined(CONFIG_BT_EXT_ADV)
 static bool data_cb(struct bt_data *data, void *user_data)
 {
@@ -34,25 +113,18 @@ static bool data_cb(struct bt_data *data, void *user_data)
 		len = MIN(data->data_len, NAME_LEN - 1);
 		(void)memcpy(name, data->data, len);
 		name[len] = '\0';
-		if(DEBUG_ENABLE) printk("BLE Dev Name: %s\n", name);
+		LOG_DBG("BLE Dev Name: %s", name);
 		return false;
 	case BT_DATA_MANUFACTURER_DATA:
 		len = MIN(data->data_len, NAME_LEN - 1);
 		(void)memcpy(name, data->data, len);
 		name[len] = '\0';
-		if(DEBUG_ENABLE) {
-			printk("Manufacturer Specific Data: ");
-			for (int i = 0; i < len; i++)
-			{
-				printk(" %.2x ", name[i]);
-			}
-			printk("\n");
-		}
+		LOG_HEXDUMP_DBG(name, len, "Manufacturer Specific Data:");
 	case BT_DATA_URI:
 		len = MIN(data->data_len, NAME_LEN - 1);
 		(void)memcpy(name, data->data, len);
 		name[len] = '\0';
-		if(DEBUG_ENABLE) printk("BLE URI: %s\n", name);
+		LOG_DBG("BLE URI: %s", name);
 		return false;
 	default:
 		return true;
@@ -77,6 +149,9 @@ static void scan_recv(const struct bt_le_scan_recv_info *info,
 	char name[NAME_LEN];
 	uint8_t data_status;
 	uint16_t data_len;
+	struct trace_record trace = { 0 };
+
+	trace_stamp(&trace, TRACE_ADV_RECEIVED);
 	
 	// Unique device identifier
 	char * sportident_dev_id0 = "SI Beacon";
@@ -87,7 +162,7 @@ static void scan_recv(const struct bt_le_scan_recv_info *info,
 	data_len = buf->len;
 	char scan_data[100];
 	(void)memset(scan_data, 0, sizeof(scan_data));
-	memcpy(scan_data, buf->data, data_len);
+	memcpy(scan_data, buf->data, MIN(data_len, sizeof(scan_data)));
 	
 	bt_data_parse(buf, data_cb, name);
 
@@ -98,70 +173,56 @@ static void scan_recv(const struct bt_le_scan_recv_info *info,
 	if (info->adv_type == 2)
 	{
 		// Print raw data
-		if(DEBUG_ENABLE) {
-			printk("Scan Data: ");
-			for (int i = 0; i < data_len; i++)
-			{
-				printk(" %.2x ", scan_data[i]);
-			}
-			printk("\r\n");
-			printk("[TYPE 2 DEVICE]: %s, AD evt type %u, Tx Pwr: %i, RSSI %i "
-					"Data status: %u, AD data len: %u Name: %s "
-					"C:%u S:%u D:%u SR:%u E:%u Pri PHY: %s, Sec PHY: %s, "
-					"Interval: 0x%04x (%u ms), SID: %u\r\n",
-					le_addr, info->adv_type, info->tx_power, info->rssi,
-					data_status, data_len, name,
-					(info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE) != 0,
-					(info->adv_props & BT_GAP_ADV_PROP_SCANNABLE) != 0,
-					(info->adv_props & BT_GAP_ADV_PROP_DIRECTED) != 0,
-					(info->adv_props & BT_GAP_ADV_PROP_SCAN_RESPONSE) != 0,
-					(info->adv_props & BT_GAP_ADV_PROP_EXT_ADV) != 0,
-					phy2str(info->primary_phy), phy2str(info->secondary_phy),
-					info->interval, info->interval * 5 / 4, info->sid);
-		}
+		LOG_HEXDUMP_DBG(scan_data, MIN(data_len, sizeof(scan_data)), "Scan Data:");
+		LOG_DBG("[TYPE 2 DEVICE]: %s, AD evt type %u, Tx Pwr: %i, RSSI %i "
+			"Data status: %u, AD data len: %u Name: %s "
+			"C:%u S:%u D:%u SR:%u E:%u Pri PHY: %s, Sec PHY: %s, "
+			"Interval: 0x%04x (%u ms), SID: %u",
+			le_addr, info->adv_type, info->tx_power, info->rssi,
+			data_status, data_len, name,
+			(info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE) != 0,
+			(info->adv_props & BT_GAP_ADV_PROP_SCANNABLE) != 0,
+			(info->adv_props & BT_GAP_ADV_PROP_DIRECTED) != 0,
+			(info->adv_props & BT_GAP_ADV_PROP_SCAN_RESPONSE) != 0,
+			(info->adv_props & BT_GAP_ADV_PROP_EXT_ADV) != 0,
+			phy2str(info->primary_phy), phy2str(info->secondary_phy),
+			info->interval, info->interval * 5 / 4, info->sid);
 		if ((scan_data[0] == 0x02 && scan_data[1] == 0x01 && scan_data[2] == 0x04) || 
 				(strstr(name, sportident_dev_id0) != NULL || strstr(name, sportident_dev_id1) != NULL))
 		{
-			if(DEBUG_ENABLE) {
-				printk("SPORTident Device Found!!!\n");
-				printk("Scanned Data: ");
-				for (int i = 0; i < data_len; i++)
-				{
-					printk(" %.2x ", scan_data[i]);
-				}
-				printk("\n");
-			}
+			LOG_DBG("SPORTident Device Found");
 
 			if (scan_data[6] == 0xFF) {
+				atomic_inc(&si_reports);
+				power_off_activity();
 				/* Parse Manufacturer specific data */
-				char siac_data[] = {
-					scan_data[7], scan_data[8], scan_data[9], scan_data[10], 
-					scan_data[11], scan_data[12], scan_data[13]
-					};
-				if(DEBUG_ENABLE) {
-					printk("SIAC Data: ");
-					for (int i = 0; i < 7; i++)
-					{
-						printk(" %.2x ", siac_data[i]);
+				struct si_punch punch = {
+					.decoded_at = k_cycle_get_32(),
+					.siac_id = sys_get_be32((uint8_t *)&scan_data[SIAC_ID_OFFSET]),
+					.trace = trace,
+				};
+
+				memcpy(punch.siac_data, &scan_data[SIAC_DATA_OFFSET], SIAC_DATA_LEN);
+				if (data_len >= SIAC_SEQ_OFFSET + 4) {
+					punch.seq = sys_get_be32((uint8_t *)&scan_data[SIAC_SEQ_OFFSET]);
+				}
+				trace_stamp(&punch.trace, TRACE_PUNCH_DECODED);
+
+				LOG_DBG("SIAC %u control %u", punch.siac_id, (uint8_t)punch.siac_data[1]);
+#if defined(CONFIG_SI_VOICE_BENCH_LOG)
+				bench_rx_put(&punch);
+#endif
+				/* Every punch goes to the log, also those of other SIACs */
+				punch_log_punch(&punch);
+				if (CONFIG_SI_VOICE_BOUND_SIAC_ID == 0 ||
+				    punch.siac_id == CONFIG_SI_VOICE_BOUND_SIAC_ID) {
+					trace_stamp(&punch.trace, TRACE_PUNCH_ENQUEUED);
+					if (audio_submit_punch(&punch) != 0) {
+						LOG_WRN("Audio queue full, punch dropped");
+						punch_log_announcement(&punch, -ENOBUFS);
 					}
-					printk("\n");
 				}
-				spi_write_test_msg(siac_data);
 			}
-
-			if(DEBUG_ENABLE) printk("[SI DEVICE]: %s, AD evt type %u, Tx Pwr: %i, RSSI %i "
-				"Data status: %u, AD data len: %u Name: %s "
-				"C:%u S:%u D:%u SR:%u E:%u Pri PHY: %s, Sec PHY: %s, "
-				"Interval: 0x%04x (%u ms), SID: %u\r\n",
-				le_addr, info->adv_type, info->tx_power, info->rssi,
-				data_status, data_len, name,
-				(info->adv_props & BT_GAP_ADV_PROP_CONNECTABLE) != 0,
-				(info->adv_props & BT_GAP_ADV_PROP_SCANNABLE) != 0,
-				(info->adv_props & BT_GAP_ADV_PROP_DIRECTED) != 0,
-				(info->adv_props & BT_GAP_ADV_PROP_SCAN_RESPONSE) != 0,
-				(info->adv_props & BT_GAP_ADV_PROP_EXT_ADV) != 0,
-				phy2str(info->primary_phy), phy2str(info->secondary_phy),
-				info->interval, info->interval * 5 / 4, info->sid);
 		}
 	}
 }
@@ -176,22 +237,53 @@ int observer_start(void)
 	struct bt_le_scan_param scan_param = {
 		.type       = BT_LE_SCAN_TYPE_PASSIVE,
 		.options    = BT_LE_SCAN_OPT_FILTER_DUPLICATE,
-		.interval   = BT_GAP_SCAN_FAST_INTERVAL,
-		.window     = BT_GAP_SCAN_FAST_WINDOW,
+		.interval   = CONFIG_SI_VOICE_SCAN_INTERVAL,
+		.window     = CONFIG_SI_VOICE_SCAN_WINDOW,
 	};
 	int err;
 
 #if defined(CONFIG_BT_EXT_ADV)
-	bt_le_scan_cb_register(&scan_callbacks);
-	if(DEBUG_ENABLE) printk("Registered scan callbacks\n");
+	static bool registered;
+
+	/* Scanning is restarted after a log download, register only once */
+	if (!registered) {
+		bt_le_scan_cb_register(&scan_callbacks);
+		registered = true;
+		LOG_DBG("Registered scan callbacks");
+	}
 #endif /* CONFIG_BT_EXT_ADV */
 
 	err = bt_le_scan_start(&scan_param, device_found);
 	if (err) {
-		if(DEBUG_ENABLE) printk("Start scanning failed (err %d)\n", err);
+		LOG_ERR("Start scanning failed (err %d)", err);
+		return err;
+	}
+	LOG_INF("Started scanning");
+	energy_on(ENERGY_RAIL_SCAN);
+#if defined(CONFIG_SI_VOICE_BENCH_LOG)
+	k_work_schedule(&bench_scan_work, K_MSEC(BENCH_SCAN_INTERVAL_MS));
+#endif
+
+	return 0;
+}
+
+void observer_stats_get(uint32_t *reports, uint32_t *si_count)
+{
+	*reports = (uint32_t)atomic_get(&scan_reports);
+	*si_count = (uint32_t)atomic_get(&si_reports);
+}
+
+int observer_stop(void)
+{
+	int err;
+
+	err = bt_le_scan_stop();
+	if (err) {
+		LOG_ERR("Stop scanning failed (err %d)", err);
 		return err;
 	}
-	if(DEBUG_ENABLE) printk("Started scanning...\n");
+	energy_off(ENERGY_RAIL_SCAN);
+	LOG_INF("Stopped scanning");
 
 	return 0;
 }
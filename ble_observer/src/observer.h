@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef OBSERVER_H_
+#define OBSERVER_H_
+
+#include <zephyr/types.h>
+
+/* Passive scanning for SPORTident advertisements, decoded punches go to the audio queue */
+int observer_start(void);
+int observer_stop(void);
+
+/* Advertising reports handed to the application and SPORTident reports decoded, since boot */
+void observer_stats_get(uint32_t *reports, uint32_t *si_count);
+
+#endif /* OBSERVER_H_ */
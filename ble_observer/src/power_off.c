@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <init.h>
+#include <stddef.h>
+#include <sys/crc.h>
+#include <logging/log.h>
+#include <logging/log_ctrl.h>
+#include <shell/shell.h>
+#include <drivers/gpio.h>
+#include <drivers/hwinfo.h>
+#if defined(CONFIG_SOC_SERIES_NRF53X)
+#include <hal/nrf_regulators.h>
+#else
+#include <hal/nrf_power.h>
+#endif
+#include "power_off.h"
+#include "audio.h"
+#include "observer.h"
+#include "punch_log.h"
+#include "energy.h"
+
+LOG_MODULE_REGISTER(power_off, CONFIG_SI_VOICE_LOG_LEVEL);
+
+#define POWER_OFF_MAGIC		0x4f464621	/* "OFF!" */
+
+#define POWER_OFF_TIMEOUT_MS	(CONFIG_SI_VOICE_POWER_OFF_TIMEOUT * MSEC_PER_SEC)
+
+/* Retry interval when the audio queue has no room for the power off */
+#define POWER_OFF_RETRY_MS	10000
+
+#define RAM_BASE		DT_REG_ADDR(DT_CHOSEN(zephyr_sram))
+
+/* Kept in a retained RAM section through System OFF, valid while the CRC matches */
+struct power_off_state {
+	uint32_t magic;
+	uint32_t offs;			/* System OFF entries since the last cold boot */
+	struct s1v3g340_standby_state ic;
+	bool ic_standby;		/* the speech IC was left in standby */
+	uint32_t crc;
+};
+
+/* Aligned so it does not straddle two RAM sections */
+static __noinit __aligned(32) struct power_off_state retained;
+
+static const struct gpio_dt_spec wake_pin = GPIO_DT_SPEC_GET(DT_ALIAS(sw0), gpios);
+
+static atomic_t last_activity;		/* k_uptime_get_32() of the last SPORTident report */
+static uint32_t offs;
+static bool woken;			/* this boot is a wake from System OFF */
+static bool resume_valid;
+static struct s1v3g340_standby_state resume_ic;
+static uint32_t wake_scan_ms;		/* uptime at which scanning resumed after the wake */
+static uint32_t retained_map[4];	/* RAM sections set to retention, by index */
+
+static void inactivity_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(inactivity_work, inactivity_work_handler);
+
+static uint32_t retained_crc(void)
+{
+	return crc32_ieee((const uint8_t *)&retained, offsetof(struct power_off_state, crc));
+}
+
+static uint32_t idle_ms(void)
+{
+	return k_uptime_get_32() - (uint32_t)atomic_get(&last_activity);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: ram_retain
+//
+//  description:
+//    Keeps the RAM sections holding an object powered in System OFF.
+//    Sections are 4 kB, except the 32 kB ones above 64 kB on the
+//    nRF52840.
+//
+//  return:
+//    number of sections retained that were not retained already
+///////////////////////////////////////////////////////////////////////
+static int ram_retain(const void *addr, size_t len)
+{
+	uintptr_t off = (uintptr_t)addr - RAM_BASE;
+	uintptr_t end = off + len;
+	int sections = 0;
+
+	while (off < end) {
+#if defined(CONFIG_SOC_SERIES_NRF53X)
+		/* 64 kB blocks of 16 sections */
+		uint32_t block = off / KB(64);
+		uint32_t section = (off % KB(64)) / KB(4);
+		uint32_t index = block * 16 + section;
+		size_t size = KB(4);
+
+		NRF_VMC->RAM[block].POWERSET = VMC_RAM_POWERSET_S0RETENTION_Msk << section;
+#else
+		/* 8 kB blocks of 2 sections, then RAM8 with 32 kB sections */
+		uint32_t block = (off < KB(64)) ? off / KB(8) : 8;
+		uint32_t section = (off < KB(64)) ? (off % KB(8)) / KB(4) : (off - KB(64)) / KB(32);
+		uint32_t index = block * 2 + section;
+		size_t size = (off < KB(64)) ? KB(4) : KB(32);
+
+		NRF_POWER->RAM[block].POWERSET = POWER_RAM_POWERSET_S0RETENTION_Msk << section;
+#endif
+		if (!(retained_map[index / 32] & BIT(index % 32))) {
+			retained_map[index / 32] |= BIT(index % 32);
+			sections++;
+		}
+		off = ROUND_DOWN(off, size) + size;
+	}
+
+	return sections;
+}
+
+static void system_off(void)
+{
+#if defined(CONFIG_SOC_SERIES_NRF53X)
+	nrf_regulators_system_off(NRF_REGULATORS);
+#else
+	nrf_power_system_off(NRF_POWER);
+#endif
+}
+
+void power_off_activity(void)
+{
+	atomic_set(&last_activity, k_uptime_get_32());
+}
+
+bool power_off_resume_state(struct s1v3g340_standby_state *state)
+{
+	if (resume_valid) {
+		*state = resume_ic;
+	}
+
+	return resume_valid;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: power_off_start
+//
+//  description:
+//    Arms the inactivity timer, called once scanning has started. After
+//    a wake from System OFF the time from the wake to scanning is
+//    logged, the SoC start-up before the kernel not included.
+///////////////////////////////////////////////////////////////////////
+int power_off_start(void)
+{
+	int err;
+
+	err = gpio_pin_configure_dt(&wake_pin, GPIO_INPUT);
+	if (err) {
+		LOG_ERR("Wake pin not configured (err %d)", err);
+		return err;
+	}
+
+	power_off_activity();
+	if (woken) {
+		wake_scan_ms = k_uptime_get_32();
+		LOG_INF("Woke from System OFF (%u since power on), scanning %u ms after the wake, "
+			"speech IC %s", offs, wake_scan_ms,
+			resume_valid ? "resumed from standby" : "reset");
+	}
+	k_work_schedule(&inactivity_work, K_MSEC(POWER_OFF_TIMEOUT_MS));
+
+	return 0;
+}
+
+static void inactivity_work_handler(struct k_work *work)
+{
+	uint32_t idle = idle_ms();
+
+	if (idle < POWER_OFF_TIMEOUT_MS) {
+		k_work_reschedule(&inactivity_work, K_MSEC(POWER_OFF_TIMEOUT_MS - idle));
+		return;
+	}
+
+	/* The audio worker owns the speech IC, it powers off in turn with the announcements */
+	if (audio_submit_power_off() != 0) {
+		k_work_reschedule(&inactivity_work, K_MSEC(POWER_OFF_RETRY_MS));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: power_off_enter
+//
+//  description:
+//    Stops scanning, commits the punch log, puts the speech IC into
+//    standby with the amplifier muted and the SoC into System OFF. The
+//    wake pin brings the unit back through a reset, the retained state
+//    then lets main() take the speech IC out of standby instead of
+//    resetting it. Logs the expected System OFF current.
+//
+//  return:
+//    -EAGAIN when a report came in meanwhile, -EIO when System OFF
+//    failed and the speech IC has to be reset, otherwise no return
+///////////////////////////////////////////////////////////////////////
+int power_off_enter(void)
+{
+	uint32_t idle = idle_ms();
+	uint32_t off_na;
+	int sections;
+	int err;
+
+	if (idle < POWER_OFF_TIMEOUT_MS) {
+		k_work_reschedule(&inactivity_work, K_MSEC(POWER_OFF_TIMEOUT_MS - idle));
+		return -EAGAIN;
+	}
+
+	LOG_INF("No SPORTident traffic for %u s, powering off", idle / MSEC_PER_SEC);
+
+	/* Level sensing on the pin is what wakes the SoC from System OFF */
+	err = gpio_pin_interrupt_configure_dt(&wake_pin, GPIO_INT_LEVEL_ACTIVE);
+	if (err) {
+		LOG_ERR("Wake pin sense not configured (err %d), staying on", err);
+		k_work_reschedule(&inactivity_work, K_MSEC(POWER_OFF_TIMEOUT_MS));
+		return -EAGAIN;
+	}
+
+	(void)observer_stop();
+#if defined(CONFIG_SI_VOICE_PUNCH_LOG)
+	punch_log_flush();
+#endif
+
+	retained.magic = POWER_OFF_MAGIC;
+	retained.offs = offs + 1;
+	retained.ic_standby = (S1V3G340_Standby_Enter(&retained.ic) == 0);
+	if (!retained.ic_standby) {
+		LOG_WRN("Speech IC not in standby, holding it in reset");
+		GPIO_ControlMute(0);
+		GPIO_S1V3G340_Reset(0);
+	}
+	retained.crc = retained_crc();
+	sections = ram_retain(&retained, sizeof(retained));
+#if defined(CONFIG_SI_VOICE_ENERGY)
+	/* The race totals continue after the wake */
+	const void *ledger;
+	size_t ledger_len;
+
+	ledger = energy_power_off(&ledger_len);
+	sections += ram_retain(ledger, ledger_len);
+#endif
+
+	off_na = CONFIG_SI_VOICE_POWER_OFF_SOC_NA + sections * CONFIG_SI_VOICE_POWER_OFF_RAM_NA +
+		 (retained.ic_standby ? CONFIG_SI_VOICE_POWER_OFF_IC_UA * 1000 : 0);
+	LOG_INF("System OFF, about %u.%03u uA (SoC %u nA, %d retained RAM sections, "
+		"speech IC %s)", off_na / 1000, off_na % 1000, CONFIG_SI_VOICE_POWER_OFF_SOC_NA,
+		sections, retained.ic_standby ? "in standby" : "in reset");
+
+	/* Deferred messages are printed now, nothing is left for after the wake */
+	LOG_PANIC();
+	system_off();
+
+	/* Only reached when System OFF is emulated, e.g. with a debugger attached */
+	k_msleep(100);
+	LOG_ERR("System OFF failed");
+	retained.magic = 0;
+	(void)gpio_pin_interrupt_configure_dt(&wake_pin, GPIO_INT_DISABLE);
+	(void)observer_start();
+	power_off_activity();
+	k_work_reschedule(&inactivity_work, K_MSEC(POWER_OFF_TIMEOUT_MS));
+
+	return -EIO;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_power_off_show(const struct shell *sh, size_t argc, char **argv)
+{
+	shell_print(sh, "No SPORTident traffic for %u of %u s", idle_ms() / MSEC_PER_SEC,
+		    CONFIG_SI_VOICE_POWER_OFF_TIMEOUT);
+	shell_print(sh, "%u System OFF since power on", offs);
+	if (woken) {
+		shell_print(sh, "Last wake: scanning after %u ms, speech IC %s", wake_scan_ms,
+			    resume_valid ? "resumed from standby" : "reset");
+	}
+
+	return 0;
+}
+
+static int cmd_power_off_now(const struct shell *sh, size_t argc, char **argv)
+{
+	atomic_set(&last_activity, k_uptime_get_32() - POWER_OFF_TIMEOUT_MS);
+	k_work_reschedule(&inactivity_work, K_NO_WAIT);
+	shell_print(sh, "Powering off, press the wake button to resume");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(power_off_cmds,
+	SHELL_CMD(show, NULL, "Inactivity and the last wake", cmd_power_off_show),
+	SHELL_CMD(now, NULL, "Power off without waiting for the timeout", cmd_power_off_now),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(poweroff, &power_off_cmds, "System OFF after inactivity", NULL);
+#endif /* CONFIG_SHELL */
+
+static int power_off_init(const struct device *dev)
+{
+	uint32_t cause = 0;
+
+	ARG_UNUSED(dev);
+
+	(void)hwinfo_get_reset_cause(&cause);
+	(void)hwinfo_clear_reset_cause();
+	woken = (cause & RESET_LOW_POWER_WAKE) != 0;
+
+	if (retained.magic == POWER_OFF_MAGIC && retained.crc == retained_crc()) {
+		offs = retained.offs;
+		resume_valid = woken && retained.ic_standby;
+		resume_ic = retained.ic;
+	}
+	/* Only the wake right after System OFF resumes from it */
+	retained.magic = 0;
+
+	return 0;
+}
+
+SYS_INIT(power_off_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef POWER_OFF_H_
+#define POWER_OFF_H_
+
+#include <zephyr.h>
+#include "s1v3g340.h"
+
+#if defined(CONFIG_SI_VOICE_POWER_OFF)
+
+/* A SPORTident report was received, restarts the inactivity period. Cheap,
+ * for the Bluetooth RX thread.
+ */
+void power_off_activity(void);
+
+/* True after a wake from System OFF with the speech IC left in standby,
+ * state is then what S1V3G340_Standby_Exit() needs
+ */
+bool power_off_resume_state(struct s1v3g340_standby_state *state);
+
+/* Starts the inactivity timer once scanning, reports the wake latency */
+int power_off_start(void);
+
+/* Powers off if there still was no traffic, on the audio worker. Returns
+ * only when the power off was called off.
+ */
+int power_off_enter(void);
+
+#else
+
+static inline void power_off_activity(void) {}
+static inline bool power_off_resume_state(struct s1v3g340_standby_state *state)
+{
+	return false;
+}
+static inline int power_off_start(void) { return 0; }
+static inline int power_off_enter(void) { return -ENOTSUP; }
+
+#endif /* CONFIG_SI_VOICE_POWER_OFF */
+
+#endif /* POWER_OFF_H_ */
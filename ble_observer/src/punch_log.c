@@ -0,0 +1,693 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <init.h>
+#include <string.h>
+#include <fs/fcb.h>
+#include <storage/flash_map.h>
+#include <logging/log.h>
+#include <shell/shell.h>
+#if defined(CONFIG_SI_VOICE_PUNCH_LOG_LZ4)
+#include <lz4.h>
+#endif
+#include "punch_log.h"
+
+LOG_MODULE_REGISTER(punch_log, CONFIG_SI_VOICE_LOG_LEVEL);
+
+#define PUNCH_LOG_MAGIC		0x50554e43	/* "PUNC" */
+#define PUNCH_LOG_VERSION	3
+#define PUNCH_LOG_AREA_ID	FLASH_AREA_ID(storage)
+
+/* Stations repeat a punch in many advertisements, recently logged ones are skipped */
+#define PUNCH_LOG_RECENT	4
+
+/* Records are collected in one batch while the other one is written,
+ * each batch becomes one FCB entry with its own CRC.
+ */
+struct punch_log_batch {
+	uint32_t count;
+	struct punch_log_record records[CONFIG_SI_VOICE_PUNCH_LOG_BATCH];
+};
+
+struct punch_key {
+	uint32_t siac_id;
+	uint32_t seq;
+	uint8_t control;
+};
+
+static struct punch_log_batch batches[2];
+static uint8_t fill_idx;		/* batch taking new records */
+static uint8_t commit_idx;		/* next batch to be written */
+static uint8_t sealed;			/* BIT(i) when batch i waits to be written */
+static struct punch_key recent[PUNCH_LOG_RECENT];
+static uint8_t recent_next;
+static struct punch_log_stats stats;
+static struct k_spinlock log_lock;
+
+#define BATCH_BYTES		(CONFIG_SI_VOICE_PUNCH_LOG_BATCH * sizeof(struct punch_log_record))
+#if defined(CONFIG_SI_VOICE_PUNCH_LOG_LZ4)
+#define SEGMENT_MAX		(sizeof(struct punch_log_segment) + LZ4_COMPRESSBOUND(BATCH_BYTES))
+#else
+#define SEGMENT_MAX		(sizeof(struct punch_log_segment) + BATCH_BYTES)
+#endif
+
+/* Segment being written or read, both with flash_lock held */
+static uint8_t segment_buf[SEGMENT_MAX] __aligned(4);
+#if defined(CONFIG_SI_VOICE_PUNCH_LOG_LZ4)
+/* Hash table of the compressor, too large for the work queue stack */
+static LZ4_stream_t lz4_state;
+static struct punch_log_record walk_records[CONFIG_SI_VOICE_PUNCH_LOG_BATCH];
+#endif
+
+static struct fcb log_fcb;
+static struct flash_sector log_sectors[CONFIG_SI_VOICE_PUNCH_LOG_MAX_SECTORS];
+static bool log_ready;
+/* Log offsets of the oldest segment and of the end, with flash_lock held */
+static uint32_t log_start;
+static uint32_t log_end;
+/* Serializes flash access between the commit work and readers */
+static K_MUTEX_DEFINE(flash_lock);
+
+static K_THREAD_STACK_DEFINE(log_stack, CONFIG_SI_VOICE_PUNCH_LOG_STACK_SIZE);
+static struct k_work_q log_work_q;
+
+static void init_work_handler(struct k_work *work);
+static void commit_work_handler(struct k_work *work);
+static void flush_work_handler(struct k_work *work);
+static K_WORK_DEFINE(init_work, init_work_handler);
+static K_WORK_DEFINE(commit_work, commit_work_handler);
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_work_handler);
+
+/* Closes the filling batch for writing, log_lock held */
+static void batch_seal(void)
+{
+	sealed |= BIT(fill_idx);
+	fill_idx ^= 1;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: record_add
+//
+//  description:
+//    Copies a record into the filling batch. Only takes the spinlock,
+//    so it is safe from the Bluetooth RX thread and the audio path.
+//    A full batch is handed to the log work queue for writing.
+///////////////////////////////////////////////////////////////////////
+static void record_add(const struct punch_log_record *rec)
+{
+	k_spinlock_key_t key = k_spin_lock(&log_lock);
+	struct punch_log_batch *batch = &batches[fill_idx];
+	bool full = false;
+
+	if (sealed & BIT(fill_idx)) {
+		/* Both batches wait for the flash */
+		stats.dropped++;
+		k_spin_unlock(&log_lock, key);
+		return;
+	}
+
+	batch->records[batch->count++] = *rec;
+	stats.records++;
+	if (batch->count == CONFIG_SI_VOICE_PUNCH_LOG_BATCH) {
+		batch_seal();
+		full = true;
+	}
+
+	k_spin_unlock(&log_lock, key);
+
+	if (full) {
+		k_work_submit_to_queue(&log_work_q, &commit_work);
+	} else {
+		/* Does nothing when the flush is already scheduled */
+		k_work_schedule_for_queue(&log_work_q, &flush_work,
+					  K_MSEC(CONFIG_SI_VOICE_PUNCH_LOG_FLUSH_MS));
+	}
+}
+
+static void record_fill(struct punch_log_record *rec, enum punch_log_type type,
+			const struct si_punch *punch)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->uptime_ms = k_uptime_get_32();
+	rec->type = type;
+	if (punch) {
+		rec->siac_id = punch->siac_id;
+		rec->seq = punch->seq;
+		memcpy(rec->siac_data, punch->siac_data, SIAC_DATA_LEN);
+	}
+}
+
+void punch_log_punch(const struct si_punch *punch)
+{
+	struct punch_key punch_key = {
+		.siac_id = punch->siac_id,
+		.seq = punch->seq,
+		.control = punch->siac_data[1],
+	};
+	struct punch_log_record rec;
+	k_spinlock_key_t key = k_spin_lock(&log_lock);
+
+	for (int i = 0; i < PUNCH_LOG_RECENT; i++) {
+		if (recent[i].siac_id == punch_key.siac_id && recent[i].seq == punch_key.seq &&
+		    recent[i].control == punch_key.control) {
+			k_spin_unlock(&log_lock, key);
+			return;
+		}
+	}
+	recent[recent_next] = punch_key;
+	recent_next = (recent_next + 1) % PUNCH_LOG_RECENT;
+
+	k_spin_unlock(&log_lock, key);
+
+	record_fill(&rec, PUNCH_LOG_PUNCH, punch);
+	record_add(&rec);
+}
+
+void punch_log_announcement(const struct si_punch *punch, int result)
+{
+	struct punch_log_record rec;
+
+	record_fill(&rec, PUNCH_LOG_ANNOUNCEMENT, punch);
+	rec.result = (int8_t)CLAMP(result, INT8_MIN, 0);
+	record_add(&rec);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: segment_build
+//
+//  description:
+//    Packs a sealed batch into segment_buf, LZ4 compressed when that
+//    makes it smaller. Timestamps, SIAC IDs and the punch data repeat
+//    from record to record, so a full batch usually shrinks to a
+//    fraction.
+//
+//  return:
+//    length of the segment including its header
+///////////////////////////////////////////////////////////////////////
+static uint16_t segment_build(const struct punch_log_batch *batch)
+{
+	struct punch_log_segment *seg = (struct punch_log_segment *)segment_buf;
+	uint16_t raw_len = batch->count * sizeof(struct punch_log_record);
+
+	seg->records = batch->count;
+	seg->format = PUNCH_LOG_SEGMENT_RAW;
+	seg->len = raw_len;
+
+#if defined(CONFIG_SI_VOICE_PUNCH_LOG_LZ4)
+	int len = LZ4_compress_fast_extState(&lz4_state, (const char *)batch->records,
+					     (char *)seg->data, raw_len,
+					     SEGMENT_MAX - sizeof(*seg), 1);
+
+	if (len > 0 && len < raw_len) {
+		seg->format = PUNCH_LOG_SEGMENT_LZ4;
+		seg->len = len;
+		return sizeof(*seg) + len;
+	}
+#endif
+	memcpy(seg->data, batch->records, raw_len);
+
+	return sizeof(*seg) + raw_len;
+}
+
+/* Reads the header of an entry, flash_lock held */
+static int segment_header_read(const struct fcb_entry *loc, struct punch_log_segment *seg)
+{
+	if (loc->fe_data_len < sizeof(*seg)) {
+		return -EBADMSG;
+	}
+
+	return flash_area_read(log_fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), seg, sizeof(*seg));
+}
+
+/* Moves log_start to the oldest segment after a rotation, flash_lock held */
+static void log_start_update(void)
+{
+	struct fcb_entry loc = { 0 };
+	struct punch_log_segment seg;
+
+	if (fcb_getnext(&log_fcb, &loc) == 0 && segment_header_read(&loc, &seg) == 0) {
+		log_start = seg.start;
+	} else {
+		log_start = log_end;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: batch_write
+//
+//  description:
+//    Appends a batch as one FCB entry. The entry only becomes valid
+//    when fcb_append_finish() writes its CRC, so a reset during the
+//    write leaves the log as it was before. When the area is full the
+//    oldest sector is erased, which spreads the erases evenly.
+///////////////////////////////////////////////////////////////////////
+static int batch_write(const struct punch_log_batch *batch)
+{
+	struct punch_log_segment *seg = (struct punch_log_segment *)segment_buf;
+	uint16_t len = segment_build(batch);
+	struct fcb_entry loc;
+	int err;
+
+	seg->start = log_end;
+
+	err = fcb_append(&log_fcb, len, &loc);
+	if (err == -ENOSPC) {
+		err = fcb_rotate(&log_fcb);
+		if (err == 0) {
+			stats.rotations++;
+			log_start_update();
+			err = fcb_append(&log_fcb, len, &loc);
+		}
+	}
+	if (err) {
+		return err;
+	}
+
+	err = flash_area_write(log_fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), segment_buf, len);
+	if (err) {
+		return err;
+	}
+
+	err = fcb_append_finish(&log_fcb, &loc);
+	if (err == 0) {
+		stats.stored += len;
+		log_end += len;
+	}
+
+	return err;
+}
+
+static void commit_work_handler(struct k_work *work)
+{
+	if (!log_ready) {
+		/* Written once the flash area is mounted */
+		return;
+	}
+
+	while (sealed & BIT(commit_idx)) {
+		struct punch_log_batch *batch = &batches[commit_idx];
+		k_spinlock_key_t key;
+		int err;
+
+		/* A sealed batch is not touched by the producers */
+		k_mutex_lock(&flash_lock, K_FOREVER);
+		err = batch_write(batch);
+		k_mutex_unlock(&flash_lock);
+
+		key = k_spin_lock(&log_lock);
+		if (err) {
+			LOG_ERR("Commit of %u records failed (err %d)", batch->count, err);
+			stats.errors++;
+			stats.dropped += batch->count;
+		} else {
+			stats.batches++;
+			stats.bytes += batch->count * sizeof(struct punch_log_record);
+		}
+		batch->count = 0;
+		sealed &= ~BIT(commit_idx);
+		commit_idx ^= 1;
+		k_spin_unlock(&log_lock, key);
+	}
+}
+
+static void flush_work_handler(struct k_work *work)
+{
+	k_spinlock_key_t key = k_spin_lock(&log_lock);
+
+	if (batches[fill_idx].count > 0 && !(sealed & BIT(fill_idx))) {
+		batch_seal();
+	}
+
+	k_spin_unlock(&log_lock, key);
+
+	commit_work_handler(NULL);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: punch_log_flush
+//
+//  description:
+//    Writes the records still in RAM and waits until they are in
+//    flash. Blocks, not for the Bluetooth RX thread.
+///////////////////////////////////////////////////////////////////////
+void punch_log_flush(void)
+{
+	struct k_work_sync sync;
+
+	k_work_reschedule_for_queue(&log_work_q, &flush_work, K_NO_WAIT);
+	k_work_flush_delayable(&flush_work, &sync);
+}
+
+struct walk_ctx {
+	punch_log_cb cb;
+	void *user_data;
+};
+
+static int walk_entry(struct fcb_entry_ctx *loc_ctx, void *arg)
+{
+	const struct punch_log_segment *seg = (const struct punch_log_segment *)segment_buf;
+	const struct punch_log_record *records = (const struct punch_log_record *)seg->data;
+	struct walk_ctx *ctx = arg;
+	uint16_t len = loc_ctx->loc.fe_data_len;
+
+	if (len < sizeof(*seg) || len > sizeof(segment_buf)) {
+		return -EBADMSG;
+	}
+	if (flash_area_read(loc_ctx->fap, FCB_ENTRY_FA_DATA_OFF(loc_ctx->loc),
+			    segment_buf, len) != 0) {
+		return -EIO;
+	}
+
+	switch (seg->format) {
+	case PUNCH_LOG_SEGMENT_RAW:
+		if (seg->len < seg->records * sizeof(*records)) {
+			return -EBADMSG;
+		}
+		break;
+#if defined(CONFIG_SI_VOICE_PUNCH_LOG_LZ4)
+	case PUNCH_LOG_SEGMENT_LZ4:
+		if (LZ4_decompress_safe((const char *)seg->data, (char *)walk_records, seg->len,
+					sizeof(walk_records)) != seg->records * sizeof(*records)) {
+			return -EBADMSG;
+		}
+		records = walk_records;
+		break;
+#endif
+	default:
+		return -ENOTSUP;
+	}
+
+	for (int i = 0; i < seg->records; i++) {
+		if (!ctx->cb(&records[i], ctx->user_data)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int punch_log_walk(punch_log_cb cb, void *user_data)
+{
+	struct walk_ctx ctx = { .cb = cb, .user_data = user_data };
+	int err;
+
+	if (!log_ready) {
+		return -EAGAIN;
+	}
+
+	k_mutex_lock(&flash_lock, K_FOREVER);
+	err = fcb_walk(&log_fcb, NULL, walk_entry, &ctx);
+	k_mutex_unlock(&flash_lock);
+
+	return (err > 0) ? 0 : err;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: punch_log_seek
+//
+//  description:
+//    Positions a cursor at a log offset, see punch_log_range(). Only
+//    the segment headers are read, so resuming a download does not read
+//    the data before it.
+//
+//  return:
+//    0, -ERANGE when the offset is beyond the end of the log or its
+//    segment has been erased to make room
+///////////////////////////////////////////////////////////////////////
+int punch_log_seek(struct punch_log_cursor *cur, uint32_t offset)
+{
+	struct fcb_entry loc = { 0 };
+	struct punch_log_segment seg;
+	int err = -ERANGE;
+
+	if (!log_ready) {
+		return -EAGAIN;
+	}
+
+	memset(cur, 0, sizeof(*cur));
+
+	k_mutex_lock(&flash_lock, K_FOREVER);
+	if (offset == log_start) {
+		/* A cleared cursor starts at the oldest entry */
+		cur->offset = offset;
+		err = 0;
+	} else if (offset > log_start && offset <= log_end) {
+		while (fcb_getnext(&log_fcb, &loc) == 0) {
+			if (segment_header_read(&loc, &seg) != 0) {
+				err = -EIO;
+				break;
+			}
+			if (offset >= seg.start && offset <= seg.start + loc.fe_data_len) {
+				cur->loc = loc;
+				cur->entry_off = offset - seg.start;
+				cur->offset = offset;
+				err = 0;
+				break;
+			}
+		}
+	}
+	k_mutex_unlock(&flash_lock);
+
+	return err;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: punch_log_read
+//
+//  description:
+//    Reads up to len bytes at the cursor and advances it, continuing
+//    into the following entries.
+//
+//  return:
+//    number of bytes read, 0 at the end of the log, -ERANGE when the
+//    segment under the cursor has been erased meanwhile, negative errno
+///////////////////////////////////////////////////////////////////////
+int punch_log_read(struct punch_log_cursor *cur, void *buf, size_t len)
+{
+	uint8_t *out = buf;
+	size_t done = 0;
+	int err = 0;
+
+	if (!log_ready) {
+		return -EAGAIN;
+	}
+
+	k_mutex_lock(&flash_lock, K_FOREVER);
+	if (cur->offset < log_start) {
+		k_mutex_unlock(&flash_lock);
+		return -ERANGE;
+	}
+	while (done < len) {
+		size_t n;
+
+		if (cur->entry_off == cur->loc.fe_data_len) {
+			/* A cleared cursor starts at the oldest entry */
+			if (fcb_getnext(&log_fcb, &cur->loc) != 0) {
+				break;
+			}
+			cur->entry_off = 0;
+			continue;
+		}
+
+		n = MIN(len - done, cur->loc.fe_data_len - cur->entry_off);
+		err = flash_area_read(log_fcb.fap,
+				      FCB_ENTRY_FA_DATA_OFF(cur->loc) + cur->entry_off,
+				      &out[done], n);
+		if (err) {
+			break;
+		}
+		cur->entry_off += n;
+		cur->offset += n;
+		done += n;
+	}
+	k_mutex_unlock(&flash_lock);
+
+	return err ? err : done;
+}
+
+/* Log offsets of the oldest segment and of the end, for punch_log_seek() */
+void punch_log_range(uint32_t *start, uint32_t *end)
+{
+	k_mutex_lock(&flash_lock, K_FOREVER);
+	*start = log_start;
+	*end = log_end;
+	k_mutex_unlock(&flash_lock);
+}
+
+void punch_log_stats_get(struct punch_log_stats *out)
+{
+	k_spinlock_key_t key = k_spin_lock(&log_lock);
+
+	*out = stats;
+	out->pending = batches[0].count + batches[1].count;
+
+	k_spin_unlock(&log_lock, key);
+}
+
+static void init_work_handler(struct k_work *work)
+{
+	uint32_t sector_cnt = ARRAY_SIZE(log_sectors);
+	struct punch_log_record rec;
+	struct fcb_entry loc = { 0 };
+	struct punch_log_segment seg;
+	int err;
+
+	err = flash_area_get_sectors(PUNCH_LOG_AREA_ID, &sector_cnt, log_sectors);
+	if (err) {
+		LOG_ERR("No sectors for the punch log (err %d)", err);
+		return;
+	}
+
+	log_fcb.f_magic = PUNCH_LOG_MAGIC;
+	log_fcb.f_version = PUNCH_LOG_VERSION;
+	log_fcb.f_sector_cnt = sector_cnt;
+	log_fcb.f_sectors = log_sectors;
+
+	err = fcb_init(PUNCH_LOG_AREA_ID, &log_fcb);
+	if (err == -ENOMSG) {
+		/* Area holds something else or an older log format */
+		LOG_WRN("Erasing the storage partition for the punch log");
+		err = flash_area_erase(log_fcb.fap, 0, log_fcb.fap->fa_size);
+		if (err == 0) {
+			err = fcb_init(PUNCH_LOG_AREA_ID, &log_fcb);
+		}
+	}
+	if (err) {
+		LOG_ERR("Punch log init failed (err %d)", err);
+		return;
+	}
+
+	/* Offsets continue from the newest segment */
+	k_mutex_lock(&flash_lock, K_FOREVER);
+	log_start_update();
+	log_end = log_start;
+	while (fcb_getnext(&log_fcb, &loc) == 0) {
+		if (segment_header_read(&loc, &seg) == 0) {
+			log_end = seg.start + loc.fe_data_len;
+		}
+	}
+	k_mutex_unlock(&flash_lock);
+
+	LOG_INF("Punch log in %u sectors of %u bytes, offsets %u to %u", sector_cnt,
+		log_sectors[0].fs_size, log_start, log_end);
+	log_ready = true;
+
+	record_fill(&rec, PUNCH_LOG_BOOT, NULL);
+	record_add(&rec);
+	/* Records that came in while the area was being mounted */
+	commit_work_handler(NULL);
+}
+
+#if defined(CONFIG_SHELL)
+static bool print_record(const struct punch_log_record *rec, void *user_data)
+{
+	const struct shell *sh = user_data;
+
+	switch (rec->type) {
+	case PUNCH_LOG_BOOT:
+		shell_print(sh, "%10u boot", rec->uptime_ms);
+		break;
+	case PUNCH_LOG_PUNCH:
+		shell_print(sh, "%10u punch SIAC %u seq %u control %u at %02u:%02u:%02u",
+			    rec->uptime_ms, rec->siac_id, rec->seq, rec->siac_data[1],
+			    rec->siac_data[2], rec->siac_data[3], rec->siac_data[4]);
+		break;
+	case PUNCH_LOG_ANNOUNCEMENT:
+		shell_print(sh, "%10u announced SIAC %u seq %u control %u: %d",
+			    rec->uptime_ms, rec->siac_id, rec->seq, rec->siac_data[1], rec->result);
+		break;
+	default:
+		shell_print(sh, "%10u type %u", rec->uptime_ms, rec->type);
+		break;
+	}
+
+	return true;
+}
+
+static int cmd_punchlog_dump(const struct shell *sh, size_t argc, char **argv)
+{
+	int err;
+
+	punch_log_flush();
+	err = punch_log_walk(print_record, (void *)sh);
+	if (err) {
+		shell_error(sh, "Walk failed (err %d)", err);
+	}
+
+	return err;
+}
+
+static int cmd_punchlog_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct punch_log_stats s;
+
+	punch_log_stats_get(&s);
+	shell_print(sh, "records %u, pending %u, dropped %u", s.records, s.pending, s.dropped);
+	shell_print(sh, "batches %u, bytes %u, stored %u, rotations %u, errors %u", s.batches,
+		    s.bytes, s.stored, s.rotations, s.errors);
+
+	return 0;
+}
+
+static int cmd_punchlog_flush(const struct shell *sh, size_t argc, char **argv)
+{
+	punch_log_flush();
+	shell_print(sh, "Punch log flushed");
+
+	return 0;
+}
+
+static int cmd_punchlog_erase(const struct shell *sh, size_t argc, char **argv)
+{
+	int err;
+
+	if (!log_ready) {
+		return -EAGAIN;
+	}
+
+	k_mutex_lock(&flash_lock, K_FOREVER);
+	err = fcb_clear(&log_fcb);
+	/* Downloads of the erased data fail with -ERANGE */
+	log_start = log_end;
+	k_mutex_unlock(&flash_lock);
+
+	if (err) {
+		shell_error(sh, "Erase failed (err %d)", err);
+	} else {
+		shell_print(sh, "Punch log erased");
+	}
+
+	return err;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(punchlog_cmds,
+	SHELL_CMD(dump, NULL, "Print every record in flash, oldest first", cmd_punchlog_dump),
+	SHELL_CMD(stats, NULL, "Record, batch and flash counters", cmd_punchlog_stats),
+	SHELL_CMD(flush, NULL, "Write the records still in RAM", cmd_punchlog_flush),
+	SHELL_CMD(erase, NULL, "Erase the log", cmd_punchlog_erase),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(punchlog, &punchlog_cmds, "Punch log in flash", NULL);
+#endif /* CONFIG_SHELL */
+
+static int punch_log_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+
+	/* Lowest application priority, flash writes never delay the audio or Bluetooth threads */
+	k_work_queue_start(&log_work_q, log_stack, K_THREAD_STACK_SIZEOF(log_stack),
+			   K_LOWEST_APPLICATION_THREAD_PRIO, NULL);
+	k_thread_name_set(&log_work_q.thread, "punch_log");
+
+	/* Mounting reads the whole area, done on the work queue so boot does not wait */
+	k_work_submit_to_queue(&log_work_q, &init_work);
+
+	return 0;
+}
+
+SYS_INIT(punch_log_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
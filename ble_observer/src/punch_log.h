@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef PUNCH_LOG_H_
+#define PUNCH_LOG_H_
+
+#include <zephyr.h>
+#include <fs/fcb.h>
+#include "audio.h"
+
+enum punch_log_type {
+	PUNCH_LOG_BOOT,			/* first record after a reset */
+	PUNCH_LOG_PUNCH,		/* punch decoded from an advertisement */
+	PUNCH_LOG_ANNOUNCEMENT,		/* announcement outcome of a punch */
+};
+
+/* One record of the log, stored as is in flash */
+struct punch_log_record {
+	uint32_t uptime_ms;
+	uint32_t siac_id;
+	uint32_t seq;
+	uint8_t type;			/* enum punch_log_type */
+	int8_t result;			/* announcement: 0 or a negative errno */
+	uint8_t siac_data[SIAC_DATA_LEN];
+	uint8_t reserved[3];
+} __packed;
+
+BUILD_ASSERT(sizeof(struct punch_log_record) == 24, "punch log record layout changed");
+
+#define PUNCH_LOG_SEGMENT_RAW	0
+#define PUNCH_LOG_SEGMENT_LZ4	1
+
+/* One FCB entry, a batch of records as written. The log offsets used by
+ * the download count these segments, header included, from the first
+ * segment ever written. They do not move when the oldest sector is
+ * erased.
+ */
+struct punch_log_segment {
+	uint8_t format;			/* PUNCH_LOG_SEGMENT_* */
+	uint8_t records;		/* records in the segment */
+	uint16_t len;			/* bytes of data following the header */
+	uint32_t start;			/* log offset of this segment */
+	uint8_t data[];			/* LZ4 block or the records as they are */
+} __packed;
+
+struct punch_log_stats {
+	uint32_t records;		/* records accepted into the RAM batches */
+	uint32_t dropped;		/* records lost because both batches were full */
+	uint32_t batches;		/* batches committed to flash */
+	uint32_t bytes;			/* record bytes committed to flash */
+	uint32_t stored;		/* segment bytes written, after compression */
+	uint32_t rotations;		/* oldest sector erased to make room */
+	uint32_t errors;		/* failed commits */
+	uint32_t pending;		/* records still in RAM */
+};
+
+/* Read position in the log, see punch_log_seek() */
+struct punch_log_cursor {
+	struct fcb_entry loc;		/* entry being read, fe_sector NULL before the first */
+	uint32_t entry_off;		/* bytes of loc already read */
+	uint32_t offset;		/* log offset of the cursor */
+};
+
+/* Called for every record in the log, oldest first. Return false to stop. */
+typedef bool (*punch_log_cb)(const struct punch_log_record *rec, void *user_data);
+
+#if defined(CONFIG_SI_VOICE_PUNCH_LOG)
+
+void punch_log_punch(const struct si_punch *punch);
+void punch_log_announcement(const struct si_punch *punch, int result);
+void punch_log_flush(void);
+int punch_log_walk(punch_log_cb cb, void *user_data);
+int punch_log_seek(struct punch_log_cursor *cur, uint32_t offset);
+int punch_log_read(struct punch_log_cursor *cur, void *buf, size_t len);
+void punch_log_range(uint32_t *start, uint32_t *end);
+void punch_log_stats_get(struct punch_log_stats *stats);
+
+#else
+
+static inline void punch_log_punch(const struct si_punch *punch) {}
+static inline void punch_log_announcement(const struct si_punch *punch, int result) {}
+
+#endif /* CONFIG_SI_VOICE_PUNCH_LOG */
+
+#endif /* PUNCH_LOG_H_ */
@@ -0,0 +1,1009 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include <zephyr.h>
+#include <logging/log.h>
+#include <device.h>
+#include <devicetree.h>
+#include <drivers/gpio.h>
+#include <drivers/spi.h>
+#include <shell/shell.h>
+#include "isc_msgs.h"
+#include "s1v3g340.h"
+#include "trace.h"
+#include "energy.h"
+#if defined(CONFIG_S1V3G340_EMUL)
+#include "s1v3g340_emul.h"
+#endif
+
+#if defined(CONFIG_ARCH_POSIX)
+/* native_posix and nrf52_bsim have no GPIO peripheral, the speech IC control pins are not driven */
+#define NRF_GPIO_PIN_MAP(port, pin)	(((port) << 5) | ((pin) & 0x1F))
+#define nrf_gpio_cfg_output(pin)
+#define nrf_gpio_pin_set(pin)
+#define nrf_gpio_pin_clear(pin)
+#else
+#include <hal/nrf_gpio.h>
+#endif
+
+LOG_MODULE_REGISTER(s1v3g340, CONFIG_SI_VOICE_LOG_LEVEL);
+
+// GPIO Control Pins for the EPSON speech IC
+#if defined(CONFIG_SOC_NRF5340_CPUAPP)
+/* P0.13 to P0.18 carry the QSPI flash on the nRF5340 DK, use Arduino D2 to D4 */
+#define H_RESET_PIN		NRF_GPIO_PIN_MAP(1, 4)
+#define H_MUTE_PIN		NRF_GPIO_PIN_MAP(1, 5)
+#define H_STBEXT_PIN	NRF_GPIO_PIN_MAP(1, 6)
+#else
+#define H_RESET_PIN		NRF_GPIO_PIN_MAP(0, 14)
+#define H_MUTE_PIN		NRF_GPIO_PIN_MAP(0, 15)
+#define H_STBEXT_PIN	NRF_GPIO_PIN_MAP(0, 16)
+#endif
+
+/* "t1", from the release of H_RESET to the first SPI message */
+#define RESET_WAIT_MS			120
+
+/* Interval between two reads of the speech IC while waiting for ISC_SEQUENCER_STATUS_IND */
+#define STATUS_POLL_INTERVAL_MS		5
+/* Dummy bytes clocked per read while waiting for a response, a whole
+ * ISC_VERSION_RESP with its checksum fits
+ */
+#define RESPONSE_READ_LEN		24
+/* Reads spent waiting for the response to a request, 1 ms apart */
+#define RESPONSE_READS			20
+/* Longest response frame collected, from the length field */
+#define RESPONSE_MAX_LEN		32
+
+/* Time a transfer may take on top of its bytes at the SPI clock before
+ * it is given up
+ */
+#define SPI_TRANSFER_MARGIN_MS		5
+/* Wait before the first retry of a failed exchange, doubled for each
+ * further one, so a busy sequencer has time to finish
+ */
+#define ISC_RETRY_DELAY_MS		10
+
+/* Good messages that make up for one checksum failure, the clock drops
+ * when the link corrupts more than about one message in this many
+ */
+#define LINK_GOOD_PER_ERROR		8
+
+/* SPI clocks from CONFIG_S1V3G340_SPI_FREQUENCY down to
+ * CONFIG_S1V3G340_SPI_MIN_FREQUENCY, each half the one before
+ */
+#define SPI_CLOCKS_MAX			8
+
+#define MY_SPI_MASTER DT_NODELABEL(my_spi_master)
+#define MY_SPI_MASTER_DEV DT_NODELABEL(reg_my_spi_master)
+
+// SPI master functionality
+const struct device *spi_dev;
+#if defined(CONFIG_SPI_ASYNC)
+static struct k_poll_signal spi_done_sig = K_POLL_SIGNAL_INITIALIZER(spi_done_sig);
+#endif
+
+#if DT_SPI_DEV_HAS_CS_GPIOS(MY_SPI_MASTER_DEV)
+struct spi_cs_control spim_cs = {
+	.gpio = SPI_CS_GPIOS_DT_SPEC_GET(MY_SPI_MASTER_DEV),
+	.delay = 0,
+};
+#define SPIM_CS (&spim_cs)
+#else
+/* Chip select is handled by the SPI controller, e.g. the SPI emulator */
+#define SPIM_CS NULL
+#endif
+
+uint8_t tx_buffer[70];		/* Note: Transmit buffer size should be large enough to send the entire SPI message. SPI message length increases with the number of phrases to be played. Each new phrase will approximately add 8 bytes to the total message length.*/
+uint8_t rx_buffer[70];		/* Full duplex, a response can start anywhere in a transfer */
+
+BUILD_ASSERT(ISC_SEQUENCER_CONFIG_REQ_SIZE(S1V3G340_MAX_PHRASES) + ISC_CHECKSUM_LEN <=
+	     sizeof(tx_buffer), "tx_buffer too small for S1V3G340_MAX_PHRASES");
+BUILD_ASSERT(RESPONSE_READ_LEN <= sizeof(rx_buffer), "rx_buffer shorter than a response read");
+
+/* The SPI drivers only reconfigure when handed a different struct
+ * spi_config, so every clock has its own.
+ */
+static struct spi_config spi_cfgs[SPI_CLOCKS_MAX];
+static int spi_clock_count;
+static int spi_clock;		/* index into spi_cfgs of the clock in use */
+#if defined(CONFIG_SPI_ASYNC)
+/* Set when a transfer missed its deadline. The SPI driver keeps the bus
+ * locked until the transfer completes, so no new one is started before
+ * its done signal has been raised.
+ */
+static bool spi_hung;
+#endif
+
+/* Clocked out while reading responses, the transmit buffer keeps the
+ * request for a retry
+ */
+static const uint8_t dummy_tx[RESPONSE_READ_LEN];
+
+/* Uptime in ms at which the speech IC takes SPI messages after H_RESET */
+static int64_t reset_done_at;
+
+/* Set once ISC_TEST_REQ has enabled checksums, cleared by ISC_RESET_REQ */
+static bool isc_checksum;
+/* Checksum failures, one up per failure and one down per
+ * LINK_GOOD_PER_ERROR good messages, on either direction
+ */
+static int link_errors;
+static int link_good;
+static struct s1v3g340_link_stats link_stats;
+
+/* Response frame collected from MISO, it may span transfers */
+static struct {
+	uint8_t frame[RESPONSE_MAX_LEN + ISC_CHECKSUM_LEN];	/* from the length field */
+	uint16_t len;
+	uint16_t pos;
+	bool in_frame;
+} isc_rx;
+
+///////////////////////////////////////////////////////////////////////
+//  function: GPIO_ControlStandby
+//
+//  description:
+//    STAND-BY control for Device STBY(Stand-by) High/Low control
+//
+//  argument:
+//    iValue    Signal value High:1  Low:0
+///////////////////////////////////////////////////////////////////////
+void GPIO_ControlStandby(int iValue)
+{
+  if (iValue==1)
+  {
+    // Write 1 to P0.16 - H_STBEXIT pin
+	nrf_gpio_pin_set(H_STBEXT_PIN);
+#if defined(CONFIG_S1V3G340_EMUL)
+	s1v3g340_emul_standby_exit();
+#endif
+  }
+  else
+  {
+    // Write 0 to P0.16 - H_STBEXIT pin
+	nrf_gpio_pin_clear(H_STBEXT_PIN);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: GPIO_ControlMute
+//
+//  description:
+//    MUTE control for Device MUTE control
+//
+//  argument:
+//    iValue    Signal value Mute  enable:1  disable:0
+///////////////////////////////////////////////////////////////////////
+void GPIO_ControlMute(int iValue)
+{
+  if (iValue)
+  {
+    // Write 1 to P0.15 - H_MUTE pin
+	nrf_gpio_pin_set(H_MUTE_PIN);
+	energy_on(ENERGY_RAIL_AMP);
+  }
+  else
+  {
+    // Write 0 to P0.15 - H_MUTE pin
+	nrf_gpio_pin_clear(H_MUTE_PIN);
+	energy_off(ENERGY_RAIL_AMP);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: GPIO_S1V3G340_Reset
+//
+//  description:
+//    RESET control for Device reset control
+//
+//  argument:
+//    iValue    Signal value High:1  Low:0
+///////////////////////////////////////////////////////////////////////
+void GPIO_S1V3G340_Reset(int iValue)
+{
+  if (iValue)
+  {
+    // Write 1 to P0.14 - H_RESET pin
+	nrf_gpio_pin_set(H_RESET_PIN);
+	energy_on(ENERGY_RAIL_IC_AWAKE);
+  }
+  else
+  {
+    // Write 0 to P0.14 - H_RESET pin
+	nrf_gpio_pin_clear(H_RESET_PIN);
+	energy_off(ENERGY_RAIL_IC_AWAKE);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Hardware_Reset_Start
+//
+//  description:
+//    Configures the speech IC control pins and runs the power-on
+//    reset sequence. Returns without the "t1" wait, so the caller can
+//    do other work until S1V3G340_Hardware_Reset_Wait().
+///////////////////////////////////////////////////////////////////////
+void S1V3G340_Hardware_Reset_Start(void)
+{
+	//EPSON S1V3G340 Control pins config
+	nrf_gpio_cfg_output(H_RESET_PIN);
+	nrf_gpio_cfg_output(H_MUTE_PIN);
+	nrf_gpio_cfg_output(H_STBEXT_PIN);
+
+	GPIO_S1V3G340_Reset(0);
+	GPIO_ControlStandby(0);		// Set stanby signal(STBYEXIT) to Low(deassert)
+	GPIO_ControlMute(0);        // Set mute signal(MUTE) to Low(enable)
+	GPIO_S1V3G340_Reset(1);
+	GPIO_ControlMute(1);        // Set mute signal(MUTE) to High(disable)
+#if defined(CONFIG_S1V3G340_EMUL)
+	s1v3g340_emul_hw_reset();
+#endif
+	reset_done_at = k_uptime_get() + RESET_WAIT_MS;
+
+	/* The speech IC comes out of reset without checksums */
+	isc_checksum = false;
+	isc_rx.in_frame = false;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Hardware_Reset_Wait
+//
+//  description:
+//    Sleeps for what is left of the "t1" wait of 120 ms after
+//    S1V3G340_Hardware_Reset_Start().
+///////////////////////////////////////////////////////////////////////
+void S1V3G340_Hardware_Reset_Wait(void)
+{
+	int64_t left = reset_done_at - k_uptime_get();
+
+	if (left > 0) {
+		k_msleep(left);
+	}
+}
+
+void S1V3G340_Hardware_Reset(void)
+{
+	S1V3G340_Hardware_Reset_Start();
+	S1V3G340_Hardware_Reset_Wait();
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: clearTxBuffer
+//
+//  description:
+//    Zeroes the transmit buffer. The whole buffer is clocked out on
+//    every transfer, so the bytes after the encoded message must be 0.
+///////////////////////////////////////////////////////////////////////
+static void clearTxBuffer(void)
+{
+	memset(tx_buffer, 0, sizeof(tx_buffer));
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Transfer
+//
+//  description:
+//    Clocks len bytes out to the speech IC and sleeps until the
+//    transfer has completed, for at most the time the bytes take at the
+//    SPI clock plus SPI_TRANSFER_MARGIN_MS. What the IC sent back is
+//    left in rx_buffer.
+//
+//  argument:
+//    tx_data: bytes to send, tx_buffer or dummy_tx
+//    len: number of bytes
+//
+//  return:
+//    0, -ETIMEDOUT when the transfer missed its deadline, -EIO while
+//    the SPI driver still holds a transfer that missed its deadline,
+//    -ENODEV when S1V3G340_Spi_Init() has not succeeded
+///////////////////////////////////////////////////////////////////////
+static int S1V3G340_Transfer(const uint8_t *tx_data, size_t len)
+{
+	const struct spi_config *cfg = &spi_cfgs[spi_clock];
+	const struct spi_buf tx_buf = {
+		.buf = (uint8_t *)tx_data,
+		.len = len,
+	};
+	const struct spi_buf rx_buf = {
+		.buf = rx_buffer,
+		.len = len,
+	};
+	const struct spi_buf_set tx = {
+		.buffers = &tx_buf,
+		.count = 1,
+	};
+	const struct spi_buf_set rx = {
+		.buffers = &rx_buf,
+		.count = 1,
+	};
+
+	/* The clocks are set up once the SPI master is ready */
+	if (spi_clock_count == 0) {
+		return -ENODEV;
+	}
+
+#if defined(CONFIG_SPI_ASYNC)
+	struct k_poll_event spi_done_evt = K_POLL_EVENT_INITIALIZER(K_POLL_TYPE_SIGNAL,
+								    K_POLL_MODE_NOTIFY_ONLY,
+								    &spi_done_sig);
+	int spi_signaled, spi_result;
+	uint32_t timeout_ms = SPI_TRANSFER_MARGIN_MS +
+			      DIV_ROUND_UP(len * 8U * MSEC_PER_SEC, cfg->frequency);
+
+	if (spi_hung) {
+		k_poll_signal_check(&spi_done_sig, &spi_signaled, &spi_result);
+		if (!spi_signaled) {
+			return -EIO;
+		}
+		spi_hung = false;
+	}
+
+	// Reset signal
+	k_poll_signal_reset(&spi_done_sig);
+	// Start transaction
+	int error = spi_transceive_async(spi_dev, cfg, &tx, &rx, &spi_done_sig);
+	if(error != 0){
+		LOG_ERR("SPI transceive error: %i", error);
+		return error;
+	}
+	// Wait for the done signal to be raised
+	if (k_poll(&spi_done_evt, 1, K_MSEC(timeout_ms)) != 0) {
+		LOG_ERR("SPI transfer of %u bytes not done in %u ms", (unsigned int)len, timeout_ms);
+		link_stats.spi_timeouts++;
+		spi_hung = true;
+		return -ETIMEDOUT;
+	}
+	k_poll_signal_check(&spi_done_sig, &spi_signaled, &spi_result);
+
+	return spi_result;
+#else
+	/* e.g. the SPI emulator, which has no asynchronous API */
+	return spi_transceive(spi_dev, cfg, &tx, &rx);
+#endif
+}
+
+static int S1V3G340_Transceive(const uint8_t *tx_data, size_t len)
+{
+	energy_on(ENERGY_RAIL_SPI);
+	int error = S1V3G340_Transfer(tx_data, len);
+	energy_off(ENERGY_RAIL_SPI);
+
+	return error;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: link_error
+//
+//  description:
+//    Counts a checksum failure. When the count reaches
+//    CONFIG_S1V3G340_SPI_FALLBACK_ERRORS the SPI clock drops to the next
+//    lower step, the caller re-initializes the speech IC at the new
+//    clock.
+///////////////////////////////////////////////////////////////////////
+static void link_error(void)
+{
+	link_stats.checksum_errors++;
+	if (++link_errors < CONFIG_S1V3G340_SPI_FALLBACK_ERRORS) {
+		return;
+	}
+	link_errors = 0;
+	link_good = 0;
+	if (spi_clock + 1 < spi_clock_count) {
+		spi_clock++;
+		link_stats.fallbacks++;
+		LOG_WRN("ISC checksum failures, SPI clock lowered to %u Hz",
+			spi_cfgs[spi_clock].frequency);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: isc_result
+//
+//  description:
+//    Result code of a response frame, the first two payload bytes of
+//    every response but ISC_VERSION_RESP, ISC_RESET_RESP and
+//    ISC_SEQUENCER_STATUS_IND.
+///////////////////////////////////////////////////////////////////////
+static uint16_t isc_result(uint16_t msg_id)
+{
+	if (isc_rx.len - (isc_checksum ? ISC_CHECKSUM_LEN : 0) < 6 ||
+	    msg_id == ID_ISC_VERSION_RESP || msg_id == ID_ISC_SEQUENCER_STATUS_IND) {
+		return 0;
+	}
+
+	return isc_rx.frame[4] | (isc_rx.frame[5] << 8);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: isc_rx_feed
+//
+//  description:
+//    Runs the bytes of the last transfer through the response parser.
+//    Idle bytes between frames are skipped, a frame cut off at the end
+//    of the transfer is completed by the next one. With checksums on,
+//    frames with a bad checksum are counted and dropped. ISC_ERROR_IND,
+//    ISC_MSG_BLOCKED_RESP and a response with a non-zero result code
+//    fail the request.
+//
+//  argument:
+//    len: bytes received in rx_buffer
+//    want_id: message ID of the response waited for
+//
+//  return:
+//    1 when a frame with want_id and a zero result has been received,
+//    -EBUSY on ISC_MSG_BLOCKED_RESP, -EIO on any other failure, 0
+//    otherwise
+///////////////////////////////////////////////////////////////////////
+static int isc_rx_feed(size_t len, uint16_t want_id)
+{
+	int found = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t byte = rx_buffer[i];
+
+		if (!isc_rx.in_frame) {
+			if (byte == ID_START) {
+				isc_rx.in_frame = true;
+				isc_rx.pos = 0;
+				isc_rx.len = 0;
+			}
+			continue;
+		}
+
+		isc_rx.frame[isc_rx.pos++] = byte;
+		if (isc_rx.pos == 2) {
+			isc_rx.len = (isc_rx.frame[0] | (isc_rx.frame[1] << 8)) +
+				     (isc_checksum ? ISC_CHECKSUM_LEN : 0);
+			if (isc_rx.len < 4 || isc_rx.len > sizeof(isc_rx.frame)) {
+				/* Not a frame, the start byte was noise */
+				isc_rx.in_frame = false;
+			}
+			continue;
+		}
+		if (isc_rx.pos < 2 || isc_rx.pos < isc_rx.len) {
+			continue;
+		}
+
+		/* Frame complete */
+		uint16_t msg_id = isc_rx.frame[2] | (isc_rx.frame[3] << 8);
+
+		isc_rx.in_frame = false;
+		if (isc_checksum && IscChecksum(isc_rx.frame, isc_rx.len) != 0) {
+			LOG_HEXDUMP_DBG(isc_rx.frame, isc_rx.len, "ISC rx bad checksum");
+			link_error();
+			found = (found == 1) ? 1 : -EIO;
+			continue;
+		}
+		LOG_HEXDUMP_DBG(isc_rx.frame, isc_rx.len, "ISC rx");
+		if (isc_checksum) {
+			if (msg_id == ID_ISC_ERROR_IND) {
+				/* The speech IC found a bad checksum in a request */
+				link_error();
+			} else if (link_errors > 0 && ++link_good == LINK_GOOD_PER_ERROR) {
+				link_errors--;
+				link_good = 0;
+			}
+		}
+		if (found == 1) {
+			continue;
+		}
+		if (msg_id == ID_ISC_ERROR_IND) {
+			LOG_WRN("ISC_ERROR_IND 0x%04x waiting for 0x%04x",
+				isc_result(msg_id), want_id);
+			link_stats.error_inds++;
+			found = -EIO;
+		} else if (msg_id == ID_ISC_MSG_BLOCKED_RESP) {
+			LOG_WRN("Speech IC blocked message 0x%04x", isc_result(msg_id));
+			link_stats.blocked++;
+			found = -EBUSY;
+		} else if (msg_id == want_id) {
+			uint16_t result = isc_result(msg_id);
+
+			if (result != 0) {
+				LOG_WRN("Response 0x%04x with result 0x%04x", msg_id, result);
+				link_stats.error_inds++;
+				found = -EIO;
+			} else {
+				found = 1;
+			}
+		}
+	}
+
+	return found;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: isc_frame
+//
+//  description:
+//    Completes the request encoded in the transmit buffer with its
+//    checksum when checksums are on.
+//
+//  argument:
+//    msgLen: length of the encoded request, negative if it did not fit
+//
+//  return:
+//    length of the request to send, -EINVAL if it does not fit
+///////////////////////////////////////////////////////////////////////
+static int isc_frame(int msgLen)
+{
+	if (msgLen < 0) {
+		return -EINVAL;
+	}
+	if (isc_checksum) {
+		msgLen = IscAppendChecksum(tx_buffer, sizeof(tx_buffer), msgLen);
+		if (msgLen < 0) {
+			return -EINVAL;
+		}
+	}
+
+	return msgLen;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: isc_send
+//
+//  description:
+//    Sends the request in the transmit buffer. Anything the speech IC
+//    sends meanwhile goes through the response parser.
+//
+//  argument:
+//    len: length of the request from isc_frame()
+//    want_id: message ID of the response to the request
+//
+//  return:
+//    1 when the response already came back, 0 or a negative error code
+///////////////////////////////////////////////////////////////////////
+static int isc_send(int len, uint16_t want_id)
+{
+	int error;
+
+	LOG_HEXDUMP_DBG(tx_buffer, len, "ISC tx");
+
+	error = S1V3G340_Transceive(tx_buffer, len);
+	if (error != 0) {
+		return error;
+	}
+	if (want_id == ID_ISC_SEQUENCER_CONFIG_RESP) {
+		trace_point(TRACE_SPI_CONFIG_END);
+	}
+	link_stats.requests++;
+
+	return isc_rx_feed(len, want_id);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: isc_response
+//
+//  description:
+//    Clocks dummy bytes until the response to the last request has
+//    been received, for at most RESPONSE_READS reads.
+//
+//  argument:
+//    sent: return value of isc_send()
+//    want_id: message ID of the response
+//
+//  return:
+//    0, -EIO or -EBUSY from isc_rx_feed(), -ETIMEDOUT when no response
+//    came
+///////////////////////////////////////////////////////////////////////
+static int isc_response(int sent, uint16_t want_id)
+{
+	int found = sent;
+	int error;
+
+	if (found < 0) {
+		return found;
+	}
+
+	for (int i = 0; found == 0 && i < RESPONSE_READS; i++) {
+		if (i > 0) {
+			k_msleep(1);
+		}
+		error = S1V3G340_Transceive(dummy_tx, RESPONSE_READ_LEN);
+		if (error != 0) {
+			return error;
+		}
+		found = isc_rx_feed(RESPONSE_READ_LEN, want_id);
+	}
+
+	if (found == 0) {
+		LOG_WRN("No response 0x%04x from the speech IC", want_id);
+		link_stats.response_timeouts++;
+		return -ETIMEDOUT;
+	}
+
+	return (found == 1) ? 0 : found;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: isc_exchange
+//
+//  description:
+//    Sends a request and waits for its response, retrying up to
+//    CONFIG_S1V3G340_ISC_RETRIES times when it fails. Every attempt is
+//    bounded by the SPI transfer deadlines and RESPONSE_READS, so the
+//    whole exchange is too.
+//
+//  argument:
+//    len: length of the request from isc_frame()
+//    want_id: message ID of the response
+//
+//  return:
+//    0 or the error of the last attempt
+///////////////////////////////////////////////////////////////////////
+static int isc_exchange(int len, uint16_t want_id)
+{
+	uint32_t start = k_cycle_get_32();
+	uint32_t elapsed_us;
+	int error;
+
+	if (len < 0) {
+		return len;
+	}
+
+	for (int attempt = 0; ; attempt++) {
+		error = isc_response(isc_send(len, want_id), want_id);
+		if (error == 0 || attempt == CONFIG_S1V3G340_ISC_RETRIES) {
+			break;
+		}
+		LOG_WRN("ISC request for 0x%04x failed (err %d), retrying", want_id, error);
+		link_stats.retries++;
+		k_msleep(ISC_RETRY_DELAY_MS << attempt);
+		/* Start the response parser clean, a frame may have been cut off */
+		isc_rx.in_frame = false;
+	}
+
+	elapsed_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+	link_stats.worst_exchange_us = MAX(link_stats.worst_exchange_us, elapsed_us);
+
+	return error;
+}
+
+static int isc_request(int msgLen, uint16_t want_id)
+{
+	return isc_exchange(isc_frame(msgLen), want_id);
+}
+
+int S1V3G340_Spi_Init(void)
+{
+	spi_dev = DEVICE_DT_GET(MY_SPI_MASTER);
+	if(!device_is_ready(spi_dev)) {
+		LOG_ERR("SPI master device not ready");
+		return -ENODEV;
+	}
+#if DT_SPI_DEV_HAS_CS_GPIOS(MY_SPI_MASTER_DEV)
+	if(!device_is_ready(spim_cs.gpio.port)){
+		LOG_ERR("SPI master chip select device not ready");
+		return -ENODEV;
+	}
+#endif
+
+	/* EasyDMA SPIM, starting at the fastest clock */
+	spi_clock_count = 0;
+	for (uint32_t freq = CONFIG_S1V3G340_SPI_FREQUENCY;
+	     freq >= CONFIG_S1V3G340_SPI_MIN_FREQUENCY && spi_clock_count < SPI_CLOCKS_MAX;
+	     freq /= 2) {
+		spi_cfgs[spi_clock_count++] = (struct spi_config) {
+			.operation = SPI_WORD_SET(8) | SPI_TRANSFER_MSB |
+				     SPI_MODE_CPOL | SPI_MODE_CPHA,
+			.frequency = freq,
+			.slave = 0,
+			.cs = SPIM_CS,
+		};
+	}
+	spi_clock = 0;
+	LOG_INF("SPI master at %u Hz, ISC checksums %s", spi_cfgs[0].frequency,
+		IS_ENABLED(CONFIG_S1V3G340_ISC_CHECKSUM) ? "on" : "off");
+
+	return 0;
+}
+
+int S1V3G340_Initialize_Audio_Config(void) {
+
+	int len;
+	int error;
+
+	/***************************Reset speech IC***************************/
+	// send ISC_RESET_REQ, with a checksum if they were on, the response
+	// comes without
+	clearTxBuffer();
+	len = isc_frame(IscEncodeResetReq(tx_buffer, sizeof(tx_buffer)));
+	isc_checksum = false;
+	isc_rx.in_frame = false;
+	error = isc_exchange(len, ID_ISC_RESET_RESP);
+	if(error != 0){
+		return error;
+	}
+
+	/***************************Registry key-code***************************/
+	// send ISC_TEST_REQ, checksums apply from the next message on
+	clearTxBuffer();
+	error = isc_request(IscEncodeTestReq(tx_buffer, sizeof(tx_buffer),
+					     IS_ENABLED(CONFIG_S1V3G340_ISC_CHECKSUM)),
+			    ID_ISC_TEST_RESP);
+	if(error != 0){
+		return error;
+	}
+	isc_checksum = IS_ENABLED(CONFIG_S1V3G340_ISC_CHECKSUM);
+
+	/***************************Get version info.***************************/
+	// send ISC_VERSION_REQ
+	clearTxBuffer();
+	error = isc_request(IscEncodeVersionReq(tx_buffer, sizeof(tx_buffer)),
+			    ID_ISC_VERSION_RESP);
+	if(error != 0){
+		return error;
+	}
+
+	/***********************Set volume & sampling freq.***********************/
+	// send ISC_AUDIO_CONFIG_REQ
+	clearTxBuffer();
+	error = isc_request(IscEncodeAudioConfigReq(tx_buffer, sizeof(tx_buffer),
+						    INIT_AUDIO_VOLUME),
+			    ID_ISC_AUDIO_CONFIG_RESP);
+	if(error != 0){
+		return error;
+	}
+
+	LOG_INF("Speech IC initialized, SPI at %u Hz", spi_cfgs[spi_clock].frequency);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Play_Phrases
+//
+//  description:
+//    Configures the sequencer with the given phrases and starts the
+//    playback. Returns as soon as the speech IC has accepted
+//    ISC_SEQUENCER_START_REQ; ISC_SEQUENCER_STATUS_IND is notified
+//    when the playback has finished.
+//
+//  argument:
+//    phrases: phrase codes stored on the speech IC
+//    count: number of phrases, at most S1V3G340_MAX_PHRASES
+///////////////////////////////////////////////////////////////////////
+int S1V3G340_Play_Phrases(const uint16_t phrases[], int count) {
+
+	if (count <= 0 || count > S1V3G340_MAX_PHRASES) {
+		return -EINVAL;
+	}
+
+	LOG_DBG("Playing %d phrases", count);
+
+	/***************************Sequencer configuration***************************/
+	// send ISC_SEQUENCER_CONFIG_REQ
+	clearTxBuffer();
+	int msgLen = IscEncodeSequencerConfigReq(tx_buffer, sizeof(tx_buffer), phrases, count);
+
+	trace_point(TRACE_SPI_CONFIG_START);
+	int error = isc_request(msgLen, ID_ISC_SEQUENCER_CONFIG_RESP);
+	if(error != 0){
+		return error;
+	}
+
+	/***************************Start sequencer playback***************************/
+	// send ISC_SEQUENCER_START_REQ with notification 1 (enable): the
+	// speech IC sends ISC_SEQUENCER_STATUS_IND when the sequence ends,
+	// which S1V3G340_Wait_Playback_Done() waits for. With 0 (disable),
+	// as before the playback was waited for, it sends none.
+	clearTxBuffer();
+	error = isc_request(IscEncodeSequencerStartReq(tx_buffer, sizeof(tx_buffer), 1),
+			    ID_ISC_SEQUENCER_START_RESP);
+	if(error != 0){
+		return error;
+	}
+	trace_point(TRACE_SEQUENCER_STARTED);
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Wait_Playback_Done
+//
+//  description:
+//    Reads from the speech IC until it reports ISC_SEQUENCER_STATUS_IND
+//    for the sequence started by S1V3G340_Play_Phrases().
+//
+//  argument:
+//    timeout_ms: longest time to wait for the playback to finish
+//
+//  return:
+//    0 when the playback has finished, -ETIMEDOUT otherwise
+///////////////////////////////////////////////////////////////////////
+int S1V3G340_Wait_Playback_Done(int timeout_ms)
+{
+	int64_t deadline = k_uptime_get() + timeout_ms;
+	int error;
+
+	do {
+		// clock out dummy bytes to read the indication
+		error = S1V3G340_Transceive(dummy_tx, RESPONSE_READ_LEN);
+		if(error != 0){
+			return error;
+		}
+		if (isc_rx_feed(RESPONSE_READ_LEN, ID_ISC_SEQUENCER_STATUS_IND) == 1) {
+			return 0;
+		}
+		k_msleep(STATUS_POLL_INTERVAL_MS);
+	} while (k_uptime_get() < deadline);
+
+	return -ETIMEDOUT;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Stop_Playback
+//
+//  description:
+//    Cuts the running sequence short with ISC_SEQUENCER_STOP_REQ. The
+//    sequencer then takes a new configuration straight away.
+//
+//  return:
+//    0 or the error of the request
+///////////////////////////////////////////////////////////////////////
+int S1V3G340_Stop_Playback(void)
+{
+	clearTxBuffer();
+
+	return isc_request(IscEncodeSequencerStopReq(tx_buffer, sizeof(tx_buffer)),
+			   ID_ISC_SEQUENCER_STOP_RESP);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Recover
+//
+//  description:
+//    Last step of the recovery of a speech IC that failed an exchange
+//    after its retries: pulses H_RESET and initializes the IC again.
+//    Takes the 120 ms reset wait plus at most the four bounded
+//    initialization exchanges.
+//
+//  return:
+//    0 when the speech IC is back, otherwise the error of the
+//    initialization, which is counted as a fault
+///////////////////////////////////////////////////////////////////////
+int S1V3G340_Recover(void)
+{
+	uint32_t start = k_cycle_get_32();
+	uint32_t elapsed_us;
+	int error;
+
+	LOG_WRN("Resetting the speech IC");
+	link_stats.resets++;
+
+	S1V3G340_Hardware_Reset();
+	error = S1V3G340_Initialize_Audio_Config();
+
+	elapsed_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+	link_stats.worst_recovery_us = MAX(link_stats.worst_recovery_us, elapsed_us);
+	if (error != 0) {
+		link_stats.faults++;
+		LOG_ERR("Speech IC fault, no recovery after reset (err %d)", error);
+	} else {
+		LOG_INF("Speech IC recovered in %u ms", elapsed_us / USEC_PER_MSEC);
+	}
+
+	return error;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Standby_Enter
+//
+//  description:
+//    Puts the speech IC into standby with ISC_PMAN_STANDBY_ENTRY_REQ
+//    and mutes the amplifier. The control pins keep their levels, also
+//    through System OFF of the SoC.
+//
+//  argument:
+//    state: filled with the link state S1V3G340_Standby_Exit() needs
+//
+//  return:
+//    0 or the error of the request
+///////////////////////////////////////////////////////////////////////
+int S1V3G340_Standby_Enter(struct s1v3g340_standby_state *state)
+{
+	int error;
+
+	clearTxBuffer();
+	error = isc_request(IscEncodePmanStandbyEntryReq(tx_buffer, sizeof(tx_buffer)),
+			    ID_ISC_PMAN_STANDBY_ENTRY_RESP);
+	if (error != 0) {
+		return error;
+	}
+
+	GPIO_ControlMute(0);
+	energy_off(ENERGY_RAIL_IC_AWAKE);
+	energy_on(ENERGY_RAIL_IC_STANDBY);
+
+	state->spi_clock = spi_clock;
+	state->checksum = isc_checksum;
+
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: S1V3G340_Standby_Exit
+//
+//  description:
+//    Wakes the speech IC from the standby of S1V3G340_Standby_Enter(),
+//    also after a reset of the SoC. Takes over the control pins at the
+//    levels they were left at, raises H_STBEXT and waits for
+//    ISC_PMAN_STANDBY_EXIT_IND. The IC keeps its configuration in
+//    standby, so it plays again without the reset and initialization.
+//    S1V3G340_Spi_Init() must have been called.
+//
+//  argument:
+//    state: link state from S1V3G340_Standby_Enter()
+//
+//  return:
+//    0, -ETIMEDOUT or -EIO when the IC did not come out of standby and
+//    has to be reset
+///////////////////////////////////////////////////////////////////////
+int S1V3G340_Standby_Exit(const struct s1v3g340_standby_state *state)
+{
+	int error;
+
+	/* Out of reset and muted, before the pins are driven */
+	nrf_gpio_pin_set(H_RESET_PIN);
+	nrf_gpio_pin_clear(H_MUTE_PIN);
+	nrf_gpio_pin_clear(H_STBEXT_PIN);
+	nrf_gpio_cfg_output(H_RESET_PIN);
+	nrf_gpio_cfg_output(H_MUTE_PIN);
+	nrf_gpio_cfg_output(H_STBEXT_PIN);
+
+	spi_clock = MIN(state->spi_clock, spi_clock_count - 1);
+	isc_checksum = state->checksum;
+	isc_rx.in_frame = false;
+
+	energy_on(ENERGY_RAIL_IC_STANDBY);
+	GPIO_ControlStandby(1);
+	error = isc_response(0, ID_ISC_PMAN_STANDBY_EXIT_IND);
+	GPIO_ControlStandby(0);
+	energy_off(ENERGY_RAIL_IC_STANDBY);
+	if (error != 0) {
+		LOG_WRN("Speech IC did not leave standby (err %d)", error);
+		return error;
+	}
+
+	energy_on(ENERGY_RAIL_IC_AWAKE);
+	GPIO_ControlMute(1);
+	LOG_INF("Speech IC out of standby, SPI at %u Hz", spi_cfgs[spi_clock].frequency);
+
+	return 0;
+}
+
+void S1V3G340_Link_Stats_Get(struct s1v3g340_link_stats *stats)
+{
+	*stats = link_stats;
+	stats->frequency = spi_clock_count ? spi_cfgs[spi_clock].frequency : 0;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_isc_link(const struct shell *sh, size_t argc, char **argv)
+{
+	struct s1v3g340_link_stats stats;
+
+	S1V3G340_Link_Stats_Get(&stats);
+
+	shell_print(sh, "SPI at %u Hz, ISC checksums %s", stats.frequency,
+		    isc_checksum ? "on" : "off");
+	shell_print(sh, "%u requests, %u checksum errors, %u clock fallbacks", stats.requests,
+		    stats.checksum_errors, stats.fallbacks);
+	shell_print(sh, "%u error responses, %u blocked, %u response timeouts, "
+		    "%u SPI timeouts", stats.error_inds, stats.blocked, stats.response_timeouts,
+		    stats.spi_timeouts);
+	shell_print(sh, "%u retries, %u resets, %u faults", stats.retries, stats.resets,
+		    stats.faults);
+	shell_print(sh, "Longest exchange %u us, longest recovery %u us",
+		    stats.worst_exchange_us, stats.worst_recovery_us);
+
+	return 0;
+}
+
+SHELL_CMD_REGISTER(isc, NULL, "Speech IC link: SPI clock, errors and recovery", cmd_isc_link);
+#endif /* CONFIG_SHELL */
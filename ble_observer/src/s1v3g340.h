@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef S1V3G340_H_
+#define S1V3G340_H_
+
+#include <zephyr.h>
+
+/*
+Note: Phrase numbers stored on the speech IC are addressed as (PS_xxxx - 1):
+	PS_0203 - (0x00CB - 1) = 0x00CA (Reached control)
+	PS_0143 - (0x008F - 1) = 0x008E (1)
+	PS_0204 - (0x00CC - 1) = 0x00CB (in)
+	PS_0001 - (0x0001 - 1) = 0x0000 (1 hour)
+	PS_0039 - (0x0027 - 1) = 0x0026 (15 minutes)
+*/
+#define PHRASE_REACHED_CONTROL		0x00CA
+#define PHRASE_IN					0x00CB
+#define PHRASE_CONTROL(n)			((n) + 142 - 1)
+#define PHRASE_HOURS(h)				((h) - 1)
+#define PHRASE_MINUTES(m)			((m) + 24 - 1)
+
+/* Each phrase adds one 8 byte file event to ISC_SEQUENCER_CONFIG_REQ, the
+ * transmit buffer is sized for this many phrases in one sequence.
+ */
+#define S1V3G340_MAX_PHRASES		7
+
+/* SPI link to the speech IC, totals since boot */
+struct s1v3g340_link_stats {
+	uint32_t frequency;		/* SPI clock in use, Hz */
+	uint32_t requests;
+	uint32_t checksum_errors;	/* bad response checksums and ISC_ERROR_IND */
+	uint32_t fallbacks;		/* steps down to a lower clock */
+	uint32_t error_inds;		/* ISC_ERROR_IND and responses with a non-zero result */
+	uint32_t blocked;		/* ISC_MSG_BLOCKED_RESP */
+	uint32_t response_timeouts;	/* requests without a response */
+	uint32_t spi_timeouts;		/* transfers that missed their deadline */
+	uint32_t retries;		/* exchanges sent again */
+	uint32_t resets;		/* H_RESET recoveries */
+	uint32_t faults;		/* recoveries that failed */
+	uint32_t worst_exchange_us;	/* longest exchange, retries included */
+	uint32_t worst_recovery_us;	/* longest H_RESET recovery */
+};
+
+/* Link state kept through System OFF while the speech IC is in standby */
+struct s1v3g340_standby_state {
+	uint8_t spi_clock;		/* index of the SPI clock in use */
+	bool checksum;			/* ISC checksums enabled */
+};
+
+void GPIO_ControlStandby(int iValue);
+void GPIO_ControlMute(int iValue);
+void GPIO_S1V3G340_Reset(int iValue);
+
+void S1V3G340_Hardware_Reset_Start(void);
+void S1V3G340_Hardware_Reset_Wait(void);
+void S1V3G340_Hardware_Reset(void);
+int S1V3G340_Spi_Init(void);
+int S1V3G340_Initialize_Audio_Config(void);
+int S1V3G340_Play_Phrases(const uint16_t phrases[], int count);
+int S1V3G340_Wait_Playback_Done(int timeout_ms);
+int S1V3G340_Stop_Playback(void);
+int S1V3G340_Recover(void);
+int S1V3G340_Standby_Enter(struct s1v3g340_standby_state *state);
+int S1V3G340_Standby_Exit(const struct s1v3g340_standby_state *state);
+void S1V3G340_Link_Stats_Get(struct s1v3g340_link_stats *stats);
+
+#endif /* S1V3G340_H_ */
@@ -0,0 +1,588 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Emulated EPSON S1V3G340 speech IC on the Zephyr SPI emulator.
+ *
+ * Implements the part of the ISC protocol the SI Voice firmware uses:
+ * RESET, TEST (key-code check), VERSION, AUDIO_CONFIG and
+ * SEQUENCER_CONFIG/START/STOP, with ISC_SEQUENCER_STATUS_IND sent when
+ * the playback has finished. Responses are clocked out on MISO once the
+ * IC has had CONFIG_S1V3G340_EMUL_RESPONSE_US to process the request,
+ * as with the real part in full duplex mode. Checksums are added and
+ * checked once ISC_TEST_REQ has enabled them.
+ */
+
+#define DT_DRV_COMPAT epson_s1v3g340
+
+#include <zephyr.h>
+#include <string.h>
+#include <device.h>
+#include <logging/log.h>
+#include <drivers/emul.h>
+#include <drivers/spi.h>
+#include <drivers/spi_emul.h>
+#include "isc_msgs.h"
+#include "s1v3g340.h"
+#include "s1v3g340_emul.h"
+
+LOG_MODULE_REGISTER(s1v3g340_emul, CONFIG_SI_VOICE_LOG_LEVEL);
+
+/* Longest request frame accepted, ISC_SEQUENCER_CONFIG_REQ with 30 phrases */
+#define EMUL_MAX_FRAME_LEN		256
+#define EMUL_MAX_PHRASES		((EMUL_MAX_FRAME_LEN - LEN_HEAD_ISC_SEQUENCER_CONFIG_REQ) / \
+					 LEN_EVENT_ISC_SEQUENCER_CONFIG_REQ)
+/* Longest response frame, ISC_VERSION_RESP with its checksum */
+#define EMUL_MAX_RESP_LEN		(1 + LEN_ISC_VERSION_RESP + ISC_CHECKSUM_LEN)
+#define EMUL_RESP_QUEUE_LEN		4
+
+/* Result codes in the responses */
+#define ISC_RESULT_OK			0x0000
+#define ISC_RESULT_ERROR		0x0001
+
+/* Approximate playback time of the phrases stored on the Rutronik board.
+ * Phrases in a sequence follow each other with a short silence.
+ */
+#define PLAYBACK_START_US		8000
+#define PLAYBACK_GAP_US			40000
+#define PHRASE_REACHED_CONTROL_US	920000
+#define PHRASE_IN_US			240000
+#define PHRASE_CONTROL_US		560000
+#define PHRASE_HOURS_US			690000
+#define PHRASE_MINUTES_US		810000
+#define PHRASE_OTHER_US			600000
+
+struct emul_resp {
+	uint8_t data[EMUL_MAX_RESP_LEN];
+	uint8_t len;
+	uint8_t pos;
+	uint64_t ready_us;
+};
+
+struct s1v3g340_emul_data {
+	struct spi_emul emul_spi;
+
+	/* Request parser */
+	uint8_t frame[EMUL_MAX_FRAME_LEN + ISC_CHECKSUM_LEN];
+	uint16_t frame_len;
+	uint16_t frame_pos;
+	bool in_frame;
+
+	/* Response queue, clocked out on MISO */
+	struct emul_resp resp[EMUL_RESP_QUEUE_LEN];
+	uint8_t resp_head;
+	uint8_t resp_count;
+
+	/* IC state */
+	bool key_ok;
+	bool checksum;			/* enabled by ISC_TEST_REQ */
+	uint32_t fast_bytes;		/* response bytes sent above the clock limit */
+	uint32_t reset_requests;	/* requests since the last H_RESET */
+	bool hung;			/* ignores everything until H_RESET */
+	bool standby;			/* ignores everything until H_STBEXT */
+	bool audio_configured;
+	uint16_t phrases[EMUL_MAX_PHRASES];
+	uint16_t phrase_count;
+	bool playing;
+	bool notify;
+	uint64_t playback_end_us;
+
+	struct s1v3g340_emul_frame frames[CONFIG_S1V3G340_EMUL_FRAME_LOG_SIZE];
+	uint32_t frames_total;
+	struct s1v3g340_emul_stats stats;
+};
+
+struct s1v3g340_emul_cfg {
+	uint16_t chipsel;
+};
+
+static struct s1v3g340_emul_data *emul_instance;
+static struct k_spinlock emul_lock;
+
+/* Key-code the host has to register with ISC_TEST_REQ before anything else */
+static const uint8_t emul_key_code[] = {
+	(uint8_t)(CONFIG_S1V3G340_EMUL_KEY_CODE),
+	(uint8_t)(CONFIG_S1V3G340_EMUL_KEY_CODE >> 8),
+	(uint8_t)(CONFIG_S1V3G340_EMUL_KEY_CODE >> 16),
+	(uint8_t)(CONFIG_S1V3G340_EMUL_KEY_CODE >> 24),
+};
+
+static uint64_t emul_now_us(void)
+{
+	return k_ticks_to_us_floor64(k_uptime_ticks());
+}
+
+static uint32_t phrase_duration_us(uint16_t phrase)
+{
+#if defined(CONFIG_SI_VOICE_FAST_ACK)
+	if (phrase == CONFIG_SI_VOICE_ACK_PHRASE && phrase != PHRASE_REACHED_CONTROL) {
+		return CONFIG_SI_VOICE_ACK_DURATION_MS * USEC_PER_MSEC;
+	}
+#endif
+	if (phrase == PHRASE_REACHED_CONTROL) {
+		return PHRASE_REACHED_CONTROL_US;
+	} else if (phrase == PHRASE_IN) {
+		return PHRASE_IN_US;
+	} else if (phrase >= PHRASE_CONTROL(1) && phrase < PHRASE_REACHED_CONTROL) {
+		return PHRASE_CONTROL_US;
+	} else if (phrase >= PHRASE_MINUTES(0) && phrase < PHRASE_CONTROL(1)) {
+		return PHRASE_MINUTES_US;
+	} else if (phrase < PHRASE_MINUTES(0)) {
+		return PHRASE_HOURS_US;
+	}
+	return PHRASE_OTHER_US;
+}
+
+static void frame_record(struct s1v3g340_emul_data *data, uint8_t dir, uint16_t msg_id,
+			 uint16_t len, uint64_t at_us)
+{
+	struct s1v3g340_emul_frame *frame =
+		&data->frames[data->frames_total % CONFIG_S1V3G340_EMUL_FRAME_LOG_SIZE];
+
+	frame->at_us = (uint32_t)at_us;
+	frame->msg_id = msg_id;
+	frame->len = len;
+	frame->dir = dir;
+	data->frames_total++;
+
+	LOG_DBG("ISC %s 0x%04x len %u at %llu us",
+		dir == S1V3G340_EMUL_FRAME_REQ ? "req" : "resp", msg_id, len, at_us);
+}
+
+static void resp_queue(struct s1v3g340_emul_data *data, uint16_t msg_id, const uint8_t *payload,
+		       uint8_t payload_len, uint64_t ready_us)
+{
+	struct emul_resp *resp;
+	uint16_t len = 4 + payload_len;
+
+	if (data->resp_count == EMUL_RESP_QUEUE_LEN) {
+		/* The host is not reading, the real IC would drop it too */
+		return;
+	}
+
+	resp = &data->resp[(data->resp_head + data->resp_count) % EMUL_RESP_QUEUE_LEN];
+	resp->data[0] = ID_START;
+	resp->data[1] = _GET_LOW_BYTE(len);
+	resp->data[2] = _GET_HIGH_BYTE(len);
+	resp->data[3] = _GET_LOW_BYTE(msg_id);
+	resp->data[4] = _GET_HIGH_BYTE(msg_id);
+	if (payload_len) {
+		memcpy(&resp->data[5], payload, payload_len);
+	}
+	resp->len = 1 + len;
+	if (data->checksum) {
+		resp->data[resp->len] = IscChecksum(&resp->data[1], len);
+		resp->len += ISC_CHECKSUM_LEN;
+	}
+	resp->pos = 0;
+	resp->ready_us = ready_us;
+	data->resp_count++;
+
+	data->stats.responses++;
+	if (msg_id == ID_ISC_ERROR_IND || msg_id == ID_ISC_MSG_BLOCKED_RESP ||
+	    (payload_len >= 2 && msg_id != ID_ISC_VERSION_RESP &&
+	     msg_id != ID_ISC_SEQUENCER_STATUS_IND && (payload[0] || payload[1]))) {
+		data->stats.errors++;
+	}
+	frame_record(data, S1V3G340_EMUL_FRAME_RESP, msg_id, len, ready_us);
+}
+
+static void resp_result(struct s1v3g340_emul_data *data, uint16_t msg_id, uint16_t result,
+			uint64_t ready_us)
+{
+	const uint8_t payload[] = { _GET_LOW_BYTE(result), _GET_HIGH_BYTE(result) };
+
+	resp_queue(data, msg_id, payload, sizeof(payload), ready_us);
+}
+
+static void resp_blocked(struct s1v3g340_emul_data *data, uint16_t msg_id, uint64_t ready_us)
+{
+	const uint8_t payload[] = {
+		_GET_LOW_BYTE(msg_id), _GET_HIGH_BYTE(msg_id),
+		_GET_LOW_BYTE(ISC_RESULT_ERROR), _GET_HIGH_BYTE(ISC_RESULT_ERROR),
+	};
+
+	resp_queue(data, ID_ISC_MSG_BLOCKED_RESP, payload, sizeof(payload), ready_us);
+}
+
+static void playback_update(struct s1v3g340_emul_data *data, uint64_t now_us)
+{
+	if (data->playing && now_us >= data->playback_end_us) {
+		data->playing = false;
+		if (data->notify) {
+			resp_result(data, ID_ISC_SEQUENCER_STATUS_IND, 0x0000, data->playback_end_us);
+		}
+	}
+}
+
+static void sequencer_config(struct s1v3g340_emul_data *data, const uint8_t *payload,
+			     uint16_t payload_len, uint64_t ready_us)
+{
+	/* 2 bytes flags, 2 bytes event count, then one 8 byte event per phrase */
+	uint16_t count;
+
+	if (payload_len < 4) {
+		resp_result(data, ID_ISC_SEQUENCER_CONFIG_RESP, ISC_RESULT_ERROR, ready_us);
+		return;
+	}
+	count = payload[2] | (payload[3] << 8);
+	if (count == 0 || count > EMUL_MAX_PHRASES ||
+	    payload_len != 4 + count * LEN_EVENT_ISC_SEQUENCER_CONFIG_REQ) {
+		resp_result(data, ID_ISC_SEQUENCER_CONFIG_RESP, ISC_RESULT_ERROR, ready_us);
+		return;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const uint8_t *event = &payload[4 + i * LEN_EVENT_ISC_SEQUENCER_CONFIG_REQ];
+
+		data->phrases[i] = event[6] | (event[7] << 8);
+	}
+	data->phrase_count = count;
+
+	resp_result(data, ID_ISC_SEQUENCER_CONFIG_RESP, ISC_RESULT_OK, ready_us);
+}
+
+static void sequencer_start(struct s1v3g340_emul_data *data, const uint8_t *payload,
+			    uint16_t payload_len, uint64_t ready_us)
+{
+	uint64_t duration_us = PLAYBACK_START_US;
+
+	if (data->phrase_count == 0 || !data->audio_configured || data->playing) {
+		resp_result(data, ID_ISC_SEQUENCER_START_RESP, ISC_RESULT_ERROR, ready_us);
+		return;
+	}
+
+	for (int i = 0; i < data->phrase_count; i++) {
+		duration_us += phrase_duration_us(data->phrases[i]) + PLAYBACK_GAP_US;
+	}
+
+	data->notify = (payload_len >= 1 && payload[0] == 1);
+	data->playing = true;
+	data->playback_end_us = ready_us + duration_us;
+	data->stats.sequences++;
+	data->stats.busy_us += duration_us;
+
+	resp_result(data, ID_ISC_SEQUENCER_START_RESP, ISC_RESULT_OK, ready_us);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: request_handle
+//
+//  description:
+//    Handles one complete request frame. The frame starts with the
+//    length field, the 0x00 0xAA header is already stripped.
+///////////////////////////////////////////////////////////////////////
+static void request_handle(struct s1v3g340_emul_data *data, uint64_t now_us)
+{
+	uint16_t msg_id = data->frame[2] | (data->frame[3] << 8);
+	const uint8_t *payload = &data->frame[4];
+	uint16_t payload_len = data->frame_len - 4;
+	uint64_t ready_us = now_us + CONFIG_S1V3G340_EMUL_RESPONSE_US;
+	uint8_t version[LEN_ISC_VERSION_RESP - 4] = { 0 };
+
+	data->stats.requests++;
+	frame_record(data, S1V3G340_EMUL_FRAME_REQ, msg_id, data->frame_len, now_us);
+
+	if (CONFIG_S1V3G340_EMUL_HANG_REQUESTS > 0 &&
+	    ++data->reset_requests > CONFIG_S1V3G340_EMUL_HANG_REQUESTS) {
+		/* Stuck, only H_RESET brings the IC back */
+		data->hung = true;
+	}
+	if (data->hung || data->standby) {
+		return;
+	}
+
+	if (data->checksum && IscChecksum(data->frame, data->frame_len + ISC_CHECKSUM_LEN) != 0) {
+		resp_result(data, ID_ISC_ERROR_IND, ISC_RESULT_ERROR, ready_us);
+		return;
+	}
+
+	/* Everything but RESET and TEST is blocked until the key-code is registered */
+	if (!data->key_ok && msg_id != ID_ISC_RESET_REQ && msg_id != ID_ISC_TEST_REQ) {
+		resp_blocked(data, msg_id, ready_us);
+		return;
+	}
+
+	switch (msg_id) {
+	case ID_ISC_RESET_REQ:
+		data->key_ok = false;
+		data->checksum = false;
+		data->audio_configured = false;
+		data->phrase_count = 0;
+		data->playing = false;
+		data->resp_count = 0;
+		resp_queue(data, ID_ISC_RESET_RESP, NULL, 0, ready_us);
+		break;
+	case ID_ISC_TEST_REQ:
+		/* checksum flag, duplex flag, key-code */
+		data->key_ok = (payload_len >= 8 &&
+				memcmp(&payload[4], emul_key_code, sizeof(emul_key_code)) == 0);
+		resp_result(data, ID_ISC_TEST_RESP,
+			    data->key_ok ? ISC_RESULT_OK : ISC_RESULT_ERROR, ready_us);
+		/* From the next message on */
+		data->checksum = data->key_ok && payload[0] == 1;
+		break;
+	case ID_ISC_VERSION_REQ:
+		/* product ID, firmware and voice data versions */
+		version[0] = 0x40;
+		version[1] = 0x03;
+		version[2] = 0x01;
+		version[4] = 0x01;
+		resp_queue(data, ID_ISC_VERSION_RESP, version, sizeof(version), ready_us);
+		break;
+	case ID_ISC_AUDIO_CONFIG_REQ:
+		data->audio_configured = true;
+		resp_result(data, ID_ISC_AUDIO_CONFIG_RESP, ISC_RESULT_OK, ready_us);
+		break;
+	case ID_ISC_SEQUENCER_CONFIG_REQ:
+		if (data->playing) {
+			resp_blocked(data, msg_id, ready_us);
+			break;
+		}
+		sequencer_config(data, payload, payload_len, ready_us);
+		break;
+	case ID_ISC_SEQUENCER_START_REQ:
+		sequencer_start(data, payload, payload_len, ready_us);
+		break;
+	case ID_ISC_PMAN_STANDBY_ENTRY_REQ:
+		if (data->playing) {
+			resp_blocked(data, msg_id, ready_us);
+			break;
+		}
+		resp_result(data, ID_ISC_PMAN_STANDBY_ENTRY_RESP, ISC_RESULT_OK, ready_us);
+		data->standby = true;
+		break;
+	case ID_ISC_SEQUENCER_STOP_REQ:
+		data->playing = false;
+		resp_result(data, ID_ISC_SEQUENCER_STOP_RESP, ISC_RESULT_OK, ready_us);
+		break;
+	default:
+		resp_result(data, ID_ISC_ERROR_IND, ISC_RESULT_ERROR, ready_us);
+		break;
+	}
+}
+
+static void request_byte(struct s1v3g340_emul_data *data, uint8_t byte, uint64_t now_us)
+{
+	if (!data->in_frame) {
+		/* Dummy bytes and the leading 0x00 are ignored */
+		if (byte == ID_START) {
+			data->in_frame = true;
+			data->frame_pos = 0;
+			data->frame_len = 0;
+		}
+		return;
+	}
+
+	data->frame[data->frame_pos++] = byte;
+
+	if (data->frame_pos == 2) {
+		data->frame_len = data->frame[0] | (data->frame[1] << 8);
+		if (data->frame_len < 4 || data->frame_len > EMUL_MAX_FRAME_LEN) {
+			data->in_frame = false;
+			resp_result(data, ID_ISC_ERROR_IND, ISC_RESULT_ERROR,
+				    now_us + CONFIG_S1V3G340_EMUL_RESPONSE_US);
+		}
+	} else if (data->frame_pos > 2 &&
+		   data->frame_pos == data->frame_len + (data->checksum ? ISC_CHECKSUM_LEN : 0)) {
+		data->in_frame = false;
+		request_handle(data, now_us);
+	}
+}
+
+static uint8_t response_byte(struct s1v3g340_emul_data *data, uint64_t now_us)
+{
+	struct emul_resp *resp;
+	uint8_t byte;
+
+	if (data->resp_count == 0) {
+		return 0x00;
+	}
+
+	resp = &data->resp[data->resp_head];
+	if (now_us < resp->ready_us) {
+		return 0x00;
+	}
+
+	byte = resp->data[resp->pos++];
+	if (resp->pos == resp->len) {
+		data->resp_head = (data->resp_head + 1) % EMUL_RESP_QUEUE_LEN;
+		data->resp_count--;
+	}
+
+	return byte;
+}
+
+static size_t buf_set_len(const struct spi_buf_set *bufs)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; bufs != NULL && i < bufs->count; i++) {
+		len += bufs->buffers[i].len;
+	}
+	return len;
+}
+
+/* Byte at the given offset of a buffer set, NULL if past the end or a skipped buffer */
+static uint8_t *buf_set_byte(const struct spi_buf_set *bufs, size_t offset)
+{
+	for (size_t i = 0; bufs != NULL && i < bufs->count; i++) {
+		if (offset < bufs->buffers[i].len) {
+			return bufs->buffers[i].buf ? (uint8_t *)bufs->buffers[i].buf + offset : NULL;
+		}
+		offset -= bufs->buffers[i].len;
+	}
+	return NULL;
+}
+
+static int s1v3g340_emul_io(struct spi_emul *emul, const struct spi_config *config,
+			    const struct spi_buf_set *tx_bufs, const struct spi_buf_set *rx_bufs)
+{
+	struct s1v3g340_emul_data *data = CONTAINER_OF(emul, struct s1v3g340_emul_data, emul_spi);
+	size_t len = MAX(buf_set_len(tx_bufs), buf_set_len(rx_bufs));
+	/* Microseconds per byte, times 256 to keep the fraction at fast clocks */
+	uint32_t byte_us_q8 = (8U * USEC_PER_SEC * 256U) / MAX(config->frequency, 1U);
+	uint64_t start_us = emul_now_us();
+	k_spinlock_key_t key = k_spin_lock(&emul_lock);
+
+	for (size_t i = 0; i < len; i++) {
+		uint64_t now_us = start_us + ((i * byte_us_q8) >> 8);
+		uint8_t *tx = buf_set_byte(tx_bufs, i);
+		uint8_t *rx = buf_set_byte(rx_bufs, i);
+		uint8_t out;
+
+		playback_update(data, now_us);
+		/* Full duplex, MISO is shifted out while MOSI is shifted in */
+		out = response_byte(data, now_us);
+		if (out != 0x00 && CONFIG_S1V3G340_EMUL_MAX_SPI_FREQUENCY > 0 &&
+		    config->frequency > CONFIG_S1V3G340_EMUL_MAX_SPI_FREQUENCY &&
+		    (++data->fast_bytes % 16) == 0) {
+			/* Clock too fast for the IC, MISO flips a bit now and then */
+			out ^= 0x01;
+		}
+		request_byte(data, tx ? *tx : 0x00, now_us);
+		if (rx) {
+			*rx = out;
+		}
+	}
+
+	data->stats.transfers++;
+	data->stats.bytes += len;
+
+	k_spin_unlock(&emul_lock, key);
+
+	if (IS_ENABLED(CONFIG_S1V3G340_EMUL_SPI_TIMING)) {
+		/* Let simulated time pass for the transfer itself */
+		k_busy_wait((len * byte_us_q8) >> 8);
+	}
+
+	return 0;
+}
+
+static const struct spi_emul_api s1v3g340_emul_api = {
+	.io = s1v3g340_emul_io,
+};
+
+///////////////////////////////////////////////////////////////////////
+//  function: s1v3g340_emul_hw_reset
+//
+//  description:
+//    Pulse on the H_RESET pin of the emulated IC. Called by the driver,
+//    the emulated boards have no GPIO to wire the pin to.
+///////////////////////////////////////////////////////////////////////
+void s1v3g340_emul_hw_reset(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&emul_lock);
+	struct s1v3g340_emul_data *data = emul_instance;
+
+	if (data) {
+		data->in_frame = false;
+		data->key_ok = false;
+		data->checksum = false;
+		data->audio_configured = false;
+		data->phrase_count = 0;
+		data->playing = false;
+		data->resp_count = 0;
+		data->reset_requests = 0;
+		data->hung = false;
+		data->standby = false;
+		data->stats.hw_resets++;
+	}
+
+	k_spin_unlock(&emul_lock, key);
+}
+
+void s1v3g340_emul_standby_exit(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&emul_lock);
+	struct s1v3g340_emul_data *data = emul_instance;
+
+	if (data && data->standby && !data->hung) {
+		data->standby = false;
+		resp_queue(data, ID_ISC_PMAN_STANDBY_EXIT_IND, NULL, 0,
+			   emul_now_us() + CONFIG_S1V3G340_EMUL_RESPONSE_US);
+	}
+
+	k_spin_unlock(&emul_lock, key);
+}
+
+void s1v3g340_emul_stats_get(struct s1v3g340_emul_stats *stats)
+{
+	k_spinlock_key_t key = k_spin_lock(&emul_lock);
+
+	if (emul_instance) {
+		*stats = emul_instance->stats;
+	} else {
+		memset(stats, 0, sizeof(*stats));
+	}
+
+	k_spin_unlock(&emul_lock, key);
+}
+
+int s1v3g340_emul_frames_get(struct s1v3g340_emul_frame *frames, int max)
+{
+	k_spinlock_key_t key = k_spin_lock(&emul_lock);
+	int count = 0;
+
+	if (emul_instance) {
+		uint32_t total = emul_instance->frames_total;
+		uint32_t first = total > CONFIG_S1V3G340_EMUL_FRAME_LOG_SIZE ?
+				 total - CONFIG_S1V3G340_EMUL_FRAME_LOG_SIZE : 0;
+
+		if (total - first > max) {
+			first = total - max;
+		}
+		for (uint32_t i = first; i < total; i++) {
+			frames[count++] =
+				emul_instance->frames[i % CONFIG_S1V3G340_EMUL_FRAME_LOG_SIZE];
+		}
+	}
+
+	k_spin_unlock(&emul_lock, key);
+
+	return count;
+}
+
+static int s1v3g340_emul_init(const struct emul *target, const struct device *parent)
+{
+	const struct s1v3g340_emul_cfg *cfg = target->cfg;
+	struct s1v3g340_emul_data *data = target->data;
+
+	data->emul_spi.api = &s1v3g340_emul_api;
+	data->emul_spi.chipsel = cfg->chipsel;
+	emul_instance = data;
+
+	return spi_emul_register(parent, target->dev_label, &data->emul_spi);
+}
+
+#define S1V3G340_EMUL(n)							\
+	static struct s1v3g340_emul_data s1v3g340_emul_data_##n;		\
+	static const struct s1v3g340_emul_cfg s1v3g340_emul_cfg_##n = {	\
+		.chipsel = DT_INST_REG_ADDR(n),					\
+	};									\
+	EMUL_DEFINE(s1v3g340_emul_init, DT_DRV_INST(n), &s1v3g340_emul_cfg_##n,	\
+		    &s1v3g340_emul_data_##n)
+
+DT_INST_FOREACH_STATUS_OKAY(S1V3G340_EMUL)
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef S1V3G340_EMUL_H_
+#define S1V3G340_EMUL_H_
+
+#include <zephyr.h>
+
+/* Direction of a recorded ISC frame */
+#define S1V3G340_EMUL_FRAME_REQ		0	/* host to speech IC */
+#define S1V3G340_EMUL_FRAME_RESP	1	/* speech IC to host */
+
+/* ISC frame seen on the emulated bus */
+struct s1v3g340_emul_frame {
+	uint32_t at_us;
+	uint16_t msg_id;
+	uint16_t len;
+	uint8_t dir;
+};
+
+/* Totals since boot, subtract two snapshots to get the cost of one announcement */
+struct s1v3g340_emul_stats {
+	uint32_t transfers;
+	uint32_t bytes;
+	uint32_t requests;
+	uint32_t responses;
+	uint32_t errors;		/* ISC_ERROR_IND, ISC_MSG_BLOCKED_RESP or a non-zero result */
+	uint32_t sequences;		/* accepted ISC_SEQUENCER_START_REQ */
+	uint64_t busy_us;		/* scheduled playback time of the accepted sequences */
+	uint32_t hw_resets;		/* pulses on H_RESET */
+};
+
+void s1v3g340_emul_stats_get(struct s1v3g340_emul_stats *stats);
+
+/* H_RESET of the emulated IC, the driver calls it from S1V3G340_Hardware_Reset() */
+void s1v3g340_emul_hw_reset(void);
+
+/* Rising edge on H_STBEXT of the emulated IC */
+void s1v3g340_emul_standby_exit(void);
+
+/* Copies the most recent frames, oldest first. Returns the number copied. */
+int s1v3g340_emul_frames_get(struct s1v3g340_emul_frame *frames, int max);
+
+#endif /* S1V3G340_EMUL_H_ */
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr.h>
+#include <init.h>
+#include <string.h>
+#include <shell/shell.h>
+#include "trace.h"
+
+/* Bucket n counts latencies in [2^n, 2^(n+1)) us, bucket 0 also takes 0 us
+ * and the last bucket everything above. 24 buckets reach 16 s.
+ */
+#define TRACE_HIST_BUCKETS	24
+
+struct trace_span {
+	const char *name;
+	enum trace_point from;
+	enum trace_point to;
+};
+
+struct trace_hist {
+	uint32_t buckets[TRACE_HIST_BUCKETS];
+	uint32_t count;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint64_t total_us;
+};
+
+static const struct trace_span spans[] = {
+	{ "rx-decode",		TRACE_ADV_RECEIVED,	TRACE_PUNCH_DECODED },
+	{ "decode-queue",	TRACE_PUNCH_DECODED,	TRACE_PUNCH_ENQUEUED },
+	{ "queue-wait",		TRACE_PUNCH_ENQUEUED,	TRACE_SPI_CONFIG_START },
+	{ "spi-config",		TRACE_SPI_CONFIG_START,	TRACE_SPI_CONFIG_END },
+	{ "start-ack",		TRACE_SPI_CONFIG_END,	TRACE_SEQUENCER_STARTED },
+	{ "playback",		TRACE_SEQUENCER_STARTED, TRACE_PLAYBACK_DONE },
+	{ "punch-voice",	TRACE_ADV_RECEIVED,	TRACE_SEQUENCER_STARTED },
+	{ "punch-announce",	TRACE_ADV_RECEIVED,	TRACE_ANNOUNCEMENT_STARTED },
+	{ "punch-done",		TRACE_ADV_RECEIVED,	TRACE_PLAYBACK_DONE },
+};
+
+static struct trace_hist hists[ARRAY_SIZE(spans)];
+static struct trace_record current;
+static struct k_spinlock trace_lock;
+
+static uint32_t trace_cycles_to_us(uint32_t cycles)
+{
+#if defined(CONFIG_TIMING_FUNCTIONS)
+	return (uint32_t)(timing_cycles_to_ns(cycles) / NSEC_PER_USEC);
+#else
+	return k_cyc_to_us_floor32(cycles);
+#endif
+}
+
+static void hist_add(struct trace_hist *hist, uint32_t us)
+{
+	int bucket = (us < 2) ? 0 : (31 - __builtin_clz(us));
+
+	hist->buckets[MIN(bucket, TRACE_HIST_BUCKETS - 1)]++;
+	if (hist->count == 0 || us < hist->min_us) {
+		hist->min_us = us;
+	}
+	if (us > hist->max_us) {
+		hist->max_us = us;
+	}
+	hist->total_us += us;
+	hist->count++;
+}
+
+/* Upper bound of the bucket holding the given percentile, capped at the maximum */
+static uint32_t hist_percentile(const struct trace_hist *hist, uint32_t percent)
+{
+	uint32_t rank = (hist->count * percent + 99) / 100;
+	uint32_t seen = 0;
+
+	for (int i = 0; i < TRACE_HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			return MIN(BIT(i + 1) - 1, hist->max_us);
+		}
+	}
+	return hist->max_us;
+}
+
+void trace_punch_begin(const struct trace_record *rec)
+{
+	current = *rec;
+}
+
+void trace_point(enum trace_point point)
+{
+	trace_stamp(&current, point);
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: trace_punch_end
+//
+//  description:
+//    Adds every span of the current punch whose two points were both
+//    stamped to its histogram.
+///////////////////////////////////////////////////////////////////////
+void trace_punch_end(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&trace_lock);
+
+	for (int i = 0; i < ARRAY_SIZE(spans); i++) {
+		uint32_t need = BIT(spans[i].from) | BIT(spans[i].to);
+
+		if ((current.hit & need) == need) {
+			hist_add(&hists[i], trace_cycles_to_us(current.at[spans[i].to] -
+							       current.at[spans[i].from]));
+		}
+	}
+
+	k_spin_unlock(&trace_lock, key);
+
+	current.hit = 0;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_trace_show(const struct shell *sh, size_t argc, char **argv)
+{
+	struct trace_hist hist;
+
+	shell_print(sh, "%-16s %8s %10s %10s %10s %10s %10s", "span", "count",
+		    "min us", "p50 us", "p95 us", "p99 us", "max us");
+
+	for (int i = 0; i < ARRAY_SIZE(spans); i++) {
+		k_spinlock_key_t key = k_spin_lock(&trace_lock);
+
+		hist = hists[i];
+		k_spin_unlock(&trace_lock, key);
+
+		if (hist.count == 0) {
+			shell_print(sh, "%-16s %8u", spans[i].name, 0);
+			continue;
+		}
+		shell_print(sh, "%-16s %8u %10u %10u %10u %10u %10u", spans[i].name, hist.count,
+			    hist.min_us, hist_percentile(&hist, 50), hist_percentile(&hist, 95),
+			    hist_percentile(&hist, 99), hist.max_us);
+
+		if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+			for (int b = 0; b < TRACE_HIST_BUCKETS; b++) {
+				if (hist.buckets[b]) {
+					shell_print(sh, "  < %8lu us %8u", BIT(b + 1), hist.buckets[b]);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int cmd_trace_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	k_spinlock_key_t key = k_spin_lock(&trace_lock);
+
+	memset(hists, 0, sizeof(hists));
+	k_spin_unlock(&trace_lock, key);
+
+	shell_print(sh, "Histograms cleared");
+
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(trace_cmds,
+	SHELL_CMD_ARG(show, NULL, "Latency per span, -v adds the buckets", cmd_trace_show, 1, 1),
+	SHELL_CMD(reset, NULL, "Clear the histograms", cmd_trace_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(trace, &trace_cmds, "Punch-to-voice latency histograms", NULL);
+#endif /* CONFIG_SHELL */
+
+static int trace_init(const struct device *dev)
+{
+	ARG_UNUSED(dev);
+
+#if defined(CONFIG_TIMING_FUNCTIONS)
+	timing_init();
+	timing_start();
+#endif
+
+	return 0;
+}
+
+SYS_INIT(trace_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <zephyr.h>
+#if defined(CONFIG_TIMING_FUNCTIONS)
+#include <timing/timing.h>
+#endif
+
+/* Points on the way from a SPORTident advertisement to the loudspeaker */
+enum trace_point {
+	TRACE_ADV_RECEIVED,		/* scan_recv() entered */
+	TRACE_PUNCH_DECODED,		/* punch parsed from the manufacturer data */
+	TRACE_PUNCH_ENQUEUED,		/* handed to the audio thread */
+	TRACE_SPI_CONFIG_START,		/* first ISC_SEQUENCER_CONFIG_REQ transfer started */
+	TRACE_SPI_CONFIG_END,		/* first ISC_SEQUENCER_CONFIG_REQ transfer done */
+	TRACE_SEQUENCER_STARTED,	/* first ISC_SEQUENCER_START_REQ accepted, first syllable */
+	TRACE_ANNOUNCEMENT_STARTED,	/* sequencer started for the full announcement */
+	TRACE_PLAYBACK_DONE,		/* ISC_SEQUENCER_STATUS_IND for the announcement */
+	TRACE_POINT_COUNT
+};
+
+/* Timestamps of one punch, carried with it from the Bluetooth RX thread */
+struct trace_record {
+#if defined(CONFIG_SI_VOICE_TRACE)
+	uint32_t at[TRACE_POINT_COUNT];
+	uint32_t hit;
+#endif
+};
+
+#if defined(CONFIG_SI_VOICE_TRACE)
+
+static inline uint32_t trace_now(void)
+{
+#if defined(CONFIG_TIMING_FUNCTIONS)
+	/* CPU cycle counter where the architecture has one */
+	return (uint32_t)timing_counter_get();
+#else
+	return k_cycle_get_32();
+#endif
+}
+
+/* Stamps a point of the given record, a point already stamped is kept */
+static inline void trace_stamp(struct trace_record *rec, enum trace_point point)
+{
+	if (!(rec->hit & BIT(point))) {
+		rec->at[point] = trace_now();
+		rec->hit |= BIT(point);
+	}
+}
+
+/* The audio thread traces one punch at a time */
+void trace_punch_begin(const struct trace_record *rec);
+void trace_point(enum trace_point point);
+void trace_punch_end(void);
+
+#else
+
+static inline void trace_stamp(struct trace_record *rec, enum trace_point point) {}
+static inline void trace_punch_begin(const struct trace_record *rec) {}
+static inline void trace_point(enum trace_point point) {}
+static inline void trace_punch_end(void) {}
+
+#endif /* CONFIG_SI_VOICE_TRACE */
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+#include "isc_msgs.h"
+
+/* Byte sum from the length field on, 0 for a message with a good checksum */
+static uint8_t msg_sum(const uint8_t *buf, int len)
+{
+	uint8_t sum = 0;
+
+	for (int i = HEADER_LEN; i < len; i++) {
+		sum += buf[i];
+	}
+	return sum;
+}
+
+static void assert_header(const uint8_t *buf, int len, uint16_t msg_id)
+{
+	zassert_equal(buf[0], 0x00, NULL);
+	zassert_equal(buf[1], ID_START, NULL);
+	zassert_equal(buf[2] | (buf[3] << 8), len - HEADER_LEN, "length field");
+	zassert_equal(buf[4] | (buf[5] << 8), msg_id, "message ID");
+}
+
+ZTEST(isc_msgs, test_reset_req)
+{
+	static const uint8_t expected[] = { 0x00, 0xAA, 0x06, 0x00, 0x01, 0x00, 0x00, 0x00 };
+	uint8_t buf[16];
+
+	zassert_equal(IscEncodeResetReq(buf, sizeof(buf)), sizeof(expected), NULL);
+	zassert_mem_equal(buf, expected, sizeof(expected), NULL);
+}
+
+ZTEST(isc_msgs, test_test_req)
+{
+	static const uint8_t key_code[] = { 0x9B, 0x68, 0x52, 0xD1 };
+	uint8_t buf[16];
+	int len;
+
+	len = IscEncodeTestReq(buf, sizeof(buf), 0);
+	zassert_equal(len, ISC_MSG_SIZE(LEN_ISC_TEST_REQ), NULL);
+	assert_header(buf, len, ID_ISC_TEST_REQ);
+	zassert_equal(buf[6], 0x00, "checksums off");
+	zassert_equal(buf[8], 0x01, "full duplex");
+	zassert_mem_equal(&buf[10], key_code, sizeof(key_code), NULL);
+
+	len = IscEncodeTestReq(buf, sizeof(buf), 1);
+	zassert_equal(buf[6], 0x01, "checksums on");
+}
+
+ZTEST(isc_msgs, test_parameters)
+{
+	uint8_t buf[32];
+	int len;
+
+	len = IscEncodeAudioConfigReq(buf, sizeof(buf), 0x43);
+	zassert_equal(len, ISC_MSG_SIZE(LEN_ISC_AUDIO_CONFIG_REQ), NULL);
+	assert_header(buf, len, ID_ISC_AUDIO_CONFIG_REQ);
+	zassert_equal(buf[7], 0x43, "gain");
+
+	len = IscEncodeAudioVolumeReq(buf, sizeof(buf), 0x1234);
+	zassert_equal(len, ISC_MSG_SIZE(LEN_ISC_AUDIO_VOLUME_REQ), NULL);
+	assert_header(buf, len, ID_ISC_AUDIO_VOLUME_REQ);
+	zassert_equal(buf[6] | (buf[7] << 8), 0x1234, "gain increment");
+
+	len = IscEncodeSequencerStartReq(buf, sizeof(buf), 5);
+	zassert_equal(len, ISC_MSG_SIZE(LEN_ISC_SEQUENCER_START_REQ), NULL);
+	assert_header(buf, len, ID_ISC_SEQUENCER_START_REQ);
+	zassert_equal(buf[6], 0x01, "notification");
+
+	len = IscEncodeSequencerStopReq(buf, sizeof(buf));
+	zassert_equal(len, ISC_MSG_SIZE(LEN_ISC_SEQUENCER_STOP_REQ), NULL);
+	assert_header(buf, len, ID_ISC_SEQUENCER_STOP_REQ);
+}
+
+ZTEST(isc_msgs, test_sequencer_config_req)
+{
+	static const unsigned short phrases[] = { 0x00CA, 0x018E };
+	uint8_t buf[ISC_SEQUENCER_CONFIG_REQ_SIZE(ARRAY_SIZE(phrases))];
+	int len;
+
+	len = IscEncodeSequencerConfigReq(buf, sizeof(buf), phrases, ARRAY_SIZE(phrases));
+	zassert_equal(len, sizeof(buf), NULL);
+	assert_header(buf, len, ID_ISC_SEQUENCER_CONFIG_REQ);
+	zassert_equal(buf[6] | (buf[7] << 8), 1, "play mode");
+	zassert_equal(buf[8] | (buf[9] << 8), ARRAY_SIZE(phrases), "event count");
+
+	for (int i = 0; i < ARRAY_SIZE(phrases); i++) {
+		const uint8_t *event = &buf[ISC_SEQUENCER_CONFIG_REQ_SIZE(i)];
+
+		zassert_equal(event[2] | (event[3] << 8), 1, "event type of phrase %d", i);
+		zassert_equal(event[4] | (event[5] << 8), 3, "file type of phrase %d", i);
+		zassert_equal(event[6] | (event[7] << 8), phrases[i], "code of phrase %d", i);
+	}
+
+	zassert_equal(IscEncodeSequencerConfigReq(buf, sizeof(buf), phrases, 0), -1,
+		      "no phrases");
+	zassert_equal(IscEncodeSequencerConfigReq(buf, sizeof(buf) - 1, phrases,
+						  ARRAY_SIZE(phrases)), -1, "buffer too small");
+}
+
+ZTEST(isc_msgs, test_buffer_too_small)
+{
+	uint8_t buf[ISC_MSG_SIZE(LEN_ISC_AUDIODEC_CONFIG_REQ)];
+
+	zassert_equal(IscEncodeResetReq(buf, ISC_MSG_SIZE(LEN_ISC_RESET_REQ) - 1), -1, NULL);
+	zassert_equal(IscEncodeTestReq(buf, ISC_MSG_SIZE(LEN_ISC_TEST_REQ) - 1, 1), -1, NULL);
+	zassert_equal(IscEncodeVersionReq(buf, ISC_MSG_SIZE(LEN_ISC_VERSION_REQ) - 1), -1, NULL);
+	zassert_equal(IscEncodeAudioConfigReq(buf, ISC_MSG_SIZE(LEN_ISC_AUDIO_CONFIG_REQ) - 1,
+					      0), -1, NULL);
+	zassert_equal(IscEncodeAudiodecConfigReq(buf,
+						 ISC_MSG_SIZE(LEN_ISC_AUDIODEC_CONFIG_REQ) - 1),
+		      -1, NULL);
+	zassert_equal(IscEncodeSequencerStartReq(buf,
+						 ISC_MSG_SIZE(LEN_ISC_SEQUENCER_START_REQ) - 1, 0),
+		      -1, NULL);
+	zassert_equal(IscEncodeAudiodecConfigReq(buf, sizeof(buf)), sizeof(buf), NULL);
+}
+
+ZTEST(isc_msgs, test_checksum)
+{
+	uint8_t buf[16];
+	int len;
+
+	/* 06 00 01 00 00 00 sums to 0x07 */
+	len = IscEncodeResetReq(buf, sizeof(buf));
+	zassert_equal(IscChecksum(&buf[HEADER_LEN], len - HEADER_LEN), 0xF9, NULL);
+
+	zassert_equal(IscAppendChecksum(buf, sizeof(buf), len), len + ISC_CHECKSUM_LEN, NULL);
+	zassert_equal(buf[len], 0xF9, NULL);
+	zassert_equal(msg_sum(buf, len + ISC_CHECKSUM_LEN), 0, NULL);
+	/* The receiver checks from the length field to the checksum */
+	zassert_equal(IscChecksum(&buf[HEADER_LEN], len - HEADER_LEN + ISC_CHECKSUM_LEN), 0,
+		      NULL);
+
+	len = IscEncodeTestReq(buf, sizeof(buf), 1);
+	zassert_equal(IscAppendChecksum(buf, sizeof(buf), len), len + ISC_CHECKSUM_LEN, NULL);
+	zassert_equal(msg_sum(buf, len + ISC_CHECKSUM_LEN), 0, NULL);
+}
+
+ZTEST(isc_msgs, test_append_checksum_limits)
+{
+	uint8_t buf[ISC_MSG_SIZE(LEN_ISC_RESET_REQ)];
+	int len = IscEncodeResetReq(buf, sizeof(buf));
+
+	zassert_equal(IscAppendChecksum(buf, sizeof(buf), len), -1, "no room");
+	zassert_equal(IscAppendChecksum(buf, sizeof(buf), ISC_MSG_SIZE(4) - 1), -1,
+		      "shorter than a header");
+}
+
+ZTEST_SUITE(isc_msgs, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+#include <string.h>
+#include "punch_log.h"
+
+/* Larger than the log in the storage partition of native_posix */
+#define LOG_BUF_SIZE		(64 * 1024)
+
+/* Batches logged at most while waiting for the oldest sector to be erased */
+#define ROTATION_BATCHES	1000
+
+static uint8_t log_buf[LOG_BUF_SIZE];
+static uint8_t read_buf[LOG_BUF_SIZE];
+
+/* Expected order of the records of one SIAC, see log_punches() */
+struct walk_check {
+	uint32_t siac_id;
+	uint32_t first_seq;
+	uint32_t matched;		/* records of the SIAC */
+	uint32_t bad;			/* records of the SIAC out of order or altered */
+	uint32_t total;			/* records in the log */
+};
+
+static uint8_t punch_control(uint32_t seq)
+{
+	return 31 + seq % 100;
+}
+
+static int8_t punch_result(uint32_t seq)
+{
+	return (seq % 3 == 0) ? -EIO : 0;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: log_punches
+//
+//  description:
+//    Logs count punches of a SIAC with consecutive sequence numbers,
+//    each followed by its announcement, and waits until they are in
+//    flash. The log work queue only runs while the test thread blocks,
+//    so the batches are flushed before both are full.
+///////////////////////////////////////////////////////////////////////
+static void log_punches(uint32_t siac_id, uint32_t first_seq, int count)
+{
+	struct si_punch punch = { .siac_id = siac_id };
+	struct punch_log_stats stats;
+
+	for (int i = 0; i < count; i++) {
+		punch_log_stats_get(&stats);
+		if (stats.pending + 2 > CONFIG_SI_VOICE_PUNCH_LOG_BATCH) {
+			punch_log_flush();
+		}
+
+		punch.seq = first_seq + i;
+		punch.siac_data[0] = 0x07;
+		punch.siac_data[1] = punch_control(punch.seq);
+		punch_log_punch(&punch);
+		punch_log_announcement(&punch, punch_result(punch.seq));
+	}
+	punch_log_flush();
+
+	punch_log_stats_get(&stats);
+	zassert_equal(stats.dropped, 0, "records dropped");
+	zassert_equal(stats.errors, 0, "commits failed");
+}
+
+static bool check_record(const struct punch_log_record *rec, void *user_data)
+{
+	struct walk_check *chk = user_data;
+	uint32_t seq = chk->first_seq + chk->matched / 2;
+	uint8_t type = (chk->matched % 2) ? PUNCH_LOG_ANNOUNCEMENT : PUNCH_LOG_PUNCH;
+
+	chk->total++;
+	if (rec->siac_id != chk->siac_id) {
+		return true;
+	}
+
+	if (rec->type != type || rec->seq != seq || rec->siac_data[0] != 0x07 ||
+	    rec->siac_data[1] != punch_control(seq) ||
+	    rec->result != (type == PUNCH_LOG_ANNOUNCEMENT ? punch_result(seq) : 0)) {
+		chk->bad++;
+	}
+	chk->matched++;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////
+//  function: log_read_all
+//
+//  description:
+//    Reads the whole log into log_buf as the download does, from the
+//    oldest segment to the end.
+//
+//  return:
+//    length of the log, its start offset in *start
+///////////////////////////////////////////////////////////////////////
+static uint32_t log_read_all(uint32_t *start)
+{
+	struct punch_log_cursor cur;
+	uint32_t end;
+
+	punch_log_range(start, &end);
+	zassert_true(end - *start <= sizeof(log_buf), "log larger than the buffer");
+
+	zassert_ok(punch_log_seek(&cur, *start), NULL);
+	zassert_equal(punch_log_read(&cur, log_buf, sizeof(log_buf)), end - *start, NULL);
+	zassert_equal(cur.offset, end, NULL);
+	zassert_equal(punch_log_read(&cur, read_buf, sizeof(read_buf)), 0, "read past the end");
+
+	return end - *start;
+}
+
+static void punch_log_before(void *fixture)
+{
+	struct walk_check chk = { 0 };
+
+	ARG_UNUSED(fixture);
+
+	/* Waits for the mount, it runs first on the log work queue */
+	punch_log_flush();
+	zassert_ok(punch_log_walk(check_record, &chk), "punch log not mounted");
+	zassert_true(chk.total > 0, "no boot record");
+}
+
+ZTEST(punch_log, test_walk_round_trip)
+{
+	struct walk_check chk = { .siac_id = 1001, .first_seq = 10 };
+	int count = CONFIG_SI_VOICE_PUNCH_LOG_BATCH + 5;
+
+	log_punches(chk.siac_id, chk.first_seq, count);
+
+	zassert_ok(punch_log_walk(check_record, &chk), NULL);
+	zassert_equal(chk.matched, 2 * count, NULL);
+	zassert_equal(chk.bad, 0, NULL);
+}
+
+ZTEST(punch_log, test_repeated_punch)
+{
+	struct walk_check chk = { .siac_id = 1002, .first_seq = 0 };
+	struct si_punch punch = { .siac_id = chk.siac_id };
+
+	/* Stations send a punch in many advertisements, one record is kept */
+	punch.siac_data[0] = 0x07;
+	punch.siac_data[1] = punch_control(0);
+	for (int i = 0; i < 5; i++) {
+		punch_log_punch(&punch);
+	}
+	punch_log_flush();
+
+	zassert_ok(punch_log_walk(check_record, &chk), NULL);
+	zassert_equal(chk.matched, 1, NULL);
+	zassert_equal(chk.bad, 0, NULL);
+}
+
+ZTEST(punch_log, test_segments)
+{
+	const struct punch_log_segment *seg;
+	struct walk_check chk = { 0 };
+	uint32_t records = 0;
+	uint32_t start, len, pos;
+
+	log_punches(2001, 0, CONFIG_SI_VOICE_PUNCH_LOG_BATCH);
+	len = log_read_all(&start);
+
+	/* The segments tile the log, each header holds its own offset */
+	for (pos = 0; pos + sizeof(*seg) <= len; pos += sizeof(*seg) + seg->len) {
+		seg = (const struct punch_log_segment *)&log_buf[pos];
+
+		zassert_equal(seg->start, start + pos, "segment at %u", pos);
+		zassert_between_inclusive(seg->records, 1, CONFIG_SI_VOICE_PUNCH_LOG_BATCH, NULL);
+		if (seg->format == PUNCH_LOG_SEGMENT_RAW) {
+			zassert_equal(seg->len, seg->records * sizeof(struct punch_log_record), NULL);
+		} else {
+			zassert_true(IS_ENABLED(CONFIG_SI_VOICE_PUNCH_LOG_LZ4), NULL);
+			zassert_equal(seg->format, PUNCH_LOG_SEGMENT_LZ4, NULL);
+			zassert_true(seg->len < seg->records * sizeof(struct punch_log_record),
+				     NULL);
+		}
+		records += seg->records;
+	}
+	zassert_equal(pos, len, "segments do not end with the log");
+
+	zassert_ok(punch_log_walk(check_record, &chk), NULL);
+	zassert_equal(records, chk.total, NULL);
+}
+
+ZTEST(punch_log, test_resume)
+{
+	const struct punch_log_segment *seg = (const struct punch_log_segment *)log_buf;
+	struct punch_log_cursor cur;
+	uint32_t start, len, next, mid;
+
+	/* At least two segments */
+	log_punches(3001, 0, CONFIG_SI_VOICE_PUNCH_LOG_BATCH);
+	len = log_read_all(&start);
+	next = start + sizeof(*seg) + seg->len;
+	mid = next + 3;
+	zassert_true(mid < start + len, NULL);
+
+	/* Anywhere in a segment, as a download resumes */
+	zassert_ok(punch_log_seek(&cur, mid), NULL);
+	zassert_equal(punch_log_read(&cur, read_buf, sizeof(read_buf)), start + len - mid, NULL);
+	zassert_mem_equal(read_buf, &log_buf[mid - start], start + len - mid, NULL);
+
+	/* At a segment boundary */
+	zassert_ok(punch_log_seek(&cur, next), NULL);
+	zassert_equal(punch_log_read(&cur, read_buf, sizeof(*seg)), sizeof(*seg), NULL);
+	zassert_equal(((const struct punch_log_segment *)read_buf)->start, next, NULL);
+
+	/* At the end there is nothing to read yet, beyond it nothing to seek */
+	zassert_ok(punch_log_seek(&cur, start + len), NULL);
+	zassert_equal(punch_log_read(&cur, read_buf, sizeof(read_buf)), 0, NULL);
+	zassert_equal(punch_log_seek(&cur, start + len + 1), -ERANGE, NULL);
+	if (start > 0) {
+		zassert_equal(punch_log_seek(&cur, start - 1), -ERANGE, NULL);
+	}
+}
+
+ZTEST(punch_log, test_rotation)
+{
+	struct punch_log_stats before, after;
+	struct punch_log_cursor cur;
+	uint32_t start, end, new_start, new_end;
+	struct walk_check chk = { .siac_id = 4001, .first_seq = 0 };
+	int i;
+
+	punch_log_flush();
+	punch_log_stats_get(&before);
+	punch_log_range(&start, &end);
+
+	/* A download in progress at the oldest segment */
+	zassert_ok(punch_log_seek(&cur, start), NULL);
+	zassert_equal(punch_log_read(&cur, read_buf, 16), 16, NULL);
+
+	after = before;
+	for (i = 0; i < ROTATION_BATCHES && after.rotations == before.rotations; i++) {
+		log_punches(chk.siac_id, i * CONFIG_SI_VOICE_PUNCH_LOG_BATCH,
+			    CONFIG_SI_VOICE_PUNCH_LOG_BATCH);
+		punch_log_stats_get(&after);
+	}
+	zassert_true(after.rotations > before.rotations, "storage partition never filled");
+
+	/* Offsets keep counting, the erased ones are gone */
+	punch_log_range(&new_start, &new_end);
+	zassert_true(new_start > start, NULL);
+	zassert_true(new_end > end, NULL);
+	zassert_equal(punch_log_read(&cur, read_buf, 16), -ERANGE, NULL);
+	zassert_equal(punch_log_seek(&cur, start), -ERANGE, NULL);
+	zassert_ok(punch_log_seek(&cur, new_start), NULL);
+
+	/* Records written after the rotation read back in order */
+	chk.siac_id = 4002;
+	log_punches(chk.siac_id, chk.first_seq, CONFIG_SI_VOICE_PUNCH_LOG_BATCH);
+	zassert_ok(punch_log_walk(check_record, &chk), NULL);
+	zassert_equal(chk.matched, 2 * CONFIG_SI_VOICE_PUNCH_LOG_BATCH, NULL);
+	zassert_equal(chk.bad, 0, NULL);
+}
+
+ZTEST_SUITE(punch_log, NULL, NULL, punch_log_before, NULL, NULL);
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2022 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ztest.h>
+
+/* White box: the response parser and the link state are static */
+#include "s1v3g340.c"
+
+BUILD_ASSERT(CONFIG_S1V3G340_SPI_FALLBACK_ERRORS >= 2, "tests forgive one error of the count");
+
+/* Length field of a response with a result code */
+#define RESULT_LEN	6
+
+///////////////////////////////////////////////////////////////////////
+//  function: rx_put
+//
+//  description:
+//    Writes a response frame with a result code into rx_buffer, as the
+//    speech IC clocks it out, with a checksum when they are on.
+//
+//  argument:
+//    at: offset in rx_buffer
+//
+//  return:
+//    offset in rx_buffer after the frame
+///////////////////////////////////////////////////////////////////////
+static size_t rx_put(size_t at, uint16_t msg_id, uint16_t result)
+{
+	uint8_t *buf = &rx_buffer[at];
+	int len = ISC_MSG_SIZE(RESULT_LEN);
+
+	buf[0] = 0x00;
+	buf[1] = ID_START;
+	buf[2] = _GET_LOW_BYTE(RESULT_LEN);
+	buf[3] = _GET_HIGH_BYTE(RESULT_LEN);
+	buf[4] = _GET_LOW_BYTE(msg_id);
+	buf[5] = _GET_HIGH_BYTE(msg_id);
+	buf[6] = _GET_LOW_BYTE(result);
+	buf[7] = _GET_HIGH_BYTE(result);
+	if (isc_checksum) {
+		len = IscAppendChecksum(buf, sizeof(rx_buffer) - at, len);
+	}
+
+	return at + len;
+}
+
+/* Every test starts at the fastest clock with a clean link */
+static void link_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	zassert_ok(S1V3G340_Spi_Init(), "SPI emulator not ready");
+	zassert_true(spi_clock_count > 2, "the ladder needs three clocks");
+
+	memset(&isc_rx, 0, sizeof(isc_rx));
+	memset(&link_stats, 0, sizeof(link_stats));
+	memset(rx_buffer, 0, sizeof(rx_buffer));
+	isc_checksum = false;
+	link_errors = 0;
+	link_good = 0;
+}
+
+ZTEST(s1v3g340_rx, test_response)
+{
+	size_t end;
+
+	/* Idle bytes before and after the frame */
+	end = rx_put(5, ID_ISC_TEST_RESP, 0);
+	zassert_equal(isc_rx_feed(end + 4, ID_ISC_TEST_RESP), 1, NULL);
+	zassert_false(isc_rx.in_frame, NULL);
+
+	/* A frame for another request is skipped */
+	end = rx_put(0, ID_ISC_AUDIO_CONFIG_RESP, 0);
+	zassert_equal(isc_rx_feed(end, ID_ISC_TEST_RESP), 0, NULL);
+	zassert_equal(link_stats.error_inds, 0, NULL);
+}
+
+ZTEST(s1v3g340_rx, test_split_response)
+{
+	uint8_t frame[ISC_MSG_SIZE(RESULT_LEN) + ISC_CHECKSUM_LEN];
+	size_t len;
+
+	for (int checksum = 0; checksum <= 1; checksum++) {
+		isc_checksum = checksum;
+		len = rx_put(0, ID_ISC_VERSION_RESP, 0);
+		memcpy(frame, rx_buffer, len);
+
+		/* Cut after every byte, the next transfer completes the frame */
+		for (size_t cut = 1; cut < len; cut++) {
+			memset(rx_buffer, 0, sizeof(rx_buffer));
+			memcpy(rx_buffer, frame, cut);
+			zassert_equal(isc_rx_feed(cut, ID_ISC_VERSION_RESP), 0,
+				      "complete after %zu bytes", cut);
+
+			memset(rx_buffer, 0, sizeof(rx_buffer));
+			memcpy(rx_buffer, &frame[cut], len - cut);
+			zassert_equal(isc_rx_feed(RESPONSE_READ_LEN, ID_ISC_VERSION_RESP), 1,
+				      "lost when cut after %zu bytes", cut);
+		}
+	}
+	zassert_equal(link_stats.checksum_errors, 0, NULL);
+}
+
+ZTEST(s1v3g340_rx, test_error_ind)
+{
+	size_t end = rx_put(0, ID_ISC_ERROR_IND, 0x0001);
+
+	zassert_equal(isc_rx_feed(end, ID_ISC_TEST_RESP), -EIO, NULL);
+	zassert_equal(link_stats.error_inds, 1, NULL);
+	/* Without checksums it says nothing about the link */
+	zassert_equal(link_stats.checksum_errors, 0, NULL);
+}
+
+ZTEST(s1v3g340_rx, test_msg_blocked)
+{
+	size_t end = rx_put(0, ID_ISC_MSG_BLOCKED_RESP, ID_ISC_SEQUENCER_CONFIG_REQ);
+
+	zassert_equal(isc_rx_feed(end, ID_ISC_SEQUENCER_CONFIG_RESP), -EBUSY, NULL);
+	zassert_equal(link_stats.blocked, 1, NULL);
+	zassert_equal(link_stats.error_inds, 0, NULL);
+}
+
+ZTEST(s1v3g340_rx, test_result_error)
+{
+	size_t end = rx_put(0, ID_ISC_AUDIO_CONFIG_RESP, 0x0001);
+
+	zassert_equal(isc_rx_feed(end, ID_ISC_AUDIO_CONFIG_RESP), -EIO, NULL);
+	zassert_equal(link_stats.error_inds, 1, NULL);
+}
+
+ZTEST(s1v3g340_rx, test_bad_checksum)
+{
+	size_t end;
+
+	isc_checksum = true;
+	end = rx_put(0, ID_ISC_TEST_RESP, 0);
+	rx_buffer[end - 1] ^= 0x01;
+
+	zassert_equal(isc_rx_feed(end, ID_ISC_TEST_RESP), -EIO, NULL);
+	zassert_equal(link_stats.checksum_errors, 1, NULL);
+	zassert_equal(link_errors, 1, NULL);
+
+	/* The good copy of a retry still gets through */
+	end = rx_put(0, ID_ISC_TEST_RESP, 0);
+	zassert_equal(isc_rx_feed(end, ID_ISC_TEST_RESP), 1, NULL);
+}
+
+ZTEST(s1v3g340_rx, test_error_ind_checksum)
+{
+	size_t end;
+
+	/* With checksums on, the speech IC reports a bad request checksum */
+	isc_checksum = true;
+	end = rx_put(0, ID_ISC_ERROR_IND, 0x0001);
+
+	zassert_equal(isc_rx_feed(end, ID_ISC_TEST_RESP), -EIO, NULL);
+	zassert_equal(link_stats.checksum_errors, 1, NULL);
+	zassert_equal(link_errors, 1, NULL);
+}
+
+ZTEST(s1v3g340_rx, test_noise_start)
+{
+	size_t end;
+
+	/* A start byte followed by a length no frame has */
+	rx_buffer[0] = ID_START;
+	rx_buffer[1] = 0xFF;
+	rx_buffer[2] = 0xFF;
+	end = rx_put(3, ID_ISC_TEST_RESP, 0);
+
+	zassert_equal(isc_rx_feed(end, ID_ISC_TEST_RESP), 1, NULL);
+}
+
+ZTEST_SUITE(s1v3g340_rx, NULL, NULL, link_before, NULL, NULL);
+
+ZTEST(s1v3g340_link, test_fallback_ladder)
+{
+	for (int step = 1; step < spi_clock_count; step++) {
+		for (int i = 0; i < CONFIG_S1V3G340_SPI_FALLBACK_ERRORS; i++) {
+			zassert_equal(spi_clock, step - 1, "lowered after %d errors", i);
+			link_error();
+		}
+		zassert_equal(spi_clock, step, NULL);
+		zassert_equal(spi_cfgs[spi_clock].frequency, CONFIG_S1V3G340_SPI_FREQUENCY >> step,
+			      NULL);
+		zassert_equal(link_stats.fallbacks, step, NULL);
+	}
+
+	/* The lowest clock is kept */
+	for (int i = 0; i < CONFIG_S1V3G340_SPI_FALLBACK_ERRORS; i++) {
+		link_error();
+	}
+	zassert_equal(spi_clock, spi_clock_count - 1, NULL);
+	zassert_equal(spi_cfgs[spi_clock].frequency, CONFIG_S1V3G340_SPI_MIN_FREQUENCY, NULL);
+	zassert_equal(link_stats.fallbacks, spi_clock_count - 1, NULL);
+}
+
+ZTEST(s1v3g340_link, test_good_frames_forgive)
+{
+	size_t end;
+
+	isc_checksum = true;
+	for (int i = 0; i < CONFIG_S1V3G340_SPI_FALLBACK_ERRORS - 1; i++) {
+		link_error();
+	}
+
+	end = rx_put(0, ID_ISC_TEST_RESP, 0);
+	for (int i = 0; i < LINK_GOOD_PER_ERROR; i++) {
+		zassert_equal(isc_rx_feed(end, ID_ISC_TEST_RESP), 1, NULL);
+	}
+	zassert_equal(link_errors, CONFIG_S1V3G340_SPI_FALLBACK_ERRORS - 2, NULL);
+
+	/* One more error does not reach the count */
+	link_error();
+	zassert_equal(spi_clock, 0, NULL);
+	zassert_equal(link_stats.fallbacks, 0, NULL);
+}
+
+ZTEST(s1v3g340_link, test_exchange_retries)
+{
+	uint32_t delay_ms = 0;
+	int64_t start;
+
+	/* Below the clock limit of the emulated IC, before the key-code is
+	 * registered: every attempt gets ISC_MSG_BLOCKED_RESP
+	 */
+	S1V3G340_Hardware_Reset();
+	spi_clock = spi_clock_count - 1;
+
+	start = k_uptime_get();
+	clearTxBuffer();
+	zassert_equal(isc_request(IscEncodeVersionReq(tx_buffer, sizeof(tx_buffer)),
+				  ID_ISC_VERSION_RESP), -EBUSY, NULL);
+
+	zassert_equal(link_stats.requests, CONFIG_S1V3G340_ISC_RETRIES + 1, NULL);
+	zassert_equal(link_stats.blocked, CONFIG_S1V3G340_ISC_RETRIES + 1, NULL);
+	zassert_equal(link_stats.retries, CONFIG_S1V3G340_ISC_RETRIES, NULL);
+	for (int attempt = 0; attempt < CONFIG_S1V3G340_ISC_RETRIES; attempt++) {
+		delay_ms += ISC_RETRY_DELAY_MS << attempt;
+	}
+	zassert_true(k_uptime_get() - start >= delay_ms, "retries not backed off");
+
+	/* The key-code unblocks it */
+	zassert_ok(S1V3G340_Initialize_Audio_Config(), NULL);
+	zassert_equal(link_stats.checksum_errors, 0, NULL);
+}
+
+ZTEST(s1v3g340_link, test_clock_fallback)
+{
+	struct s1v3g340_link_stats stats;
+	uint32_t checksum_errors;
+	int error = -EIO;
+
+	/* Initialize at 8 MHz, recover when the corrupted responses run out
+	 * the retries, until the clock is down to one the IC follows
+	 */
+	S1V3G340_Hardware_Reset();
+	for (int i = 0; i < 20 && (error != 0 || spi_cfgs[spi_clock].frequency >
+						 CONFIG_S1V3G340_EMUL_MAX_SPI_FREQUENCY); i++) {
+		error = S1V3G340_Initialize_Audio_Config();
+		if (error != 0) {
+			error = S1V3G340_Recover();
+		}
+	}
+	zassert_ok(error, NULL);
+
+	S1V3G340_Link_Stats_Get(&stats);
+	zassert_equal(stats.frequency, CONFIG_S1V3G340_EMUL_MAX_SPI_FREQUENCY, NULL);
+	zassert_equal(stats.fallbacks, 2, NULL);
+	zassert_true(stats.checksum_errors >= 2 * CONFIG_S1V3G340_SPI_FALLBACK_ERRORS, NULL);
+
+	/* Clean at the lower clock */
+	checksum_errors = stats.checksum_errors;
+	zassert_ok(S1V3G340_Initialize_Audio_Config(), NULL);
+	zassert_ok(S1V3G340_Play_Phrases((const uint16_t[]){ 0xCA, 0x8E }, 2), NULL);
+	zassert_ok(S1V3G340_Wait_Playback_Done(5000), NULL);
+	S1V3G340_Link_Stats_Get(&stats);
+	zassert_equal(stats.checksum_errors, checksum_errors, NULL);
+	zassert_equal(stats.frequency, CONFIG_S1V3G340_EMUL_MAX_SPI_FREQUENCY, NULL);
+}
+
+ZTEST_SUITE(s1v3g340_link, NULL, NULL, link_before, NULL, NULL);
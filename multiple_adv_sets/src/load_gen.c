@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <zephyr/random/rand32.h>
+
+#include "punch.h"
+
+#if defined(CONFIG_MOCK_STATION_LOAD_GEN)
+
+#define LOAD_GEN_STACK_SIZE	1024
+#define LOAD_GEN_PRIORITY	5
+
+/* First control code of the emulated stations, SPORTident controls start at 31 */
+#define LOAD_GEN_FIRST_CONTROL	31
+
+#define LOAD_GEN_REPORT_INTERVAL_MS	10000
+
+#if defined(CONFIG_LOAD_GEN_ARRIVAL_BURST)
+#define LOAD_GEN_BURST_SIZE	CONFIG_LOAD_GEN_BURST_SIZE
+#else
+#define LOAD_GEN_BURST_SIZE	1
+#endif
+
+/* Mean time between two bursts */
+#define LOAD_GEN_MEAN_INTERVAL_US \
+	(1000000ULL * LOAD_GEN_BURST_SIZE / CONFIG_LOAD_GEN_PUNCH_RATE)
+
+/* -ln(u / 2^32) in 1/1024 units, u in [1, 2^32) */
+static uint32_t neg_ln_q10(uint32_t u)
+{
+	int ip = 31 - __builtin_clz(u);
+	/* Mantissa of u in [1, 2) as Q30 */
+	uint64_t m = ((uint64_t)u << 30) >> ip;
+	uint32_t log2_q10 = ip << 10;
+
+	/* Fractional bits of log2() by repeated squaring */
+	for (int bit = 9; bit >= 0; bit--) {
+		m = (m * m) >> 30;
+		if (m >= (2ULL << 30)) {
+			m >>= 1;
+			log2_q10 |= BIT(bit);
+		}
+	}
+
+	/* ln(2) = 45426 / 65536 */
+	return (((32U << 10) - log2_q10) * 45426ULL) >> 16;
+}
+
+static uint64_t load_gen_interval_us(void)
+{
+	if (IS_ENABLED(CONFIG_LOAD_GEN_ARRIVAL_POISSON)) {
+		/* Exponentially distributed inter-arrival times */
+		return (LOAD_GEN_MEAN_INTERVAL_US * neg_ln_q10(sys_rand32_get() | 1)) >> 10;
+	}
+
+	return LOAD_GEN_MEAN_INTERVAL_US;
+}
+
+static int load_gen_punch(uint32_t race_start_ms)
+{
+	uint32_t race_time_s = (k_uptime_get_32() - race_start_ms) / MSEC_PER_SEC;
+	struct punch punch = {
+		.siac_id = CONFIG_LOAD_GEN_SIAC_ID_BASE +
+			   (sys_rand32_get() % CONFIG_LOAD_GEN_SIAC_IDS),
+		.control = LOAD_GEN_FIRST_CONTROL +
+			   (sys_rand32_get() % CONFIG_LOAD_GEN_STATIONS),
+		.hours = race_time_s / 3600,
+		.minutes = (race_time_s / 60) % 60,
+		.seconds = race_time_s % 60,
+	};
+
+	return punch_submit(&punch);
+}
+
+static void load_gen_thread(void)
+{
+	uint32_t race_start_ms = k_uptime_get_32();
+	uint32_t last_report_ms = race_start_ms;
+	uint64_t next_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	uint32_t generated = 0;
+	uint32_t dropped = 0;
+
+	printk("Load generator: %d stations, %d SIACs, %d punches/s, burst %d, interval %d ms\n",
+	       CONFIG_LOAD_GEN_STATIONS, CONFIG_LOAD_GEN_SIAC_IDS, CONFIG_LOAD_GEN_PUNCH_RATE,
+	       LOAD_GEN_BURST_SIZE, CONFIG_MOCK_STATION_ADV_INTERVAL_MS);
+
+	while (CONFIG_LOAD_GEN_PUNCHES == 0 || generated < CONFIG_LOAD_GEN_PUNCHES) {
+		for (int i = 0; i < LOAD_GEN_BURST_SIZE; i++) {
+			if (load_gen_punch(race_start_ms) != 0) {
+				dropped++;
+			}
+			generated++;
+		}
+
+		if (k_uptime_get_32() - last_report_ms >= LOAD_GEN_REPORT_INTERVAL_MS) {
+			last_report_ms = k_uptime_get_32();
+			printk("Load generator: %u punches generated, %u dropped\n",
+			       generated, dropped);
+		}
+
+		/* Absolute deadlines so the rate does not drift with processing time */
+		next_us += load_gen_interval_us();
+		k_sleep(K_TIMEOUT_ABS_TICKS(k_us_to_ticks_ceil64(next_us)));
+	}
+
+	printk("Load generator done: %u punches generated, %u dropped\n", generated, dropped);
+}
+
+K_THREAD_DEFINE(load_gen_tid, LOAD_GEN_STACK_SIZE, load_gen_thread, NULL, NULL, NULL,
+		LOAD_GEN_PRIORITY, 0, SYS_FOREVER_MS);
+
+void load_gen_start(void)
+{
+	k_thread_start(load_gen_tid);
+}
+
+#else
+
+void load_gen_start(void)
+{
+}
+
+#endif /* CONFIG_MOCK_STATION_LOAD_GEN */
@@ -6,9 +6,10 @@
 
 #include <zephyr/kernel.h>
 #include <zephyr/sys/printk.h>
+#include <zephyr/sys/byteorder.h>
+#include <string.h>
 
 #include <zephyr/bluetooth/bluetooth.h>
-#include <zephyr/bluetooth/conn.h>
 #include <zephyr/bluetooth/uuid.h>
 
 #include <zephyr/settings/settings.h>
@@ -17,26 +18,63 @@
 
 #include <drivers/gpio.h>
 
+#include "punch.h"
+
+/* Non-connectable advertising sets are created once at boot and reused
+ * for every punch, ext_adv[NON_CONNECTABLE_ADV_IDX + n] for n < ADV_POOL_SIZE.
+ */
+#define ADV_POOL_SIZE           CONFIG_MOCK_STATION_ADV_POOL_SIZE
 #define NON_CONNECTABLE_ADV_IDX 0
-#define CONNECTABLE_ADV_IDX     1
 
 #define RUN_STATUS_LED          DK_LED1
-#define CON_STATUS_LED          DK_LED2
 #define RUN_LED_BLINK_INTERVAL  1000
 
 #define NON_CONNECTABLE_DEVICE_NAME "SI Beacon"
 
-#define BLE_ADV_TIMEOUT		(50)	//  N * 10ms for advertiser timeout
-#define BLE_ADV_EVENTS		(5)
+/* Advertising interval in 0.625 ms units */
+#define ADV_INTERVAL(ms)	((ms) * 8 / 5)
+#define ADV_INTERVAL_MIN	ADV_INTERVAL(CONFIG_MOCK_STATION_ADV_INTERVAL_MS)
+#define ADV_INTERVAL_MAX	ADV_INTERVAL(CONFIG_MOCK_STATION_ADV_INTERVAL_MS + 10)
+
+#define BLE_ADV_EVENTS		CONFIG_MOCK_STATION_ADV_EVENTS
+//  N * 10ms for advertiser timeout, a safety net behind the event count that
+//  allows for the longest interval and the up to 10 ms random advDelay
+#define BLE_ADV_TIMEOUT		DIV_ROUND_UP(BLE_ADV_EVENTS * (CONFIG_MOCK_STATION_ADV_INTERVAL_MS + 20), 10)
+
+#if defined(CONFIG_MOCK_STATION_ADV_STRATEGY_BURST)
+#define ADV_BURST_EVENTS	CONFIG_MOCK_STATION_ADV_BURST_EVENTS
+#define ADV_BACKOFF_EVENTS	CONFIG_MOCK_STATION_ADV_BACKOFF_EVENTS
+#else
+#define ADV_BURST_EVENTS	0
+#define ADV_BACKOFF_EVENTS	0
+#endif
 
 #define BUTTON0_NODE	DT_NODELABEL(button0)
 #define BUTTON1_NODE	DT_NODELABEL(button1)
 #define BUTTON2_NODE	DT_NODELABEL(button2)
 #define BUTTON3_NODE	DT_NODELABEL(button3)
 
-#define APP_IDLE		0
-#define APP_BLE_ADV		1
+/* Simulated boards such as nrf52_bsim have no buttons */
+#define HAS_BUTTONS	(DT_NODE_EXISTS(BUTTON0_NODE) && DT_NODE_EXISTS(BUTTON1_NODE) && \
+			 DT_NODE_EXISTS(BUTTON2_NODE) && DT_NODE_EXISTS(BUTTON3_NODE))
+
+#define PUNCH_QUEUE_LEN	64
+
+/* Summary interval when every punch is not logged */
+#define PUNCH_SUMMARY_INTERVAL	1000
+
+/* Manufacturer specific data of a punch:
+ *   0xFF, 0xFF                     Manufacturer identifier for SPORTident
+ *   0x07, control, hours, minutes,
+ *   seconds, 0x00, 0x00            Data from Station inc. timestamp
+ *   SIAC ID                        4 bytes, big endian
+ *   sequence number                4 bytes, big endian
+ * followed by zero padding up to CONFIG_MOCK_STATION_PAYLOAD_LEN.
+ */
+#define PUNCH_SIAC_ID_OFFSET	9
+#define PUNCH_SEQ_OFFSET	13
 
+#if HAS_BUTTONS
 static const struct gpio_dt_spec button0_spec = GPIO_DT_SPEC_GET(BUTTON0_NODE, gpios);
 static const struct gpio_dt_spec button1_spec = GPIO_DT_SPEC_GET(BUTTON1_NODE, gpios);
 static const struct gpio_dt_spec button2_spec = GPIO_DT_SPEC_GET(BUTTON2_NODE, gpios);
@@ -46,230 +84,292 @@ static struct gpio_callback button0_cb;
 static struct gpio_callback button1_cb;
 static struct gpio_callback button2_cb;
 static struct gpio_callback button3_cb;
+#endif
 
-static void advertising_work_handle(struct k_work *work);
+K_MSGQ_DEFINE(punch_msgq, sizeof(struct punch), PUNCH_QUEUE_LEN, 4);
 
-static K_WORK_DEFINE(advertising_work, advertising_work_handle);
+static atomic_t punch_seq;
+static uint32_t punch_count;
+static uint32_t punch_failed;
+static uint32_t punch_preempted;
+
+BUILD_ASSERT(NON_CONNECTABLE_ADV_IDX + ADV_POOL_SIZE <= CONFIG_BT_EXT_ADV_MAX_ADV_SET,
+	     "ADV_POOL_SIZE exceeds CONFIG_BT_EXT_ADV_MAX_ADV_SET");
 
 static struct bt_le_ext_adv *ext_adv[CONFIG_BT_EXT_ADV_MAX_ADV_SET];
+#if defined(CONFIG_MOCK_STATION_ADV_STRATEGY_BURST)
+/* Exact intervals, a burst stretched by 10 ms per event would not be dense */
+static const struct bt_le_adv_param *non_connectable_adv_param =
+	BT_LE_ADV_PARAM(BT_LE_ADV_OPT_USE_NAME,
+			ADV_INTERVAL(CONFIG_MOCK_STATION_ADV_BURST_INTERVAL_MS),
+			ADV_INTERVAL(CONFIG_MOCK_STATION_ADV_BURST_INTERVAL_MS),
+			NULL);
+static const struct bt_le_adv_param *backoff_adv_param =
+	BT_LE_ADV_PARAM(BT_LE_ADV_OPT_USE_NAME,
+			ADV_INTERVAL(CONFIG_MOCK_STATION_ADV_BACKOFF_INTERVAL_MS),
+			ADV_INTERVAL(CONFIG_MOCK_STATION_ADV_BACKOFF_INTERVAL_MS),
+			NULL);
+#else
 static const struct bt_le_adv_param *non_connectable_adv_param =
 	BT_LE_ADV_PARAM(BT_LE_ADV_OPT_USE_NAME,
-			// 0x140, /* 200 ms */
-			0xA0,  /* 100 ms */
-			// 0x190, /* 250 ms */
-			0xB0,  /* 110 ms */
+			ADV_INTERVAL_MIN,
+			ADV_INTERVAL_MAX,
 			NULL);
+#endif
 
-static struct bt_data non_connectable_data[] = {
+/* Pool sets that are still advertising, cleared from the sent callback */
+static ATOMIC_DEFINE(adv_pool_active, ADV_POOL_SIZE);
+/* Sets in the burst of the burst strategy, and sets whose burst is done
+ * and that wait for the back-off to be started
+ */
+static ATOMIC_DEFINE(adv_pool_burst, ADV_POOL_SIZE);
+static ATOMIC_DEFINE(adv_pool_backoff, ADV_POOL_SIZE);
+/* Sets left with the back-off parameters */
+static ATOMIC_DEFINE(adv_pool_slow, ADV_POOL_SIZE);
+/* The main thread and the back-off work both start and stop sets */
+static K_MUTEX_DEFINE(adv_pool_lock);
+static uint32_t adv_pool_last_used[ADV_POOL_SIZE];
+static uint32_t adv_pool_use_count;
+
+static uint8_t punch_mfg_data[CONFIG_MOCK_STATION_PAYLOAD_LEN];
+
+/* Flags, manufacturer data and at least one character of the name (USE_NAME) */
+BUILD_ASSERT(3 + 2 + CONFIG_MOCK_STATION_PAYLOAD_LEN + 2 + 1 <= BT_GAP_ADV_MAX_ADV_DATA_LEN,
+	     "Punch payload leaves no room for the device name");
+
+static const struct bt_data punch_ad[] = {
 	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
-	BT_DATA_BYTES(BT_DATA_MANUFACTURER_DATA, /* Manufacturer specific data */
-		      0xFF, 0xFF, /* Manufacturer identifier for SPORTident */
-		      0x07, 0x00 /*control no:*/, 0x01 /*hours*/, 0x0C /*minutes*/, 0x00, 0x00, 0x00,  /* Data from Station inc. timestamp */
-			  0x00, 0x00, 0x00, 0x01	/* SIAC ID */)
+	BT_DATA(BT_DATA_MANUFACTURER_DATA, punch_mfg_data, sizeof(punch_mfg_data)),
 };
 
-static struct bt_data non_connectable_data0[] = {
-	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
-	BT_DATA_BYTES(BT_DATA_MANUFACTURER_DATA, /* Manufacturer specific data */
-			0xFF, 0xFF, /* Manufacturer identifier for SPORTident */
-			0x07, 0x01, 0x00, 0x0C, 0x00, 0x00, 0x00,  /* Data from Station inc. timestamp */
-			0x00, 0x00, 0x00, 0x01	/* SIAC ID */)
-	};
+/* Punches emulated by the four buttons on the DK */
+static const struct punch mock_station_punches[] = {
+	{ .control = 0x01, .hours = 0x00, .minutes = 0x0C, .siac_id = 1 },
+	{ .control = 0x02, .hours = 0x00, .minutes = 0x20, .siac_id = 2 },
+	{ .control = 0x03, .hours = 0x01, .minutes = 0x03, .siac_id = 3 },
+	{ .control = 0x04, .hours = 0x01, .minutes = 0x16, .siac_id = 4 },
+};
 
-static struct bt_data non_connectable_data1[] = {
-	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
-	BT_DATA_BYTES(BT_DATA_MANUFACTURER_DATA, /* Manufacturer specific data */
-			0xFF, 0xFF, /* Manufacturer identifier for SPORTident */
-			0x07, 0x02, 0x00, 0x20, 0x00, 0x00, 0x00,  /* Data from Station inc. timestamp */
-			0x00, 0x00, 0x00, 0x02	/* SIAC ID */)
-	};
+static void adv_backoff_work_handler(struct k_work *work);
+static K_WORK_DEFINE(adv_backoff_work, adv_backoff_work_handler);
 
-static struct bt_data non_connectable_data2[] = {
-	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
-	BT_DATA_BYTES(BT_DATA_MANUFACTURER_DATA, /* Manufacturer specific data */
-			0xFF, 0xFF, /* Manufacturer identifier for SPORTident */
-			0x07, 0x03, 0x01, 0x03, 0x00, 0x00, 0x00,  /* Data from Station inc. timestamp */
-			0x00, 0x00, 0x00, 0x03	/* SIAC ID */)
-	};
+static void adv_sent_cb(struct bt_le_ext_adv *adv,
+			struct bt_le_ext_adv_sent_info *info)
+{
+	for (int i = 0; i < ADV_POOL_SIZE; i++) {
+		if (ext_adv[NON_CONNECTABLE_ADV_IDX + i] == adv) {
+			if (atomic_test_and_clear_bit(adv_pool_burst, i) && ADV_BACKOFF_EVENTS > 0) {
+				/* Still busy, the set cannot be reconfigured from here */
+				atomic_set_bit(adv_pool_backoff, i);
+				k_work_submit(&adv_backoff_work);
+			} else {
+				atomic_clear_bit(adv_pool_active, i);
+			}
+			break;
+		}
+	}
+}
 
-static struct bt_data non_connectable_data3[] = {
-	BT_DATA_BYTES(BT_DATA_FLAGS, BT_LE_AD_NO_BREDR),
-	BT_DATA_BYTES(BT_DATA_MANUFACTURER_DATA, /* Manufacturer specific data */
-			0xFF, 0xFF, /* Manufacturer identifier for SPORTident */
-			0x07, 0x04, 0x01, 0x16, 0x00, 0x00, 0x00,  /* Data from Station inc. timestamp */
-			0x00, 0x00, 0x00, 0x04	/* SIAC ID */)
-	};
-
-static void adv_connected_cb(struct bt_le_ext_adv *adv,
-			     struct bt_le_ext_adv_connected_info *info)
+/* Restarts the sets whose burst is done at the back-off interval */
+static void adv_backoff_work_handler(struct k_work *work)
 {
-	printk("Advertiser[%d] %p connected conn %p\n", bt_le_ext_adv_get_index(adv),
-		adv, info->conn);
+#if defined(CONFIG_MOCK_STATION_ADV_STRATEGY_BURST)
+	k_mutex_lock(&adv_pool_lock, K_FOREVER);
+
+	for (int i = 0; i < ADV_POOL_SIZE; i++) {
+		struct bt_le_ext_adv *adv_set = ext_adv[NON_CONNECTABLE_ADV_IDX + i];
+		int err;
+
+		/* Cleared when the set was taken for a new punch meanwhile */
+		if (!atomic_test_and_clear_bit(adv_pool_backoff, i)) {
+			continue;
+		}
+
+		err = bt_le_ext_adv_update_param(adv_set, backoff_adv_param);
+		if (!err) {
+			atomic_set_bit(adv_pool_slow, i);
+			err = bt_le_ext_adv_start(adv_set,
+						  BT_LE_EXT_ADV_START_PARAM(0, ADV_BACKOFF_EVENTS));
+		}
+		if (err) {
+			atomic_clear_bit(adv_pool_active, i);
+			printk("Failed to start the back-off (err %d)\n", err);
+		}
+	}
+
+	k_mutex_unlock(&adv_pool_lock);
+#endif
 }
 
 static const struct bt_le_ext_adv_cb adv_cb = {
-	.connected = adv_connected_cb
+	.sent = adv_sent_cb,
 };
 
-static void connectable_adv_start(void)
+static int advertising_pool_create(void)
 {
 	int err;
 
-	err = bt_le_ext_adv_start(ext_adv[CONNECTABLE_ADV_IDX], BT_LE_EXT_ADV_START_DEFAULT);
+	err = bt_set_name(NON_CONNECTABLE_DEVICE_NAME);
 	if (err) {
-		printk("Failed to start connectable advertising (err %d)\n", err);
+		printk("Failed to set device name (err %d)\n", err);
+		return err;
 	}
-}
 
-static void advertising_work_handle(struct k_work *work)
-{
-	connectable_adv_start();
-}
-
-static void connected(struct bt_conn *conn, uint8_t err)
-{
-	char addr[BT_ADDR_LE_STR_LEN];
-
-	if (err) {
-		printk("Connection failed (err %u)\n", err);
-		return;
+	for (int i = 0; i < ADV_POOL_SIZE; i++) {
+		err = bt_le_ext_adv_create(non_connectable_adv_param, &adv_cb,
+					   &ext_adv[NON_CONNECTABLE_ADV_IDX + i]);
+		if (err) {
+			printk("Failed to create a non-connectable advertising set (err %d)\n", err);
+			return err;
+		}
 	}
 
-	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+	printk("Created %d advertising sets\n", ADV_POOL_SIZE);
 
-	dk_set_led_on(CON_STATUS_LED);
+#if defined(CONFIG_MOCK_STATION_ADV_STRATEGY_BURST)
+	printk("Advertising strategy: burst of %d events at %d ms, then %d at %d ms\n",
+	       ADV_BURST_EVENTS, CONFIG_MOCK_STATION_ADV_BURST_INTERVAL_MS,
+	       ADV_BACKOFF_EVENTS, CONFIG_MOCK_STATION_ADV_BACKOFF_INTERVAL_MS);
+#else
+	printk("Advertising strategy: %d events at %d-%d ms\n", BLE_ADV_EVENTS,
+	       CONFIG_MOCK_STATION_ADV_INTERVAL_MS, CONFIG_MOCK_STATION_ADV_INTERVAL_MS + 10);
+#endif
 
-	printk("Connected %s\n", addr);
+	return 0;
 }
 
-static void disconnected(struct bt_conn *conn, uint8_t reason)
+/* Least recently used idle set, or the least recently used set if all are busy */
+static int advertising_pool_get(void)
 {
-	char addr[BT_ADDR_LE_STR_LEN];
-
-	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
+	int idle = -1;
+	int oldest = 0;
 
-	dk_set_led_off(CON_STATUS_LED);
-
-	printk("Disconnected: %s (reason %u)\n", addr, reason);
+	for (int i = 0; i < ADV_POOL_SIZE; i++) {
+		if (!atomic_test_bit(adv_pool_active, i) &&
+		    (idle < 0 || adv_pool_last_used[i] < adv_pool_last_used[idle])) {
+			idle = i;
+		}
+		if (adv_pool_last_used[i] < adv_pool_last_used[oldest]) {
+			oldest = i;
+		}
+	}
 
-	/* Process the disconnect logic in the workqueue so that
-	 * the BLE stack is finished with the connection bookkeeping
-	 * logic and advertising is possible.
-	 */
-	k_work_submit(&advertising_work);
+	return (idle >= 0) ? idle : oldest;
 }
 
-BT_CONN_CB_DEFINE(conn_callbacks) = {
-	.connected = connected,
-	.disconnected = disconnected,
-};
-
-static int advertising_set_create(struct bt_le_ext_adv **adv,
-				  const struct bt_le_adv_param *param,
-				  const struct bt_data *ad, size_t ad_len)
+static int non_connectable_adv_start(const struct bt_data *ad, size_t ad_len)
 {
+	int slot = advertising_pool_get();
+	struct bt_le_ext_adv *adv_set = ext_adv[NON_CONNECTABLE_ADV_IDX + slot];
 	int err;
-	struct bt_le_ext_adv *adv_set;
 
-	err = bt_le_ext_adv_create(param, &adv_cb,
-				   adv);
-	if (err) {
-		return err;
-	}
+	adv_pool_last_used[slot] = ++adv_pool_use_count;
 
-	adv_set = *adv;
+	if (atomic_test_and_clear_bit(adv_pool_active, slot)) {
+		/* Every set is busy, cut the oldest punch short */
+		punch_preempted++;
+		atomic_clear_bit(adv_pool_burst, slot);
+		atomic_clear_bit(adv_pool_backoff, slot);
+		err = bt_le_ext_adv_stop(adv_set);
+		if (err) {
+			printk("Failed to stop advertising (err %d)\n", err);
+			return err;
+		}
+	}
 
-	printk("Created adv: %p\n", adv_set);
+#if defined(CONFIG_MOCK_STATION_ADV_STRATEGY_BURST)
+	if (atomic_test_and_clear_bit(adv_pool_slow, slot)) {
+		err = bt_le_ext_adv_update_param(adv_set, non_connectable_adv_param);
+		if (err) {
+			atomic_set_bit(adv_pool_slow, slot);
+			printk("Failed to restore the burst interval (err %d)\n", err);
+			return err;
+		}
+	}
+#endif
 
-	err = bt_le_ext_adv_set_data(adv_set, ad, ad_len,
-				     NULL, 0);
+	err = bt_le_ext_adv_set_data(adv_set, ad, ad_len, NULL, 0);
 	if (err) {
 		printk("Failed to set advertising data (err %d)\n", err);
 		return err;
 	}
 
-	return bt_le_ext_adv_start(adv_set, BT_LE_EXT_ADV_START_PARAM(BLE_ADV_TIMEOUT, BLE_ADV_EVENTS));
+	atomic_set_bit(adv_pool_active, slot);
+	if (IS_ENABLED(CONFIG_MOCK_STATION_ADV_STRATEGY_BURST)) {
+		atomic_set_bit(adv_pool_burst, slot);
+		err = bt_le_ext_adv_start(adv_set, BT_LE_EXT_ADV_START_PARAM(0, ADV_BURST_EVENTS));
+	} else {
+		err = bt_le_ext_adv_start(adv_set,
+					  BT_LE_EXT_ADV_START_PARAM(BLE_ADV_TIMEOUT, BLE_ADV_EVENTS));
+	}
+	if (err) {
+		atomic_clear_bit(adv_pool_burst, slot);
+		atomic_clear_bit(adv_pool_active, slot);
+		printk("Failed to start advertising (err %d)\n", err);
+	}
+
+	return err;
 }
 
-static int non_connectable_adv_create(int mockStationNumber)
+static int punch_advertise(const struct punch *punch)
 {
 	int err;
 
-	err = bt_set_name(NON_CONNECTABLE_DEVICE_NAME);
-	if (err) {
-		printk("Failed to set device name (err %d)\n", err);
-		return err;
-	}
-	
-	if (mockStationNumber == 0)
-	{
-		err = advertising_set_create(&ext_adv[NON_CONNECTABLE_ADV_IDX], non_connectable_adv_param,
-				     non_connectable_data0, ARRAY_SIZE(non_connectable_data0));
-		if (err) {
-			printk("Failed to create a non-connectable advertising set (err %d)\n", err);
-		}
-	} else if (mockStationNumber == 1)
-	{
-		err = advertising_set_create(&ext_adv[NON_CONNECTABLE_ADV_IDX], non_connectable_adv_param,
-				     non_connectable_data1, ARRAY_SIZE(non_connectable_data1));
-		if (err) {
-			printk("Failed to create a non-connectable advertising set (err %d)\n", err);
-		}
-	} else if (mockStationNumber == 2)
-	{
-		err = advertising_set_create(&ext_adv[NON_CONNECTABLE_ADV_IDX], non_connectable_adv_param,
-				     non_connectable_data2, ARRAY_SIZE(non_connectable_data2));
-		if (err) {
-			printk("Failed to create a non-connectable advertising set (err %d)\n", err);
-		}
-	} else if (mockStationNumber == 3)
-	{
-		err = advertising_set_create(&ext_adv[NON_CONNECTABLE_ADV_IDX], non_connectable_adv_param,
-				     non_connectable_data3, ARRAY_SIZE(non_connectable_data3));
-		if (err) {
-			printk("Failed to create a non-connectable advertising set (err %d)\n", err);
-		}
-	}  else
-	{
-		err = advertising_set_create(&ext_adv[NON_CONNECTABLE_ADV_IDX], non_connectable_adv_param,
-				     non_connectable_data, ARRAY_SIZE(non_connectable_data));
-		if (err) {
-			printk("Failed to create a non-connectable advertising set (err %d)\n", err);
-		}
-	}
+	(void)memset(punch_mfg_data, 0, sizeof(punch_mfg_data));
+
+	punch_mfg_data[0] = 0xFF;
+	punch_mfg_data[1] = 0xFF;
+	punch_mfg_data[2] = 0x07;
+	punch_mfg_data[3] = punch->control;
+	punch_mfg_data[4] = punch->hours;
+	punch_mfg_data[5] = punch->minutes;
+	punch_mfg_data[6] = punch->seconds;
+	sys_put_be32(punch->siac_id, &punch_mfg_data[PUNCH_SIAC_ID_OFFSET]);
+	sys_put_be32(punch->seq, &punch_mfg_data[PUNCH_SEQ_OFFSET]);
+
+	k_mutex_lock(&adv_pool_lock, K_FOREVER);
+	err = non_connectable_adv_start(punch_ad, ARRAY_SIZE(punch_ad));
+	k_mutex_unlock(&adv_pool_lock);
 
 	return err;
 }
 
-int app_state = APP_IDLE;
-int mock_adv_station = 0;
+int punch_submit(struct punch *punch)
+{
+	punch->pressed_at = k_cycle_get_32();
+	punch->seq = (uint32_t)atomic_inc(&punch_seq);
 
+	/* May be called from interrupt context, drop the punch if the queue is full */
+	return k_msgq_put(&punch_msgq, punch, K_NO_WAIT);
+}
+
+static void mock_station_punch(int mockStationNumber)
+{
+	struct punch punch = mock_station_punches[mockStationNumber];
+
+	(void)punch_submit(&punch);
+}
+
+#if HAS_BUTTONS
 // Callback function when button 0 is pressed
 void button0_pressed_callback(const struct device *gpiob, struct gpio_callback *cb, gpio_port_pins_t pins) {
-	printk("Button 0 pressed!!\n");
-	mock_adv_station = 0;
-	app_state = APP_BLE_ADV;
+	mock_station_punch(0);
 }
 
 // Callback function when button 1 is pressed
 void button1_pressed_callback(const struct device *gpiob, struct gpio_callback *cb, gpio_port_pins_t pins) {
-	printk("Button 1 pressed!!\n");
-	mock_adv_station = 1;
-	app_state = APP_BLE_ADV;
+	mock_station_punch(1);
 }
 
 // Callback function when button 2 is pressed
 void button2_pressed_callback(const struct device *gpiob, struct gpio_callback *cb, gpio_port_pins_t pins) {
-	printk("Button 2 pressed!!\n");
-	mock_adv_station = 2;
-	app_state = APP_BLE_ADV;
+	mock_station_punch(2);
 }
 // Callback function when button 3 is pressed
 void button3_pressed_callback(const struct device *gpiob, struct gpio_callback *cb, gpio_port_pins_t pins) {
-	printk("Button 3 pressed!!\n");
-	mock_adv_station = 3;
-	app_state = APP_BLE_ADV;
+	mock_station_punch(3);
 }
+#endif
 
 void main(void)
 {
@@ -277,11 +377,13 @@ void main(void)
 
 	printk("Starting Bluetooth multiple advertising sets example\n");
 
+#if defined(CONFIG_DK_LIBRARY)
 	err = dk_leds_init();
 	if (err) {
 		printk("LEDs init failed (err %d)\n", err);
 		return;
 	}
+#endif
 
 	err = bt_enable(NULL);
 	if (err) {
@@ -291,6 +393,12 @@ void main(void)
 
 	printk("Bluetooth initialized\n");
 
+	err = advertising_pool_create();
+	if (err) {
+		return;
+	}
+
+#if HAS_BUTTONS
 	// Button 0 config
 	gpio_pin_configure_dt(&button0_spec, GPIO_INPUT);
 	gpio_pin_interrupt_configure_dt(&button0_spec, GPIO_INT_EDGE_TO_ACTIVE);
@@ -314,36 +422,38 @@ void main(void)
 	gpio_pin_interrupt_configure_dt(&button3_spec, GPIO_INT_EDGE_TO_ACTIVE);
 	gpio_init_callback(&button3_cb, button3_pressed_callback, BIT(button3_spec.pin));
 	gpio_add_callback(button3_spec.port, &button3_cb);
+#endif
+
+	if (IS_ENABLED(CONFIG_MOCK_STATION_LOAD_GEN)) {
+		load_gen_start();
+	} else if (IS_ENABLED(CONFIG_MOCK_STATION_RACE_REPLAY)) {
+		race_replay_start();
+	}
 
 	while (1)
 	{
-		switch (app_state)
-		{
-		case APP_IDLE:
-		k_msleep(1000);
-			break;
-		
-		case APP_BLE_ADV:
-			printk("Entered case APP_BLE_ADV\n");
-			if (mock_adv_station == 0)
-			{
-				err = non_connectable_adv_create(0);
-			} else if (mock_adv_station == 1)
-			{
-				err = non_connectable_adv_create(1);
-			} else if (mock_adv_station == 2)
-			{
-				err = non_connectable_adv_create(2);
-			} else if (mock_adv_station == 3)
-			{
-				err = non_connectable_adv_create(3);
-			}
-			printk("Non-connectable advertising started\n");
-			app_state = APP_IDLE;
-			break;
-		
-		default:
-			break;
+		struct punch punch;
+		uint32_t started_at;
+
+		k_msgq_get(&punch_msgq, &punch, K_FOREVER);
+
+		err = punch_advertise(&punch);
+		started_at = k_cycle_get_32();
+		punch_count++;
+		if (err) {
+			punch_failed++;
+		}
+
+		if (IS_ENABLED(CONFIG_MOCK_STATION_PUNCH_LOG)) {
+			/* Timestamps are in microseconds since boot for end-to-end latency measurement */
+			printk("Punch %u: SIAC %u control %u pressed at %llu us, advertising %s after %u us\n",
+			       punch.seq, punch.siac_id, punch.control,
+			       k_cyc_to_us_floor64(punch.pressed_at),
+			       err ? "failed" : "started",
+			       k_cyc_to_us_floor32(started_at - punch.pressed_at));
+		} else if ((punch_count % PUNCH_SUMMARY_INTERVAL) == 0) {
+			printk("%u punches advertised, %u cut short, %u failed\n",
+			       punch_count, punch_preempted, punch_failed);
 		}
 	}
-}
\ No newline at end of file
+}
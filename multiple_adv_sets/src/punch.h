@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#ifndef PUNCH_H_
+#define PUNCH_H_
+
+#include <zephyr/kernel.h>
+
+/* Punch advertised by an emulated SI station */
+struct punch {
+	uint32_t siac_id;
+	uint32_t seq;		/* assigned by punch_submit() */
+	uint32_t pressed_at;	/* k_cycle_get_32(), assigned by punch_submit() */
+	uint8_t control;
+	uint8_t hours;
+	uint8_t minutes;
+	uint8_t seconds;
+};
+
+/* Timestamps the punch, gives it the next sequence number and queues it
+ * for advertising. Safe to call from interrupt context.
+ *
+ * Returns 0 on success, -ENOMSG if the queue is full.
+ */
+int punch_submit(struct punch *punch);
+
+void load_gen_start(void);
+void race_replay_start(void);
+
+#endif /* PUNCH_H_ */
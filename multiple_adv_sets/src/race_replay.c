@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2021 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/printk.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "punch.h"
+
+#if defined(CONFIG_MOCK_STATION_RACE_REPLAY)
+
+#define RACE_REPLAY_STACK_SIZE	1024
+#define RACE_REPLAY_PRIORITY	5
+
+#define RACE_REPLAY_LINE_LEN	64
+
+/* Compiled-in punch log, CONFIG_RACE_REPLAY_LOG */
+static const char race_log[] = {
+#include "race_log.inc"
+	0x00
+};
+
+static const char *race_log_pos = race_log;
+
+#if defined(CONFIG_ARCH_POSIX)
+#include <stdio.h>
+
+/* Punch log read from the host file system, CONFIG_RACE_REPLAY_FILE */
+static FILE *race_log_file;
+#endif
+
+static bool race_log_next_line(char *line, size_t len)
+{
+#if defined(CONFIG_ARCH_POSIX)
+	if (race_log_file != NULL) {
+		return fgets(line, len, race_log_file) != NULL;
+	}
+#endif
+	size_t n = 0;
+
+	if (*race_log_pos == '\0') {
+		return false;
+	}
+
+	while (*race_log_pos != '\0' && *race_log_pos != '\n') {
+		if (n < len - 1) {
+			line[n++] = *race_log_pos;
+		}
+		race_log_pos++;
+	}
+	if (*race_log_pos == '\n') {
+		race_log_pos++;
+	}
+	line[n] = '\0';
+
+	return true;
+}
+
+/* Parses "siac_id,control,hh:mm:ss", returns the race time in seconds or -1 */
+static int32_t race_log_parse(const char *line, struct punch *punch)
+{
+	char *end;
+	unsigned long siac_id, control, hours, minutes, seconds;
+
+	siac_id = strtoul(line, &end, 10);
+	if (end == line || *end != ',') {
+		return -1;
+	}
+	control = strtoul(end + 1, &end, 10);
+	if (*end != ',') {
+		return -1;
+	}
+	hours = strtoul(end + 1, &end, 10);
+	if (*end != ':') {
+		return -1;
+	}
+	minutes = strtoul(end + 1, &end, 10);
+	if (*end != ':') {
+		return -1;
+	}
+	seconds = strtoul(end + 1, &end, 10);
+	if (control > UINT8_MAX || minutes > 59 || seconds > 59) {
+		return -1;
+	}
+
+	punch->siac_id = siac_id;
+	punch->control = control;
+	punch->hours = hours;
+	punch->minutes = minutes;
+	punch->seconds = seconds;
+
+	return (hours * 3600) + (minutes * 60) + seconds;
+}
+
+static void race_replay_thread(void)
+{
+	char line[RACE_REPLAY_LINE_LEN];
+	int64_t start_ticks;
+	int32_t first_s = -1;
+	int32_t last_s = 0;
+	uint32_t replayed = 0;
+	uint32_t dropped = 0;
+	uint32_t line_no = 0;
+
+#if defined(CONFIG_ARCH_POSIX)
+	if (strlen(CONFIG_RACE_REPLAY_FILE) > 0) {
+		race_log_file = fopen(CONFIG_RACE_REPLAY_FILE, "r");
+		if (race_log_file == NULL) {
+			printk("Race replay: cannot open %s\n", CONFIG_RACE_REPLAY_FILE);
+			return;
+		}
+	}
+#endif
+
+	printk("Race replay started, %dx speed\n", CONFIG_RACE_REPLAY_SPEEDUP);
+
+	start_ticks = k_uptime_ticks();
+
+	while (race_log_next_line(line, sizeof(line))) {
+		struct punch punch = { 0 };
+		int32_t race_s;
+		uint64_t offset_us;
+
+		line_no++;
+		if (line[0] == '#' || line[0] == '\0' || line[0] == '\r') {
+			continue;
+		}
+
+		race_s = race_log_parse(line, &punch);
+		if (race_s < 0) {
+			printk("Race replay: skipping malformed line %u\n", line_no);
+			continue;
+		}
+		if (race_s < last_s) {
+			printk("Race replay: line %u is out of order, replayed late\n", line_no);
+			race_s = last_s;
+		}
+		if (first_s < 0) {
+			first_s = race_s;
+		}
+		last_s = race_s;
+
+		/* Punch times are relative to the first punch of the log */
+		offset_us = (uint64_t)(race_s - first_s) * USEC_PER_SEC / CONFIG_RACE_REPLAY_SPEEDUP;
+		k_sleep(K_TIMEOUT_ABS_TICKS(start_ticks + k_us_to_ticks_ceil64(offset_us)));
+
+		if (punch_submit(&punch) != 0) {
+			dropped++;
+		}
+		replayed++;
+	}
+
+#if defined(CONFIG_ARCH_POSIX)
+	if (race_log_file != NULL) {
+		fclose(race_log_file);
+	}
+#endif
+
+	printk("Race replay done: %u punches replayed, %u dropped\n", replayed, dropped);
+}
+
+K_THREAD_DEFINE(race_replay_tid, RACE_REPLAY_STACK_SIZE, race_replay_thread, NULL, NULL, NULL,
+		RACE_REPLAY_PRIORITY, 0, SYS_FOREVER_MS);
+
+void race_replay_start(void)
+{
+	k_thread_start(race_replay_tid);
+}
+
+#else
+
+void race_replay_start(void)
+{
+}
+
+#endif /* CONFIG_MOCK_STATION_RACE_REPLAY */